@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * Compare parse_int64() and parse_double() with the C library functions
+ * on the text forms that the servers send. Build it with
+ * "make bench_numeric" and run it without arguments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jsnumeric.h"
+
+#define VALUES		(1 << 20)
+#define ROUNDS		10
+
+struct sample {
+	const char *name;
+	int integer;
+	/* print a value into a buffer of 32 bytes */
+	void (*format)(char *buf);
+};
+
+static uint64_t state = 88172645463325252ULL;
+
+static uint64_t next_random(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static void format_int4(char *buf)
+{
+	sprintf(buf, "%d", (int)(next_random() % 2000000) - 1000000);
+}
+
+static void format_int8(char *buf)
+{
+	sprintf(buf, "%lld", (long long)next_random());
+}
+
+static void format_money(char *buf)
+{
+	sprintf(buf, "%llu.%02u", (unsigned long long)(next_random() % 1000000), (unsigned int)(next_random() % 100));
+}
+
+static void format_float8(char *buf)
+{
+	sprintf(buf, "%.17g", (double)(next_random() >> 11) / (double)(1ULL << 40));
+}
+
+static void format_scientific(char *buf)
+{
+	sprintf(buf, "%.15g", (double)(next_random() >> 11) * 1e-300);
+}
+
+static const struct sample samples[] = {
+	{"int4", 1, format_int4},
+	{"int8", 1, format_int8},
+	{"numeric(12,2)", 0, format_money},
+	{"float8", 0, format_float8},
+	{"float8, tiny", 0, format_scientific},
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+	char (*text)[32] = malloc(VALUES * sizeof(*text));
+	size_t *len = malloc(VALUES * sizeof(size_t));
+	double start, libc, fast, sum1, sum2, d;
+	unsigned int i, j, k, errors;
+	int64_t ival;
+
+	if (text == NULL || len == NULL) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+
+	printf("%-16s %12s %12s %8s\n", "values", "libc ns", "parser ns", "speedup");
+
+	for (k = 0; k < sizeof(samples) / sizeof(samples[0]); k++) {
+		for (i = 0; i < VALUES; i++) {
+			samples[k].format(text[i]);
+			len[i] = strlen(text[i]);
+		}
+
+		sum1 = sum2 = 0;
+		errors = 0;
+
+		start = now();
+		for (j = 0; j < ROUNDS; j++)
+			for (i = 0; i < VALUES; i++)
+				sum1 += samples[k].integer ? (double)strtoll(text[i], NULL, 10) : strtod(text[i], NULL);
+		libc = now() - start;
+
+		start = now();
+		for (j = 0; j < ROUNDS; j++)
+			for (i = 0; i < VALUES; i++) {
+				if (samples[k].integer) {
+					errors += !parse_int64(text[i], len[i], &ival);
+					d = (double)ival;
+				} else
+					errors += !parse_double(text[i], len[i], &d);
+				sum2 += d;
+			}
+		fast = now() - start;
+
+		/* The sums also keep the compiler from dropping the loops */
+		if (errors || sum1 != sum2) {
+			fprintf(stderr, "%s: the results differ\n", samples[k].name);
+			return 1;
+		}
+
+		printf("%-16s %12.1f %12.1f %7.1fx\n", samples[k].name,
+				libc * 1e9 / ROUNDS / VALUES, fast * 1e9 / ROUNDS / VALUES, libc / fast);
+	}
+
+	free(text);
+	free(len);
+	return 0;
+}
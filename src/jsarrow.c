@@ -0,0 +1,628 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jsmisc.h>
+#include "jscommon.h"
+#include "jsarrow.h"
+
+/* {{{ FlatBuffers builder */
+
+/*
+ * Arrow metadata is serialized with FlatBuffers. The few tables needed
+ * here are built with a small builder that works like the reference
+ * implementation: the buffer is filled from the end towards the start,
+ * so that objects are always written before the ones that refer to them
+ * and offsets are computed relative to the end of the buffer.
+ */
+
+#define FB_MAX_FIELDS		8
+
+struct fb_builder {
+	duk_context *ctx;
+	duk_idx_t idx;
+	unsigned char *buf;
+	duk_size_t size;
+	/* the used part of the buffer is [head, size) */
+	duk_size_t head;
+	duk_size_t minalign;
+	uint32_t vtable[FB_MAX_FIELDS];
+	int nfields;
+	uint32_t object_end;
+};
+
+static void fb_reset(struct fb_builder *b)
+{
+	b->head = b->size;
+	b->minalign = 1;
+}
+
+static inline uint32_t fb_offset(struct fb_builder *b)
+{
+	return b->size - b->head;
+}
+
+static void fb_grow(struct fb_builder *b, duk_size_t len)
+{
+	duk_size_t used = b->size - b->head, size = b->size;
+
+	if (len <= b->head)
+		return;
+
+	while (size < used + len)
+		size *= 2;
+
+	b->buf = duk_resize_buffer(b->ctx, b->idx, size);
+	memmove(b->buf + size - used, b->buf + b->head, used);
+	b->head = size - used;
+	b->size = size;
+}
+
+static void fb_pad(struct fb_builder *b, duk_size_t n)
+{
+	b->head -= n;
+	memset(b->buf + b->head, 0, n);
+}
+
+/*
+ * Align the buffer so that @size bytes can be written at an offset that
+ * is a multiple of @size, after @additional more bytes are written.
+ */
+static void fb_prep(struct fb_builder *b, duk_size_t size, duk_size_t additional)
+{
+	duk_size_t pad;
+
+	if (size > b->minalign)
+		b->minalign = size;
+
+	pad = (~(fb_offset(b) + additional) + 1) & (size - 1);
+	fb_grow(b, pad + size + additional);
+	fb_pad(b, pad);
+}
+
+/* FlatBuffers are little endian, whatever the host is */
+static void fb_place(struct fb_builder *b, uint64_t value, int n)
+{
+	int i;
+
+	b->head -= n;
+	for (i = 0; i < n; i++, value >>= 8)
+		b->buf[b->head + i] = value & 0xff;
+}
+
+static void fb_scalar(struct fb_builder *b, uint64_t value, int n)
+{
+	fb_prep(b, n, 0);
+	fb_place(b, value, n);
+}
+
+static void fb_uoffset(struct fb_builder *b, uint32_t off)
+{
+	fb_prep(b, 4, 0);
+	fb_place(b, fb_offset(b) - off + 4, 4);
+}
+
+static void fb_start_table(struct fb_builder *b, int nfields)
+{
+	memset(b->vtable, 0, sizeof(b->vtable));
+	b->nfields = nfields;
+	b->object_end = fb_offset(b);
+}
+
+/* Add a scalar field; fields equal to their default may be left out */
+static void fb_add_scalar(struct fb_builder *b, int id, uint64_t value, int n)
+{
+	fb_scalar(b, value, n);
+	b->vtable[id] = fb_offset(b);
+}
+
+static void fb_add_offset(struct fb_builder *b, int id, uint32_t off)
+{
+	fb_uoffset(b, off);
+	b->vtable[id] = fb_offset(b);
+}
+
+static uint32_t fb_end_table(struct fb_builder *b)
+{
+	uint32_t object, value;
+	duk_size_t pos;
+	int i;
+
+	/* Placeholder for the offset of the vtable */
+	fb_scalar(b, 0, 4);
+	object = fb_offset(b);
+
+	for (i = b->nfields - 1; i >= 0; i--)
+		fb_scalar(b, b->vtable[i] ? object - b->vtable[i] : 0, 2);
+	fb_scalar(b, object - b->object_end, 2);
+	fb_scalar(b, (b->nfields + 2) * 2, 2);
+
+	/* The vtable precedes the table, so the offset is positive */
+	pos = b->size - object;
+	value = fb_offset(b) - object;
+	for (i = 0; i < 4; i++, value >>= 8)
+		b->buf[pos + i] = value & 0xff;
+
+	return object;
+}
+
+static uint32_t fb_string(struct fb_builder *b, const char *str)
+{
+	duk_size_t len = strlen(str);
+
+	fb_prep(b, 4, len + 1);
+	fb_pad(b, 1);
+	b->head -= len;
+	memcpy(b->buf + b->head, str, len);
+	fb_place(b, len, 4);
+
+	return fb_offset(b);
+}
+
+static void fb_start_vector(struct fb_builder *b, duk_size_t elem_size, duk_size_t n, duk_size_t align)
+{
+	fb_prep(b, 4, elem_size * n);
+	fb_prep(b, align, elem_size * n);
+}
+
+static uint32_t fb_end_vector(struct fb_builder *b, duk_size_t n)
+{
+	fb_grow(b, 4);
+	fb_place(b, n, 4);
+
+	return fb_offset(b);
+}
+
+static void fb_finish(struct fb_builder *b, uint32_t root)
+{
+	fb_prep(b, b->minalign, 4);
+	fb_uoffset(b, root);
+}
+
+/* }}} FlatBuffers builder */
+
+/* {{{ Arrow IPC file writer */
+
+/* Values of the enums and unions from Schema.fbs and Message.fbs */
+#define ARROW_METADATA_V5		4
+#define ARROW_HEADER_SCHEMA		1
+#define ARROW_HEADER_RECORD_BATCH	3
+#define ARROW_TYPE_INT			2
+#define ARROW_TYPE_FLOATING_POINT	3
+#define ARROW_TYPE_BINARY		4
+#define ARROW_TYPE_UTF8			5
+#define ARROW_TYPE_BOOL			6
+#define ARROW_PRECISION_DOUBLE		2
+
+static const char arrow_magic[8] = "ARROW1\0\0";
+static const unsigned char zeros[8];
+
+/* Size of a buffer padded to 8 bytes, as required for the message body */
+static inline int64_t padded(int64_t len)
+{
+	return (len + 7) & ~(int64_t)7;
+}
+
+static void arrow_write(duk_context *ctx, struct arrow_writer *w, const void *data, duk_size_t len)
+{
+	if (write_all(w->fd, data, len))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", strerror(errno));
+	w->offset += len;
+}
+
+static void arrow_builder(duk_context *ctx, struct arrow_writer *w, struct fb_builder *b)
+{
+	b->ctx = ctx;
+	b->idx = w->fb_idx;
+	b->buf = duk_get_buffer(ctx, w->fb_idx, &b->size);
+	fb_reset(b);
+}
+
+static uint32_t arrow_field_type(struct fb_builder *b, int type, int *type_type)
+{
+	switch (type) {
+	case ARROW_INT32:
+	case ARROW_INT64:
+	case ARROW_UINT64:
+		*type_type = ARROW_TYPE_INT;
+		fb_start_table(b, 2);
+		fb_add_scalar(b, 0, type == ARROW_INT32 ? 32 : 64, 4);
+		fb_add_scalar(b, 1, type != ARROW_UINT64, 1);
+		break;
+	case ARROW_FLOAT64:
+		*type_type = ARROW_TYPE_FLOATING_POINT;
+		fb_start_table(b, 1);
+		fb_add_scalar(b, 0, ARROW_PRECISION_DOUBLE, 2);
+		break;
+	case ARROW_BOOL:
+		*type_type = ARROW_TYPE_BOOL;
+		fb_start_table(b, 0);
+		break;
+	case ARROW_BINARY:
+		*type_type = ARROW_TYPE_BINARY;
+		fb_start_table(b, 0);
+		break;
+	default:
+		*type_type = ARROW_TYPE_UTF8;
+		fb_start_table(b, 0);
+	}
+
+	return fb_end_table(b);
+}
+
+/* Build the Schema table, used by the schema message and the footer */
+static uint32_t arrow_schema(duk_context *ctx, struct arrow_writer *w, struct fb_builder *b)
+{
+	const union { uint16_t u; unsigned char c[2]; } host = {1};
+	uint32_t *fields, name, type, children, vec;
+	unsigned int i;
+	int type_type;
+
+	fields = duk_push_fixed_buffer(ctx, (w->len + 1) * sizeof(uint32_t));
+
+	for (i = 0; i < w->len; i++) {
+		name = fb_string(b, w->columns[i].name);
+		type = arrow_field_type(b, w->columns[i].type, &type_type);
+		fb_start_vector(b, 4, 0, 4);
+		children = fb_end_vector(b, 0);
+
+		fb_start_table(b, 6);
+		fb_add_offset(b, 0, name);
+		fb_add_offset(b, 3, type);
+		fb_add_offset(b, 5, children);
+		fb_add_scalar(b, 1, 1, 1);
+		fb_add_scalar(b, 2, type_type, 1);
+		fields[i] = fb_end_table(b);
+	}
+
+	fb_start_vector(b, 4, w->len, 4);
+	for (i = w->len; i > 0; i--)
+		fb_uoffset(b, fields[i - 1]);
+	vec = fb_end_vector(b, w->len);
+
+	duk_pop(ctx);
+
+	fb_start_table(b, 2);
+	fb_add_offset(b, 1, vec);
+	/* Values are stored in host byte order: 0 is little, 1 is big */
+	fb_add_scalar(b, 0, host.c[0] == 0, 2);
+
+	return fb_end_table(b);
+}
+
+/*
+ * Write an encapsulated message: continuation marker, metadata length,
+ * the Message flatbuffer padded to 8 bytes. The body follows. Returns
+ * the length of everything up to the body.
+ */
+static int32_t arrow_message(duk_context *ctx, struct arrow_writer *w, struct fb_builder *b,
+		int header_type, uint32_t header, int64_t body_len)
+{
+	unsigned char prefix[8] = {0xff, 0xff, 0xff, 0xff};
+	uint32_t len;
+
+	fb_start_table(b, 4);
+	fb_add_scalar(b, 3, body_len, 8);
+	fb_add_offset(b, 2, header);
+	fb_add_scalar(b, 0, ARROW_METADATA_V5, 2);
+	fb_add_scalar(b, 1, header_type, 1);
+	fb_finish(b, fb_end_table(b));
+
+	len = padded(fb_offset(b));
+	prefix[4] = len & 0xff;
+	prefix[5] = (len >> 8) & 0xff;
+	prefix[6] = (len >> 16) & 0xff;
+	prefix[7] = len >> 24;
+
+	arrow_write(ctx, w, prefix, sizeof(prefix));
+	arrow_write(ctx, w, b->buf + b->head, fb_offset(b));
+	arrow_write(ctx, w, zeros, len - fb_offset(b));
+
+	return len + sizeof(prefix);
+}
+
+static duk_size_t value_size(int type, duk_size_t rows)
+{
+	switch (type) {
+	case ARROW_INT32:
+		return rows * 4;
+	case ARROW_BOOL:
+		return (rows + 7) / 8;
+	case ARROW_UTF8:
+	case ARROW_BINARY:
+		return (rows + 1) * 4;
+	default:
+		return rows * 8;
+	}
+}
+
+static void reset_batch(struct arrow_writer *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < w->len; i++) {
+		memset(w->columns[i].validity, 0, (w->batch_rows + 7) / 8);
+		if (w->columns[i].type == ARROW_BOOL)
+			memset(w->columns[i].values, 0, (w->batch_rows + 7) / 8);
+		w->columns[i].data_len = 0;
+		w->columns[i].null_count = 0;
+	}
+
+	w->rows = 0;
+}
+
+/*
+ * Write the rows collected so far as a record batch. For each column the
+ * body holds the validity bitmap (empty if there are no nulls), then the
+ * values, or the offsets and the data of variable width columns.
+ */
+static void write_batch(duk_context *ctx, struct arrow_writer *w)
+{
+	struct fb_builder b;
+	struct arrow_column *col;
+	int64_t *layout, body_len = 0, len, offset = w->offset;
+	uint32_t nodes, buffers, header;
+	unsigned int i, j, n = 0;
+	struct arrow_block *block;
+	int32_t meta_len;
+
+	/* Offset and length of each buffer, at most 3 per column */
+	layout = duk_push_fixed_buffer(ctx, (3 * w->len + 1) * 2 * sizeof(int64_t));
+	for (i = 0; i < w->len; i++) {
+		col = &w->columns[i];
+		len = col->null_count ? (w->rows + 7) / 8 : 0;
+		layout[2 * n] = body_len;
+		layout[2 * n++ + 1] = len;
+		body_len += padded(len);
+
+		len = value_size(col->type, w->rows);
+		layout[2 * n] = body_len;
+		layout[2 * n++ + 1] = len;
+		body_len += padded(len);
+
+		if (col->type == ARROW_UTF8 || col->type == ARROW_BINARY) {
+			layout[2 * n] = body_len;
+			layout[2 * n++ + 1] = col->data_len;
+			body_len += padded(col->data_len);
+		}
+	}
+
+	arrow_builder(ctx, w, &b);
+
+	fb_start_vector(&b, 16, w->len, 8);
+	for (i = w->len; i > 0; i--) {
+		fb_prep(&b, 8, 16);
+		fb_scalar(&b, w->columns[i - 1].null_count, 8);
+		fb_scalar(&b, w->rows, 8);
+	}
+	nodes = fb_end_vector(&b, w->len);
+
+	fb_start_vector(&b, 16, n, 8);
+	for (j = n; j > 0; j--) {
+		fb_prep(&b, 8, 16);
+		fb_scalar(&b, layout[2 * (j - 1) + 1], 8);
+		fb_scalar(&b, layout[2 * (j - 1)], 8);
+	}
+	buffers = fb_end_vector(&b, n);
+
+	fb_start_table(&b, 3);
+	fb_add_scalar(&b, 0, w->rows, 8);
+	fb_add_offset(&b, 1, nodes);
+	fb_add_offset(&b, 2, buffers);
+	header = fb_end_table(&b);
+
+	meta_len = arrow_message(ctx, w, &b, ARROW_HEADER_RECORD_BATCH, header, body_len);
+
+	for (i = 0, j = 0; i < w->len; i++) {
+		col = &w->columns[i];
+		arrow_write(ctx, w, col->validity, layout[2 * j + 1]);
+		arrow_write(ctx, w, zeros, padded(layout[2 * j + 1]) - layout[2 * j + 1]);
+		j++;
+		arrow_write(ctx, w, col->values, layout[2 * j + 1]);
+		arrow_write(ctx, w, zeros, padded(layout[2 * j + 1]) - layout[2 * j + 1]);
+		j++;
+		if (col->type == ARROW_UTF8 || col->type == ARROW_BINARY) {
+			arrow_write(ctx, w, col->data, col->data_len);
+			arrow_write(ctx, w, zeros, padded(col->data_len) - col->data_len);
+			j++;
+		}
+	}
+
+	duk_pop(ctx);
+
+	if (w->nblocks == w->blocks_size) {
+		w->blocks_size *= 2;
+		w->blocks = duk_resize_buffer(ctx, w->blocks_idx, w->blocks_size * sizeof(struct arrow_block));
+	}
+	block = &w->blocks[w->nblocks++];
+	block->offset = offset;
+	block->meta_len = meta_len;
+	block->body_len = body_len;
+
+	reset_batch(w);
+}
+
+/**
+ * arrow_init - start writing an Arrow IPC file
+ * @ctx: duktape context
+ * @w: the writer
+ * @fd: output file descriptor
+ * @len: number of columns
+ * @batch_rows: number of rows per record batch
+ *
+ * The buffers are kept on the value stack, so that they are released
+ * even if an error is thrown. Each column must then be described with
+ * arrow_column() before calling arrow_begin().
+ */
+void arrow_init(duk_context *ctx, struct arrow_writer *w, int fd, unsigned int len, duk_size_t batch_rows)
+{
+	duk_require_stack(ctx, 3 * len + 8);
+
+	w->base = duk_get_top(ctx);
+	w->fd = fd;
+	w->len = len;
+	w->batch_rows = batch_rows;
+	w->rows = 0;
+	w->total_rows = 0;
+	w->offset = 0;
+
+	w->columns = duk_push_fixed_buffer(ctx, (len + 1) * sizeof(struct arrow_column));
+	w->blocks_idx = duk_get_top(ctx);
+	w->blocks_size = 16;
+	w->nblocks = 0;
+	w->blocks = duk_push_dynamic_buffer(ctx, w->blocks_size * sizeof(struct arrow_block));
+	w->fb_idx = duk_get_top(ctx);
+	duk_push_dynamic_buffer(ctx, 1024);
+}
+
+/**
+ * arrow_column - describe a column
+ * @ctx: duktape context
+ * @w: the writer
+ * @i: column index (0-based)
+ * @name: column name; it must stay valid until arrow_finish()
+ * @type: one of the ARROW_* types
+ */
+void arrow_column(duk_context *ctx, struct arrow_writer *w, unsigned int i, const char *name, int type)
+{
+	struct arrow_column *col = &w->columns[i];
+
+	col->name = name;
+	col->type = type;
+	col->validity = duk_push_fixed_buffer(ctx, (w->batch_rows + 7) / 8);
+	col->values = duk_push_fixed_buffer(ctx, value_size(type, w->batch_rows));
+	col->data_idx = duk_get_top(ctx);
+	col->data_size = 0;
+	col->data = duk_push_dynamic_buffer(ctx, 0);
+	col->data_len = 0;
+	col->null_count = 0;
+}
+
+/**
+ * arrow_begin - write the file header and the schema
+ * @ctx: duktape context
+ * @w: the writer
+ */
+void arrow_begin(duk_context *ctx, struct arrow_writer *w)
+{
+	struct fb_builder b;
+
+	reset_batch(w);
+
+	arrow_write(ctx, w, arrow_magic, sizeof(arrow_magic));
+	arrow_builder(ctx, w, &b);
+	arrow_message(ctx, w, &b, ARROW_HEADER_SCHEMA, arrow_schema(ctx, w, &b), 0);
+}
+
+/**
+ * arrow_reserve - make room for a variable width value
+ * @ctx: duktape context
+ * @w: the writer
+ * @i: column index (0-based)
+ * @len: maximum length of the value
+ *
+ * Returns a pointer where the value can be stored; the actual length is
+ * then passed to arrow_commit(). Value offsets are 32-bit, which limits
+ * the data of a column to 2 GiB per record batch.
+ */
+unsigned char *arrow_reserve(duk_context *ctx, struct arrow_writer *w, unsigned int i, duk_size_t len)
+{
+	struct arrow_column *col = &w->columns[i];
+	duk_size_t size = col->data_size ? col->data_size : 4096;
+
+	if (len > INT32_MAX - col->data_len)
+		duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s", "Column data exceeds 2 GiB in a record batch, use a smaller batchRows\n");
+
+	if (col->data_len + len > col->data_size) {
+		while (size < col->data_len + len)
+			size *= 2;
+		col->data = duk_resize_buffer(ctx, col->data_idx, size);
+		col->data_size = size;
+	}
+
+	return col->data + col->data_len;
+}
+
+/**
+ * arrow_end_row - complete the current row
+ * @ctx: duktape context
+ * @w: the writer
+ *
+ * A record batch is written when batch_rows rows have been collected.
+ */
+void arrow_end_row(duk_context *ctx, struct arrow_writer *w)
+{
+	struct arrow_column *col;
+	unsigned int i;
+
+	for (i = 0; i < w->len; i++) {
+		col = &w->columns[i];
+		if (col->type == ARROW_UTF8 || col->type == ARROW_BINARY)
+			((int32_t *)col->values)[w->rows + 1] = col->data_len;
+	}
+
+	w->total_rows++;
+	if (++w->rows == w->batch_rows)
+		write_batch(ctx, w);
+}
+
+/**
+ * arrow_finish - write the last record batch and the footer
+ * @ctx: duktape context
+ * @w: the writer
+ *
+ * Everything that arrow_init() and arrow_column() pushed is removed from
+ * the stack.
+ */
+void arrow_finish(duk_context *ctx, struct arrow_writer *w)
+{
+	static const unsigned char eos[8] = {0xff, 0xff, 0xff, 0xff};
+	struct fb_builder b;
+	uint32_t schema, dictionaries, batches, len;
+	unsigned char trailer[4];
+	unsigned int i;
+
+	if (w->rows)
+		write_batch(ctx, w);
+
+	arrow_write(ctx, w, eos, sizeof(eos));
+
+	arrow_builder(ctx, w, &b);
+	schema = arrow_schema(ctx, w, &b);
+
+	fb_start_vector(&b, 24, 0, 8);
+	dictionaries = fb_end_vector(&b, 0);
+
+	fb_start_vector(&b, 24, w->nblocks, 8);
+	for (i = w->nblocks; i > 0; i--) {
+		fb_prep(&b, 8, 24);
+		fb_scalar(&b, w->blocks[i - 1].body_len, 8);
+		fb_pad(&b, 4);
+		fb_scalar(&b, (uint32_t)w->blocks[i - 1].meta_len, 4);
+		fb_scalar(&b, w->blocks[i - 1].offset, 8);
+	}
+	batches = fb_end_vector(&b, w->nblocks);
+
+	fb_start_table(&b, 4);
+	fb_add_offset(&b, 1, schema);
+	fb_add_offset(&b, 2, dictionaries);
+	fb_add_offset(&b, 3, batches);
+	fb_add_scalar(&b, 0, ARROW_METADATA_V5, 2);
+	fb_finish(&b, fb_end_table(&b));
+
+	len = fb_offset(&b);
+	trailer[0] = len & 0xff;
+	trailer[1] = (len >> 8) & 0xff;
+	trailer[2] = (len >> 16) & 0xff;
+	trailer[3] = len >> 24;
+
+	arrow_write(ctx, w, b.buf + b.head, len);
+	arrow_write(ctx, w, trailer, sizeof(trailer));
+	arrow_write(ctx, w, arrow_magic, 6);
+
+	duk_set_top(ctx, w->base);
+}
+
+/* }}} Arrow IPC file writer */
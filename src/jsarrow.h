@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef jsarrow_h___
+#define jsarrow_h___
+
+#include <stdint.h>
+
+/*
+ * Minimal writer for the Apache Arrow IPC file format ("Feather V2"):
+ * a schema message, one record batch message per batchRows rows and a
+ * footer that indexes the batches, so that readers can mmap the file.
+ */
+
+#define ARROW_INT32		0
+#define ARROW_INT64		1
+#define ARROW_UINT64		2
+#define ARROW_FLOAT64		3
+#define ARROW_BOOL		4
+#define ARROW_UTF8		5
+#define ARROW_BINARY		6
+
+#define ARROW_DEFAULT_BATCH_ROWS	65536
+#define ARROW_MAX_BATCH_ROWS		(INT32_MAX - 1)
+
+struct arrow_column {
+	const char *name;
+	int type;
+	unsigned char *validity;
+	/* fixed width values, a bitmap for ARROW_BOOL or int32 offsets */
+	void *values;
+	/* variable width data of ARROW_UTF8 and ARROW_BINARY columns */
+	duk_idx_t data_idx;
+	unsigned char *data;
+	duk_size_t data_len;
+	duk_size_t data_size;
+	duk_size_t null_count;
+};
+
+struct arrow_block {
+	int64_t offset;
+	int32_t meta_len;
+	int64_t body_len;
+};
+
+struct arrow_writer {
+	int fd;
+	struct arrow_column *columns;
+	unsigned int len;
+	/* rows per record batch, and rows in the current one */
+	duk_size_t batch_rows;
+	duk_size_t rows;
+	double total_rows;
+	/* bytes written to the file so far */
+	int64_t offset;
+	duk_idx_t blocks_idx;
+	struct arrow_block *blocks;
+	unsigned int nblocks;
+	unsigned int blocks_size;
+	duk_idx_t fb_idx;
+	duk_idx_t base;
+};
+
+void arrow_init(duk_context *ctx, struct arrow_writer *w, int fd, unsigned int len, duk_size_t batch_rows);
+void arrow_column(duk_context *ctx, struct arrow_writer *w, unsigned int i, const char *name, int type);
+void arrow_begin(duk_context *ctx, struct arrow_writer *w);
+unsigned char *arrow_reserve(duk_context *ctx, struct arrow_writer *w, unsigned int i, duk_size_t len);
+void arrow_end_row(duk_context *ctx, struct arrow_writer *w);
+void arrow_finish(duk_context *ctx, struct arrow_writer *w);
+
+static inline void arrow_valid(struct arrow_writer *w, unsigned int i)
+{
+	w->columns[i].validity[w->rows >> 3] |= 1 << (w->rows & 7);
+}
+
+static inline void arrow_null(struct arrow_writer *w, unsigned int i)
+{
+	w->columns[i].null_count++;
+}
+
+static inline void arrow_int32(struct arrow_writer *w, unsigned int i, int32_t value)
+{
+	((int32_t *)w->columns[i].values)[w->rows] = value;
+	arrow_valid(w, i);
+}
+
+static inline void arrow_int64(struct arrow_writer *w, unsigned int i, int64_t value)
+{
+	((int64_t *)w->columns[i].values)[w->rows] = value;
+	arrow_valid(w, i);
+}
+
+static inline void arrow_float64(struct arrow_writer *w, unsigned int i, double value)
+{
+	((double *)w->columns[i].values)[w->rows] = value;
+	arrow_valid(w, i);
+}
+
+static inline void arrow_bool(struct arrow_writer *w, unsigned int i, int value)
+{
+	if (value)
+		((unsigned char *)w->columns[i].values)[w->rows >> 3] |= 1 << (w->rows & 7);
+	arrow_valid(w, i);
+}
+
+/* Complete a value of which @len bytes were stored through arrow_reserve() */
+static inline void arrow_commit(struct arrow_writer *w, unsigned int i, duk_size_t len)
+{
+	w->columns[i].data_len += len;
+	arrow_valid(w, i);
+}
+
+static inline void arrow_bytes(duk_context *ctx, struct arrow_writer *w, unsigned int i, const void *data, duk_size_t len)
+{
+	memcpy(arrow_reserve(ctx, w, i, len), data, len);
+	arrow_commit(w, i, len);
+}
+
+#endif
@@ -1,7 +1,17 @@
 /* SPDX-License-Identifier: MIT */
 
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 #include <jsmisc.h>
 #include "jscommon.h"
+#include "jsnumeric.h"
 
 #if 0
 /**
@@ -90,3 +100,907 @@ JSBool nativeSQL(JSContext *cx, unsigned argc, jsval *vp)
 }
 
 #endif
+
+/* {{{ Column label lookup */
+
+struct column_map {
+	unsigned int len;
+	unsigned int mask;
+	const char **names;
+	unsigned int *slots;
+};
+
+static unsigned int column_hash(const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (unsigned char)tolower((unsigned char)*name++)) * 16777619u;
+
+	return hash;
+}
+
+/**
+ * column_map_create - build a hash table of column labels
+ * @names: array of column labels, in column order
+ * @len: number of columns
+ *
+ * The labels are copied, so the map does not depend on the lifetime of
+ * the native result. If two columns have the same label, the first one
+ * is found, like with a linear search.
+ *
+ * Returns the map or NULL if memory allocation fails.
+ */
+struct column_map *column_map_create(const char * const *names, unsigned int len)
+{
+	struct column_map *map;
+	unsigned int i, slot, size = 8;
+	size_t total = 0;
+	char *copy;
+
+	while (size < 2 * len)
+		size *= 2;
+
+	for (i = 0; i < len; i++)
+		total += strlen(names[i]) + 1;
+
+	map = malloc(sizeof(*map) + len * sizeof(char *) + size * sizeof(unsigned int) + total);
+	if (map == NULL)
+		return NULL;
+
+	map->len = len;
+	map->mask = size - 1;
+	map->names = (const char **)(map + 1);
+	map->slots = (unsigned int *)(map->names + len);
+	memset(map->slots, 0, size * sizeof(unsigned int));
+	copy = (char *)(map->slots + size);
+
+	for (i = 0; i < len; i++) {
+		strcpy(copy, names[i]);
+		map->names[i] = copy;
+		copy += strlen(copy) + 1;
+
+		/* Slots hold the column index + 1, so that 0 means empty */
+		for (slot = column_hash(names[i]) & map->mask; map->slots[slot]; slot = (slot + 1) & map->mask)
+			;
+		map->slots[slot] = i + 1;
+	}
+
+	return map;
+}
+
+/**
+ * column_map_lookup - find a column by its label
+ * @map: the column map
+ * @name: the label to search for
+ * @ignore_case: compare labels case insensitively
+ *
+ * Returns the 0-based column index or -1 if there is no such column.
+ */
+int column_map_lookup(const struct column_map *map, const char *name, int ignore_case)
+{
+	unsigned int slot;
+	const char *label;
+
+	if (map == NULL)
+		return -1;
+
+	/* Labels that differ only in case share the probe sequence, and
+	 * columns were inserted in order, so the first match is the
+	 * leftmost column with that label */
+	for (slot = column_hash(name) & map->mask; map->slots[slot]; slot = (slot + 1) & map->mask) {
+		label = map->names[map->slots[slot] - 1];
+		if (!(ignore_case ? strcasecmp(label, name) : strcmp(label, name)))
+			return map->slots[slot] - 1;
+	}
+
+	return -1;
+}
+
+void column_map_free(struct column_map *map)
+{
+	free(map);
+}
+
+/* }}} Column label lookup */
+
+/* {{{ Column scratch buffers */
+
+/**
+ * column_scratch_get - get the buffer of a column
+ * @scratch: the scratch buffers
+ * @len: number of columns in the result
+ * @col: column index (0-based)
+ * @size: minimum size of the buffer
+ *
+ * Buffers only grow, and are separate for each column, so that a pointer
+ * returned for a column stays valid while other columns are accessed.
+ * Changing the number of columns releases all the buffers.
+ *
+ * Returns the buffer, or NULL on allocation failure.
+ */
+unsigned char *column_scratch_get(struct column_scratch *scratch, unsigned int len, unsigned int col, size_t size)
+{
+	struct scratch_buffer *buf;
+	unsigned char *data;
+
+	if (scratch->len != len) {
+		column_scratch_free(scratch);
+		scratch->columns = calloc(len ? len : 1, sizeof(struct scratch_buffer));
+		if (scratch->columns == NULL)
+			return NULL;
+		scratch->len = len;
+	}
+
+	buf = &scratch->columns[col];
+	if (buf->size >= size && buf->data)
+		return buf->data;
+
+	data = realloc(buf->data, size ? size : 1);
+	if (data == NULL)
+		return NULL;
+
+	buf->data = data;
+	buf->size = size;
+
+	return data;
+}
+
+void column_scratch_free(struct column_scratch *scratch)
+{
+	unsigned int i;
+
+	for (i = 0; i < scratch->len; i++)
+		free(scratch->columns[i].data);
+	free(scratch->columns);
+	scratch->columns = NULL;
+	scratch->len = 0;
+}
+
+/* }}} Column scratch buffers */
+
+/* {{{ Typed values */
+
+/*
+ * The typed getters of both drivers follow JDBC: NULL values are returned
+ * as 0, false or null, and wasNull() tells them apart.
+ */
+
+/**
+ * parse_boolean - interpret a text value as a boolean
+ * @str: the value, not necessarily NUL terminated
+ * @len: length of the value
+ *
+ * "t", "true", "y", "yes" and "on" (in any case) are true, and so are
+ * numbers other than zero. Everything else is false.
+ */
+int parse_boolean(const char *str, size_t len)
+{
+	static const char * const words[] = {"t", "true", "y", "yes", "on"};
+	unsigned int i;
+	double num;
+
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+		if (len == strlen(words[i]) && !strncasecmp(str, words[i], len))
+			return 1;
+
+	return parse_double(str, len, &num) && num != 0;
+}
+
+/**
+ * push_int32 - push a number truncated to a 32-bit integer
+ * @ctx: duktape context
+ * @value: the number
+ *
+ * A RangeError is thrown if the integer part does not fit.
+ */
+void push_int32(duk_context *ctx, double value)
+{
+	value = trunc(value);
+	if (!(value >= INT32_MIN && value <= INT32_MAX))
+		duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s", "The value does not fit in a 32-bit integer\n");
+
+	duk_push_int(ctx, (duk_int_t)value);
+}
+
+/**
+ * push_int64 - push a 64-bit integer without losing precision
+ * @ctx: duktape context
+ * @value: the integer
+ *
+ * Values that a double holds exactly (up to 2^53 in magnitude) are pushed
+ * as numbers, the others as decimal strings.
+ */
+void push_int64(duk_context *ctx, int64_t value)
+{
+	if (value >= -9007199254740992LL && value <= 9007199254740992LL)
+		duk_push_number(ctx, (double)value);
+	else
+		duk_push_sprintf(ctx, "%lld", (long long)value);
+}
+
+void push_uint64(duk_context *ctx, uint64_t value)
+{
+	if (value <= 9007199254740992ULL)
+		duk_push_number(ctx, (double)value);
+	else
+		duk_push_sprintf(ctx, "%llu", (unsigned long long)value);
+}
+
+/* {{{ Dates and times */
+
+static int parse_fixed(const char **p, const char *end, int digits, int *value)
+{
+	*value = 0;
+	for (; digits; digits--, (*p)++) {
+		if (*p == end || **p < '0' || **p > '9')
+			return 0;
+		*value = *value * 10 + (**p - '0');
+	}
+	return 1;
+}
+
+/**
+ * parse_timestamp - parse the text form of a date or a timestamp
+ * @str: the value, not necessarily NUL terminated
+ * @len: length of the value
+ * @ts: where to store the fields
+ *
+ * The format is the ISO one that both servers send by default:
+ * "YYYY-MM-DD[( |T)HH:MM:SS[.ffffff]][zone][ BC]", where the zone is "Z"
+ * or an offset like "+HH", "+HH:MM" or "+HH:MM:SS". "infinity" and
+ * "-infinity" are accepted too. Returns 1 on success and 0 otherwise.
+ */
+int parse_timestamp(const char *str, size_t len, struct timestamp *ts)
+{
+	const char *p = str, *end = str + len;
+	int sign, hours, minutes = 0, seconds = 0, digit;
+
+	memset(ts, 0, sizeof(*ts));
+
+	if (len == 8 && !strncasecmp(str, "infinity", 8)) {
+		ts->infinite = 1;
+		return 1;
+	}
+	if (len == 9 && !strncasecmp(str, "-infinity", 9)) {
+		ts->infinite = -1;
+		return 1;
+	}
+
+	/* The year has at least four digits */
+	if (!parse_fixed(&p, end, 4, &ts->year))
+		return 0;
+	while (p < end && *p >= '0' && *p <= '9' && ts->year < 10000000)
+		ts->year = ts->year * 10 + (*p++ - '0');
+
+	if (p == end || *p++ != '-' || !parse_fixed(&p, end, 2, &ts->month) ||
+			p == end || *p++ != '-' || !parse_fixed(&p, end, 2, &ts->day))
+		return 0;
+
+	if (p < end && (*p == ' ' || *p == 'T') && end - p > 1 && p[1] >= '0' && p[1] <= '9') {
+		p++;
+		if (!parse_fixed(&p, end, 2, &ts->hour) ||
+				p == end || *p++ != ':' || !parse_fixed(&p, end, 2, &ts->minute) ||
+				p == end || *p++ != ':' || !parse_fixed(&p, end, 2, &ts->second))
+			return 0;
+
+		if (p < end && *p == '.') {
+			/* Microseconds, further digits are dropped */
+			for (p++, digit = 100000; p < end && *p >= '0' && *p <= '9'; p++, digit /= 10)
+				ts->usec += (*p - '0') * digit;
+		}
+
+		if (p < end && *p == 'Z') {
+			ts->has_zone = 1;
+			p++;
+		} else if (p < end && (*p == '+' || *p == '-')) {
+			sign = *p++ == '-' ? -1 : 1;
+			if (!parse_fixed(&p, end, 2, &hours))
+				return 0;
+			if (p < end && *p == ':')
+				p++;
+			if (p < end && *p >= '0' && *p <= '9' && !parse_fixed(&p, end, 2, &minutes))
+				return 0;
+			if (p < end && *p == ':' && (++p, !parse_fixed(&p, end, 2, &seconds)))
+				return 0;
+			ts->has_zone = 1;
+			ts->zone = sign * (hours * 3600 + minutes * 60 + seconds);
+		}
+	}
+
+	if (end - p == 3 && !strncmp(p, " BC", 3)) {
+		/* There is no year 0: 1 BC is year 0 */
+		ts->year = 1 - ts->year;
+		p += 3;
+	}
+
+	return p == end && ts->month >= 1 && ts->month <= 12 && ts->day >= 1 && ts->day <= 31 &&
+		ts->hour <= 24 && ts->minute <= 59 && ts->second <= 60;
+}
+
+/* Days since 1970-01-01 of a date in the proleptic Gregorian calendar */
+static double days_from_civil(int year, int month, int day)
+{
+	int era, yoe, doy, doe;
+
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (double)era * 146097 + doe - 719468;
+}
+
+/**
+ * timestamp_to_time - convert a timestamp to a JS time value
+ * @ts: the fields
+ *
+ * Returns the number of milliseconds since the epoch. Timestamps with a
+ * zone are converted directly. The others are in local time, like the
+ * dates that the JS Date constructor builds from fields. Infinite
+ * timestamps have no JS equivalent and are returned as NaN.
+ */
+double timestamp_to_time(const struct timestamp *ts)
+{
+	double days, seconds;
+	struct tm tm;
+	time_t t;
+
+	if (ts->infinite)
+		return NAN;
+
+	if (ts->has_zone) {
+		days = days_from_civil(ts->year, ts->month, ts->day);
+		seconds = days * 86400 + ts->hour * 3600 + ts->minute * 60 + ts->second - ts->zone;
+		return seconds * 1000 + ts->usec / 1000;
+	}
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = ts->year - 1900;
+	tm.tm_mon = ts->month - 1;
+	tm.tm_mday = ts->day;
+	tm.tm_hour = ts->hour;
+	tm.tm_min = ts->minute;
+	tm.tm_sec = ts->second;
+	/* Let mktime() tell whether daylight saving time applies */
+	tm.tm_isdst = -1;
+
+	t = mktime(&tm);
+	if (t == (time_t)-1 && tm.tm_year != 69)
+		return NAN;
+
+	return (double)t * 1000 + ts->usec / 1000;
+}
+
+/**
+ * push_date - push a new Date object
+ * @ctx: duktape context
+ * @time: milliseconds since the epoch, NaN for an invalid date
+ */
+void push_date(duk_context *ctx, double time)
+{
+	duk_get_global_string(ctx, "Date");
+	duk_push_number(ctx, time);
+	duk_new(ctx, 1);
+}
+
+/* }}} Dates and times */
+
+/* }}} Typed values */
+
+/* {{{ Metadata */
+
+/**
+ * push_column_info - push the description of a column or a parameter
+ * @ctx: duktape context
+ * @info: the description
+ *
+ * The object has the properties name (columns only), type (the native
+ * type code), typeName, precision, scale and nullable. Unknown values
+ * are null.
+ */
+void push_column_info(duk_context *ctx, const struct column_info *info)
+{
+	duk_push_object(ctx);
+
+	if (info->name) {
+		duk_push_string(ctx, info->name);
+		duk_put_prop_string(ctx, -2, "name");
+	}
+
+	if (info->type >= 0)
+		duk_push_int(ctx, info->type);
+	else
+		duk_push_null(ctx);
+	duk_put_prop_string(ctx, -2, "type");
+
+	if (info->type_name)
+		duk_push_string(ctx, info->type_name);
+	else
+		duk_push_null(ctx);
+	duk_put_prop_string(ctx, -2, "typeName");
+
+	if (info->precision >= 0)
+		duk_push_int(ctx, info->precision);
+	else
+		duk_push_null(ctx);
+	duk_put_prop_string(ctx, -2, "precision");
+
+	if (info->scale >= 0)
+		duk_push_int(ctx, info->scale);
+	else
+		duk_push_null(ctx);
+	duk_put_prop_string(ctx, -2, "scale");
+
+	if (info->nullable >= 0)
+		duk_push_boolean(ctx, info->nullable);
+	else
+		duk_push_null(ctx);
+	duk_put_prop_string(ctx, -2, "nullable");
+}
+
+/**
+ * push_cached - push a value cached in a property of the this binding
+ * @ctx: duktape context
+ * @key: name of the property
+ *
+ * Returns 1 if the value was pushed, and 0 (with nothing pushed) if it
+ * has not been cached yet.
+ */
+int push_cached(duk_context *ctx, const char *key)
+{
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, key);
+	if (duk_is_undefined(ctx, -1)) {
+		duk_pop_2(ctx);
+		return 0;
+	}
+
+	duk_remove(ctx, -2);
+	return 1;
+}
+
+/* Cache the value on top of the stack in a property of the this binding */
+void cache_value(duk_context *ctx, const char *key)
+{
+	duk_push_this(ctx);
+	duk_dup(ctx, -2);
+	duk_put_prop_string(ctx, -2, key);
+	duk_pop(ctx);
+}
+
+/* }}} Metadata */
+
+/* {{{ Row fetching options */
+
+/**
+ * as_object_option - check the {asObject: true} option
+ * @ctx: duktape context
+ * @idx: index of the options argument of a row fetching function
+ *
+ * Returns non-zero if rows should be pushed as objects keyed by column
+ * label instead of arrays.
+ */
+int as_object_option(duk_context *ctx, duk_idx_t idx)
+{
+	int ret;
+
+	if (!duk_is_object(ctx, idx))
+		return 0;
+
+	duk_get_prop_string(ctx, idx, "asObject");
+	ret = duk_to_boolean(ctx, -1);
+	duk_pop(ctx);
+
+	return ret;
+}
+
+/* }}} Row fetching options */
+
+/* {{{ Columnar results */
+
+/*
+ * A column set collects the values of a few columns over many rows, to be
+ * returned as one object per column:
+ *
+ *   {name: "age", values: Int32Array | Float64Array | Array, nulls: Uint8Array}
+ *
+ * Numeric values are written straight into the memory of the typed arrays,
+ * so filling a column is a plain C loop. Bit i of the nulls bitmap (bit
+ * i % 8 of byte i / 8) is set if row i is NULL; the value is then 0 or NaN.
+ *
+ * While the set is being filled, the stack holds (from set->base) the
+ * column_buffer array and then the values and nulls of each column. The
+ * buffers are dynamic, so that they can grow when the number of rows is
+ * not known in advance.
+ */
+
+static duk_size_t column_size(int type)
+{
+	switch (type) {
+	case COLUMN_INT32:
+		return sizeof(int32_t);
+	case COLUMN_FLOAT64:
+		return sizeof(double);
+	default:
+		return 0;
+	}
+}
+
+static void column_set_resize(duk_context *ctx, struct column_set *set, duk_size_t capacity)
+{
+	struct column_buffer *col;
+	duk_idx_t idx;
+	duk_size_t size, old_nulls = (set->capacity + 7) / 8;
+	unsigned int i;
+
+	for (i = 0; i < set->len; i++) {
+		col = &set->columns[i];
+		idx = set->base + 1 + 2 * i;
+
+		size = column_size(col->type);
+		if (size)
+			col->values = duk_resize_buffer(ctx, idx, capacity * size);
+
+		col->nulls = duk_resize_buffer(ctx, idx + 1, (capacity + 7) / 8);
+		if ((capacity + 7) / 8 > old_nulls)
+			memset(col->nulls + old_nulls, 0, (capacity + 7) / 8 - old_nulls);
+	}
+
+	set->capacity = capacity;
+}
+
+/**
+ * column_set_init - start collecting columnar values
+ * @ctx: duktape context
+ * @set: the column set
+ * @types: the type of each column (COLUMN_STRING, COLUMN_INT32, COLUMN_FLOAT64)
+ * @len: number of columns
+ * @capacity: expected number of rows; the set grows if needed
+ */
+void column_set_init(duk_context *ctx, struct column_set *set, const int *types, unsigned int len, duk_size_t capacity)
+{
+	unsigned int i;
+
+	duk_require_stack(ctx, 2 * len + 8);
+
+	set->base = duk_get_top(ctx);
+	set->columns = duk_push_fixed_buffer(ctx, (len ? len : 1) * sizeof(struct column_buffer));
+	set->len = len;
+	set->rows = 0;
+	set->capacity = 0;
+
+	for (i = 0; i < len; i++) {
+		set->columns[i].type = types[i];
+		set->columns[i].values = NULL;
+		if (types[i] == COLUMN_STRING)
+			duk_push_array(ctx);
+		else
+			duk_push_dynamic_buffer(ctx, 0);
+		duk_push_dynamic_buffer(ctx, 0);
+	}
+
+	column_set_resize(ctx, set, capacity ? capacity : 1);
+}
+
+/**
+ * column_set_reserve - make room for a number of rows
+ * @ctx: duktape context
+ * @set: the column set
+ * @rows: total number of rows the set must be able to hold
+ *
+ * This allows filling the set one column at a time over a block of rows;
+ * the caller updates set->rows afterwards.
+ */
+void column_set_reserve(duk_context *ctx, struct column_set *set, duk_size_t rows)
+{
+	duk_size_t capacity = set->capacity;
+
+	if (rows <= capacity)
+		return;
+
+	while (capacity < rows)
+		capacity *= 2;
+
+	column_set_resize(ctx, set, capacity);
+}
+
+/**
+ * column_set_add_row - add a row to the column set
+ * @ctx: duktape context
+ * @set: the column set
+ *
+ * Returns the index of the new row, whose values must then be set.
+ */
+duk_size_t column_set_add_row(duk_context *ctx, struct column_set *set)
+{
+	column_set_reserve(ctx, set, set->rows + 1);
+
+	return set->rows++;
+}
+
+void column_set_null(struct column_set *set, unsigned int col, duk_size_t row)
+{
+	struct column_buffer *column = &set->columns[col];
+
+	column->nulls[row / 8] |= 1 << (row % 8);
+
+	if (column->type == COLUMN_INT32)
+		((int32_t *)column->values)[row] = 0;
+	else if (column->type == COLUMN_FLOAT64)
+		((double *)column->values)[row] = NAN;
+}
+
+void column_set_string(duk_context *ctx, struct column_set *set, unsigned int col, duk_size_t row, const char *str, duk_size_t len)
+{
+	duk_push_lstring(ctx, str, len);
+	duk_put_prop_index(ctx, set->base + 1 + 2 * col, row);
+}
+
+/**
+ * column_set_finish - replace the column set with the array of columns
+ * @ctx: duktape context
+ * @set: the column set
+ * @names: the name of each column
+ *
+ * The buffers are shrunk to the number of rows, and wrapped into typed
+ * arrays. Everything that column_set_init() pushed is removed from the
+ * stack and the array of column objects is pushed instead.
+ */
+void column_set_finish(duk_context *ctx, struct column_set *set, const char * const *names)
+{
+	duk_idx_t idx, arr_idx;
+	duk_size_t size;
+	unsigned int i;
+
+	arr_idx = duk_push_array(ctx);
+
+	for (i = 0; i < set->len; i++) {
+		idx = set->base + 1 + 2 * i;
+
+		duk_push_object(ctx);
+		duk_push_string(ctx, names[i]);
+		duk_put_prop_string(ctx, -2, "name");
+
+		size = column_size(set->columns[i].type);
+		if (size) {
+			duk_resize_buffer(ctx, idx, set->rows * size);
+			duk_push_buffer_object(ctx, idx, 0, set->rows * size,
+					set->columns[i].type == COLUMN_INT32 ?
+					DUK_BUFOBJ_INT32ARRAY : DUK_BUFOBJ_FLOAT64ARRAY);
+		} else
+			duk_dup(ctx, idx);
+		duk_put_prop_string(ctx, -2, "values");
+
+		duk_resize_buffer(ctx, idx + 1, (set->rows + 7) / 8);
+		duk_push_buffer_object(ctx, idx + 1, 0, (set->rows + 7) / 8, DUK_BUFOBJ_UINT8ARRAY);
+		duk_put_prop_string(ctx, -2, "nulls");
+
+		duk_put_prop_index(ctx, arr_idx, i);
+	}
+
+	/* Leave only the array of columns on the stack */
+	duk_insert(ctx, set->base);
+	duk_set_top(ctx, set->base + 1);
+	set->columns = NULL;
+}
+
+/* }}} Columnar results */
+
+/* {{{ Text output */
+
+/*
+ * A text writer collects output (JSON, CSV) in a dynamic buffer on the
+ * duktape stack, so that nothing leaks if an error is thrown halfway.
+ * The buffer grows geometrically; appending is a bounds check and a
+ * memcpy in the common case.
+ *
+ * A writer can also be attached to a file descriptor, in which case the
+ * buffer is written out whenever it fills up, so memory usage does not
+ * depend on the size of the output.
+ */
+
+/**
+ * write_all - write a buffer to a file descriptor, retrying partial writes
+ * @fd: file descriptor
+ * @data: the data
+ * @len: length of the data
+ *
+ * Returns 0 on success, -1 on error (with errno set).
+ */
+int write_all(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * writer_init - push the buffer of a text writer
+ * @ctx: duktape context
+ * @w: the writer
+ * @size: initial size of the buffer
+ */
+void writer_init(duk_context *ctx, struct text_writer *w, duk_size_t size)
+{
+	w->size = size ? size : 64;
+	w->len = 0;
+	w->fd = -1;
+	w->written = 0;
+	w->data = duk_push_dynamic_buffer(ctx, w->size);
+	w->idx = duk_get_top_index(ctx);
+}
+
+/**
+ * writer_init_fd - push the buffer of a text writer attached to a file
+ * @ctx: duktape context
+ * @w: the writer
+ * @fd: the file descriptor to write to
+ * @size: size of the buffer; the output is written in blocks of this size
+ */
+void writer_init_fd(duk_context *ctx, struct text_writer *w, int fd, duk_size_t size)
+{
+	writer_init(ctx, w, size);
+	w->fd = fd;
+}
+
+/**
+ * writer_flush - write the buffered output to the file descriptor
+ * @ctx: duktape context
+ * @w: the writer
+ */
+void writer_flush(duk_context *ctx, struct text_writer *w)
+{
+	if (w->fd < 0 || !w->len)
+		return;
+
+	if (write_all(w->fd, w->data, w->len))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", strerror(errno));
+
+	w->written += w->len;
+	w->len = 0;
+}
+
+/**
+ * writer_reserve - make room for more output
+ * @ctx: duktape context
+ * @w: the writer
+ * @len: number of bytes that will be appended
+ */
+void writer_reserve(duk_context *ctx, struct text_writer *w, duk_size_t len)
+{
+	duk_size_t size = w->size;
+
+	if (w->len + len <= size)
+		return;
+
+	/* Make room by writing the output out; grow only for huge values */
+	if (w->fd >= 0) {
+		writer_flush(ctx, w);
+		if (len <= size)
+			return;
+	}
+
+	while (size < w->len + len)
+		size *= 2;
+
+	w->data = duk_resize_buffer(ctx, w->idx, size);
+	w->size = size;
+}
+
+/**
+ * writer_json_string - append a string as a quoted JSON string
+ * @ctx: duktape context
+ * @w: the writer
+ * @str: the string, UTF-8 encoded
+ * @len: length of the string in bytes
+ *
+ * Quotes, backslashes and control characters are escaped; everything
+ * else is copied as is, in runs.
+ */
+void writer_json_string(duk_context *ctx, struct text_writer *w, const char *str, duk_size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = str + len, *run;
+	unsigned char c;
+
+	/* Worst case: every byte becomes \u00XX */
+	writer_reserve(ctx, w, 6 * len + 2);
+
+	w->data[w->len++] = '"';
+	while (str < end) {
+		for (run = str; str < end && (unsigned char)*str >= 0x20 && *str != '"' && *str != '\\'; str++)
+			;
+		memcpy(w->data + w->len, run, str - run);
+		w->len += str - run;
+		if (str == end)
+			break;
+
+		c = *str++;
+		w->data[w->len++] = '\\';
+		switch (c) {
+		case '"':
+		case '\\':
+			w->data[w->len++] = c;
+			break;
+		case '\n':
+			w->data[w->len++] = 'n';
+			break;
+		case '\r':
+			w->data[w->len++] = 'r';
+			break;
+		case '\t':
+			w->data[w->len++] = 't';
+			break;
+		default:
+			memcpy(w->data + w->len, "u00", 3);
+			w->data[w->len + 3] = hex[c >> 4];
+			w->data[w->len + 4] = hex[c & 15];
+			w->len += 5;
+		}
+	}
+	w->data[w->len++] = '"';
+}
+
+/**
+ * writer_csv_field - append a field in CSV format (RFC 4180)
+ * @ctx: duktape context
+ * @w: the writer
+ * @str: the value
+ * @len: length of the value in bytes
+ * @delimiter: the field delimiter
+ *
+ * Fields containing the delimiter, quotes or line breaks are enclosed in
+ * quotes, with embedded quotes doubled; others are copied as is.
+ */
+void writer_csv_field(duk_context *ctx, struct text_writer *w, const char *str, duk_size_t len, char delimiter)
+{
+	const char *end = str + len, *p;
+
+	for (p = str; p < end; p++)
+		if (*p == delimiter || *p == '"' || *p == '\n' || *p == '\r')
+			break;
+
+	if (p == end) {
+		writer_append(ctx, w, str, len);
+		return;
+	}
+
+	/* Worst case: every character is a quote */
+	writer_reserve(ctx, w, 2 * len + 2);
+
+	w->data[w->len++] = '"';
+	for (p = str; p < end; p++) {
+		if (*p == '"')
+			w->data[w->len++] = '"';
+		w->data[w->len++] = *p;
+	}
+	w->data[w->len++] = '"';
+}
+
+/**
+ * writer_finish - replace the writer buffer with the output string
+ * @ctx: duktape context
+ * @w: the writer
+ *
+ * The buffer must still be on top of the stack.
+ */
+void writer_finish(duk_context *ctx, struct text_writer *w)
+{
+	duk_resize_buffer(ctx, w->idx, w->len);
+	duk_buffer_to_string(ctx, w->idx);
+	w->data = NULL;
+}
+
+/* }}} Text output */
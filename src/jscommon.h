@@ -13,4 +13,137 @@ JSBool nativeSQL(JSContext *cx, unsigned argc, jsval *vp);
 
 #endif
 
+struct column_map;
+
+struct column_map *column_map_create(const char * const *names, unsigned int len);
+int column_map_lookup(const struct column_map *map, const char *name, int ignore_case);
+void column_map_free(struct column_map *map);
+
+struct scratch_buffer {
+	unsigned char *data;
+	size_t size;
+};
+
+/* One reusable buffer per result column, for values exposed to JS */
+struct column_scratch {
+	struct scratch_buffer *columns;
+	unsigned int len;
+};
+
+unsigned char *column_scratch_get(struct column_scratch *scratch, unsigned int len, unsigned int col, size_t size);
+void column_scratch_free(struct column_scratch *scratch);
+
+#define COLUMN_STRING		0
+#define COLUMN_INT32		1
+#define COLUMN_FLOAT64		2
+
+struct column_buffer {
+	int type;
+	void *values;
+	unsigned char *nulls;
+};
+
+struct column_set {
+	struct column_buffer *columns;
+	unsigned int len;
+	duk_size_t rows;
+	duk_size_t capacity;
+	duk_idx_t base;
+};
+
+void column_set_init(duk_context *ctx, struct column_set *set, const int *types, unsigned int len, duk_size_t capacity);
+void column_set_reserve(duk_context *ctx, struct column_set *set, duk_size_t rows);
+duk_size_t column_set_add_row(duk_context *ctx, struct column_set *set);
+void column_set_null(struct column_set *set, unsigned int col, duk_size_t row);
+void column_set_string(duk_context *ctx, struct column_set *set, unsigned int col, duk_size_t row, const char *str, duk_size_t len);
+void column_set_finish(duk_context *ctx, struct column_set *set, const char * const *names);
+
+int parse_boolean(const char *str, size_t len);
+void push_int32(duk_context *ctx, double value);
+void push_int64(duk_context *ctx, int64_t value);
+void push_uint64(duk_context *ctx, uint64_t value);
+
+struct timestamp {
+	/* astronomical numbering: 1 BC is year 0 */
+	int year;
+	int month;
+	int day;
+	int hour;
+	int minute;
+	int second;
+	int usec;
+	/* offset from UTC in seconds, if has_zone is set */
+	int zone;
+	int has_zone;
+	/* 1 for infinity and -1 for -infinity */
+	int infinite;
+};
+
+int parse_timestamp(const char *str, size_t len, struct timestamp *ts);
+double timestamp_to_time(const struct timestamp *ts);
+void push_date(duk_context *ctx, double time);
+
+/* Description of a column or a parameter, see push_column_info() */
+struct column_info {
+	/* NULL for parameters */
+	const char *name;
+	/* NULL or -1 if not known */
+	int type;
+	const char *type_name;
+	int precision;
+	int scale;
+	int nullable;
+};
+
+void push_column_info(duk_context *ctx, const struct column_info *info);
+int push_cached(duk_context *ctx, const char *key);
+void cache_value(duk_context *ctx, const char *key);
+
+int as_object_option(duk_context *ctx, duk_idx_t idx);
+
+int write_all(int fd, const char *data, size_t len);
+
+struct text_writer {
+	duk_idx_t idx;
+	char *data;
+	duk_size_t len;
+	duk_size_t size;
+	/* output file descriptor, or -1 to collect the output in memory */
+	int fd;
+	double written;
+};
+
+void writer_init(duk_context *ctx, struct text_writer *w, duk_size_t size);
+void writer_init_fd(duk_context *ctx, struct text_writer *w, int fd, duk_size_t size);
+void writer_reserve(duk_context *ctx, struct text_writer *w, duk_size_t len);
+void writer_flush(duk_context *ctx, struct text_writer *w);
+void writer_json_string(duk_context *ctx, struct text_writer *w, const char *str, duk_size_t len);
+void writer_csv_field(duk_context *ctx, struct text_writer *w, const char *str, duk_size_t len, char delimiter);
+void writer_finish(duk_context *ctx, struct text_writer *w);
+
+static inline void writer_append(duk_context *ctx, struct text_writer *w, const char *str, duk_size_t len)
+{
+	if (w->len + len > w->size)
+		writer_reserve(ctx, w, len);
+	memcpy(w->data + w->len, str, len);
+	w->len += len;
+}
+
+static inline void writer_putc(duk_context *ctx, struct text_writer *w, char c)
+{
+	if (w->len == w->size)
+		writer_reserve(ctx, w, 1);
+	w->data[w->len++] = c;
+}
+
+static inline void column_set_int32(struct column_set *set, unsigned int col, duk_size_t row, int32_t value)
+{
+	((int32_t *)set->columns[col].values)[row] = value;
+}
+
+static inline void column_set_float64(struct column_set *set, unsigned int col, duk_size_t row, double value)
+{
+	((double *)set->columns[col].values)[row] = value;
+}
+
 #endif
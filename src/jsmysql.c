@@ -7,12 +7,17 @@
 #include <mysql.h>
 #include <math.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <jsmisc.h>
 
 #include "config.h"
 #include "jsmysql.h"
 #include "jssql.h"
 #include "jscommon.h"
+#include "jsarrow.h"
+#include "jsnumeric.h"
 
 /*
  * MySQL backend driver - implementation details
@@ -59,8 +64,16 @@
  * it to bool otherwise.
  */
 
+/*
+ * The statement object and each result set created from it hold a
+ * reference to the structure, see detach_statement().
+ */
 struct prepared_statement {
+	unsigned int refs;
 	MYSQL_STMT *stmt;
+	/* used to prepare the statement again, see own_statement() */
+	MYSQL *mysql;
+	char *sql;
 
 	/* parameters */
 	MYSQL_BIND *p_bind;
@@ -71,6 +84,20 @@ struct prepared_statement {
 	unsigned int r_len;
 	unsigned long *r_bind_len;
 	my_bool *r_is_null;
+	MYSQL_RES *r_meta;
+	struct column_map *labels;
+	/* built from the result metadata, see get_decoders() */
+	struct column_decoder *decoders;
+
+	/* reusable buffer for fetching column values */
+	char *scratch;
+	unsigned long scratch_len;
+	/* values exposed by getBuffer() */
+	struct column_scratch buffers;
+	/* the last value read by a getter was NULL */
+	bool was_null;
+	/* the rows of the result are still being read from the server */
+	bool unbuffered;
 
 	/* generated keys */
 	bool return_generated_keys;
@@ -83,22 +110,46 @@ struct generated_keys {
 };
 
 /**
- * clear_statement - clears the prepared statement structure
- * @stmt: pointer to the structure
+ * release_statement - drop a reference to the prepared statement structure
+ * @pstmt: pointer to the structure
+ *
+ * The structure is cleared when the last reference is dropped.
  */
-static void clear_statement(struct prepared_statement *pstmt)
+static void release_statement(struct prepared_statement *pstmt)
 {
 	unsigned int i;
 
-	if(pstmt == NULL)
+	if (pstmt == NULL || --pstmt->refs > 0)
 		return;
 
+	if (pstmt->p_bind) {
+		for (i = 0; i < pstmt->p_len; i++)
+			free(pstmt->p_bind[i].buffer);
+		free(pstmt->p_bind);
+		pstmt->p_bind = NULL;
+	}
+
 	free(pstmt->r_bind_len);
 	pstmt->r_bind_len = NULL;
 
 	free(pstmt->r_is_null);
 	pstmt->r_is_null = NULL;
 
+	column_map_free(pstmt->labels);
+	pstmt->labels = NULL;
+
+	free(pstmt->decoders);
+	pstmt->decoders = NULL;
+
+	free(pstmt->scratch);
+	pstmt->scratch = NULL;
+	column_scratch_free(&pstmt->buffers);
+
+	if (pstmt->r_meta) {
+		mysql_free_result(pstmt->r_meta);
+		pstmt->r_meta = NULL;
+	}
+
 	/* close the statement */
 	mysql_stmt_free_result(pstmt->stmt);
 	mysql_stmt_close(pstmt->stmt);
@@ -112,34 +163,74 @@ static void clear_statement(struct prepared_statement *pstmt)
 	free(pstmt->r_bind);
 	pstmt->r_bind = NULL;
 
+	free(pstmt->sql);
 	free(pstmt);
-	pstmt = NULL;
+}
+
+/**
+ * buffer_result - read the rest of an unbuffered result into the client
+ * @pstmt: pointer to the statement structure
+ *
+ * Returns 0 on success, or non-zero if the rows cannot be buffered (see
+ * mysql_stmt_error()). The failure must be reported, since the result
+ * sets would otherwise end early without an error, and the connection
+ * may be left out of sync.
+ */
+static int buffer_result(struct prepared_statement *pstmt)
+{
+	if (!pstmt->unbuffered)
+		return 0;
+
+	if (mysql_stmt_store_result(pstmt->stmt))
+		return 1;
+	pstmt->unbuffered = false;
 
+	return 0;
 }
 
-static void execute_statement(duk_context *ctx, struct prepared_statement *pstmt)
+/**
+ * detach_statement - drop the prepared statement structure of a statement object
+ * @ctx: duktape context
+ * @idx: index of the statement object
+ *
+ * Result sets created from the statement keep their reference, so the
+ * rest of their rows are buffered on the client first: the connection
+ * cannot run another statement while an unbuffered result is pending.
+ * Throws, leaving the statement untouched, if buffering fails.
+ */
+static void detach_statement(duk_context *ctx, duk_idx_t idx)
 {
-	unsigned int i;
+	struct prepared_statement *pstmt;
 
-	if (pstmt->p_len && mysql_stmt_bind_param(pstmt->stmt, pstmt->p_bind))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+	idx = duk_normalize_index(ctx, idx);
+
+	duk_get_prop_string(ctx, idx, "pstmt");
+	pstmt = duk_get_pointer(ctx, -1);
+	duk_pop(ctx);
+
+	if (pstmt == NULL)
+		return;
 
-	if (mysql_stmt_execute(pstmt->stmt)) {
-		clear_statement(pstmt);
+	if (pstmt->refs > 1 && buffer_result(pstmt))
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
-	}
+	release_statement(pstmt);
 
-	for (i = 0; i < pstmt->p_len; i++)
-		if (pstmt->p_bind[i].buffer)
-			free(pstmt->p_bind[i].buffer);
+	duk_push_pointer(ctx, NULL);
+	duk_put_prop_string(ctx, idx, "pstmt");
+}
 
-	free(pstmt->p_bind);
-	pstmt->p_bind = NULL;
+static void execute_statement(duk_context *ctx, struct prepared_statement *pstmt)
+{
+	if (pstmt->p_len && mysql_stmt_bind_param(pstmt->stmt, pstmt->p_bind))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
 
-	if (pstmt->r_len && mysql_stmt_bind_result(pstmt->stmt, pstmt->r_bind)) {
-		clear_statement(pstmt);
+	/* The parameters keep their values for the next execution */
+	if (mysql_stmt_execute(pstmt->stmt))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+	pstmt->unbuffered = mysql_stmt_field_count(pstmt->stmt) > 0;
+
+	if (pstmt->r_len && mysql_stmt_bind_result(pstmt->stmt, pstmt->r_bind))
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
-	}
 }
 
 static bool return_generated_keys(duk_context *ctx)
@@ -160,34 +251,26 @@ static bool return_generated_keys(duk_context *ctx)
 }
 
 
-static int set_statement(duk_context *ctx, const char *query, bool generated_keys)
+/**
+ * prepare_statement - prepare a statement and allocate its structure
+ * @ctx: duktape context, used for error reporting
+ * @mysql: the connection
+ * @sql: the statement, in native SQL
+ *
+ * The structure is returned with one reference, for the statement object.
+ */
+static struct prepared_statement *prepare_statement(duk_context *ctx, MYSQL *mysql, const char *sql)
 {
-	const char *nativeSQL;
-	unsigned int i;
+	struct prepared_statement *pstmt;
 	const char *error_message;
+	unsigned int i;
 
-	/* Call nativeSQL method on the connection object in the PreparedStatement given */
-	duk_get_prop_string(ctx, -1, "connection");
-	if (duk_is_undefined(ctx, -1)) {
-		duk_pop(ctx);
-		return 0;
-	}
-
-	duk_push_string(ctx, "nativeSQL");
-	duk_push_string(ctx, query);
-	duk_pcall_prop(ctx, -3, 1);
-	nativeSQL = duk_get_string(ctx, -1);
-	duk_pop(ctx);
-
-	duk_get_prop_string(ctx, -1, "connection");
-	MYSQL *mysql = (MYSQL *)duk_get_pointer(ctx, -1);
-	duk_pop(ctx);
-	if (mysql == NULL)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "MYSQL property is not set\n");
-
-	struct prepared_statement *pstmt = malloc(sizeof(struct prepared_statement));
+	pstmt = malloc(sizeof(struct prepared_statement));
+	assert(pstmt);
 
 	memset(pstmt, 0, sizeof(struct prepared_statement));
+	pstmt->refs = 1;
+	pstmt->mysql = mysql;
 
 	pstmt->stmt = mysql_stmt_init(mysql);
 	if (pstmt->stmt == NULL) {
@@ -195,13 +278,16 @@ static int set_statement(duk_context *ctx, const char *query, bool generated_key
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s","Failed to initialize statement\n");
 	}
 
-	if (mysql_stmt_prepare(pstmt->stmt, nativeSQL, strlen(nativeSQL))) {
+	if (mysql_stmt_prepare(pstmt->stmt, sql, strlen(sql))) {
 		error_message = mysql_stmt_error(pstmt->stmt);
 		mysql_stmt_free_result(pstmt->stmt);
 		free(pstmt);
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", error_message);
 	}
 
+	pstmt->sql = strdup(sql);
+	assert(pstmt->sql);
+
 	pstmt->p_len = mysql_stmt_param_count(pstmt->stmt);
 	if (pstmt->p_len) {
 		pstmt->p_bind = malloc(pstmt->p_len * sizeof(MYSQL_BIND));
@@ -237,6 +323,50 @@ static int set_statement(duk_context *ctx, const char *query, bool generated_key
 		pstmt->r_bind[i].is_null = &pstmt->r_is_null[i];
 	}
 
+	/* Build the column label map once, so that getters can look up
+	 * columns by label in constant time */
+	if (pstmt->r_len)
+		pstmt->r_meta = mysql_stmt_result_metadata(pstmt->stmt);
+
+	if (pstmt->r_meta) {
+		MYSQL_FIELD *fields = mysql_fetch_fields(pstmt->r_meta);
+		const char **names = malloc(pstmt->r_len * sizeof(char *));
+
+		assert(names);
+		for (i = 0; i < pstmt->r_len; i++)
+			names[i] = fields[i].name;
+		pstmt->labels = column_map_create(names, pstmt->r_len);
+		free(names);
+	}
+
+	return pstmt;
+}
+
+static int set_statement(duk_context *ctx, const char *query, bool generated_keys)
+{
+	const char *nativeSQL;
+	struct prepared_statement *pstmt;
+
+	/* Call nativeSQL method on the connection object in the PreparedStatement given */
+	duk_get_prop_string(ctx, -1, "connection");
+	if (duk_is_undefined(ctx, -1)) {
+		duk_pop(ctx);
+		return 0;
+	}
+
+	duk_push_string(ctx, "nativeSQL");
+	duk_push_string(ctx, query);
+	duk_pcall_prop(ctx, -3, 1);
+	nativeSQL = duk_get_string(ctx, -1);
+	duk_pop(ctx);
+
+	duk_get_prop_string(ctx, -1, "connection");
+	MYSQL *mysql = (MYSQL *)duk_get_pointer(ctx, -1);
+	duk_pop(ctx);
+	if (mysql == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "MYSQL property is not set\n");
+
+	pstmt = prepare_statement(ctx, mysql, nativeSQL);
 	pstmt->return_generated_keys = generated_keys;
 
 	/* Remove the connection object */
@@ -249,7 +379,105 @@ static int set_statement(duk_context *ctx, const char *query, bool generated_key
 	return 1;
 }
 
+/**
+ * own_statement - get the structure to execute a prepared statement with
+ * @ctx: duktape context, with the prepared statement object as this
+ * @pstmt: the current structure of the statement
+ *
+ * Executing the statement again would discard the rows that the result
+ * sets created before have not read yet. While there are such result
+ * sets, they are left with the current structure and the statement is
+ * prepared again, taking the parameters set so far along.
+ */
+static struct prepared_statement *own_statement(duk_context *ctx, struct prepared_statement *pstmt)
+{
+	struct prepared_statement *fresh;
+
+	if (pstmt->refs == 1)
+		return pstmt;
+
+	/* The connection must be free to prepare the statement */
+	if (buffer_result(pstmt))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+
+	fresh = prepare_statement(ctx, pstmt->mysql, pstmt->sql);
+	fresh->return_generated_keys = pstmt->return_generated_keys;
+	free(fresh->p_bind);
+	fresh->p_bind = pstmt->p_bind;
+	pstmt->p_bind = NULL;
+
+	duk_push_this(ctx);
+	duk_push_pointer(ctx, (void *) fresh);
+	duk_put_prop_string(ctx, -2, "pstmt");
+	duk_pop(ctx);
+
+	release_statement(pstmt);
+	return fresh;
+}
+
+/**
+ * push_result_set - push a result set reading the result of a statement
+ * @ctx: duktape context
+ * @idx: index of the statement object
+ * @pstmt: pointer to the statement structure
+ *
+ * The result set holds a reference to the structure, so it can still be
+ * read after the statement is executed again or finalized, and keeps the
+ * connection object alive.
+ */
+static void push_result_set(duk_context *ctx, duk_idx_t idx, struct prepared_statement *pstmt)
+{
+	idx = duk_normalize_index(ctx, idx);
+
+	duk_push_object(ctx);
+
+	duk_get_global_string(ctx, "MysqlResultSet");
+	duk_set_prototype(ctx, -2);
+
+	pstmt->refs++;
+	duk_push_pointer(ctx, (void *) pstmt);
+	duk_put_prop_string(ctx, -2, "pstmt");
+
+	duk_get_prop_string(ctx, idx, "connection");
+	duk_put_prop_string(ctx, -2, "connection");
+}
+
+/* Resolve the column argument (1-based position or label) of a getter */
+static int resolve_column_index(duk_context *ctx, struct prepared_statement **pstmt, uint32_t *i)
+{
+	int argc = duk_get_top(ctx);
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "pstmt");
+	*pstmt = (struct prepared_statement *)duk_get_pointer(ctx, -1);
+
+	if (*pstmt == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
+
+	if (argc < 1)
+		return 0;
+
+	/* Column labels are case insensitive in MySQL */
+	if (duk_is_string(ctx, 0))
+		*i = column_map_lookup((*pstmt)->labels, duk_get_string(ctx, 0), 1) + 1;
+	else
+		*i = duk_get_int(ctx, 0);
+
+	if (*i < 1 || *i > (*pstmt)->r_len)
+		return 0;
+
+	(*i)--;
+	(*pstmt)->was_null = (*pstmt)->r_is_null[*i];
+
+	return 1;
+}
+
 static int validate_column_index(duk_context *ctx, struct prepared_statement **pstmt, uint32_t *i)
+{
+	return resolve_column_index(ctx, pstmt, i) && !(*pstmt)->r_is_null[*i];
+}
+
+static int validate_paramater_index(duk_context *ctx, struct prepared_statement **pstmt, uint32_t *i)
 {
 	int argc = duk_get_top(ctx);
 
@@ -265,213 +493,1679 @@ static int validate_column_index(duk_context *ctx, struct prepared_statement **p
 
 	*i = duk_get_int(ctx, 0);
 
-	if (*i < 1 || *i > (*pstmt)->r_len)
+	if (*i < 1 || *i > (*pstmt)->p_len)
 		return 0;
 
 	(*i)--;
-	if ((*pstmt)->r_is_null[*i])
+	if ((*pstmt)->p_bind[*i].buffer) {
+		/* Free previously assigned value (buffer) */
+		free((*pstmt)->p_bind[*i].buffer);
+		/* Prevent second free in execute_statement()
+		if we never set any other value later */
+		(*pstmt)->p_bind[*i].buffer = NULL;
+	}
+	if (argc < 2 || duk_is_null(ctx, 1)) {
+		(*pstmt)->p_bind[*i].buffer_type = MYSQL_TYPE_NULL;
 		return 0;
+	}
+
+	return 1;
+}
+
+/* {{{ MysqlPreparedGeneratedKeys */
+
+static int MysqlGeneratedKeys_getNumber(duk_context *ctx)
+{
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "generatedKeys");
+	struct generated_keys *k = duk_get_pointer(ctx, -1);
+
+	if (k)
+		duk_push_int(ctx, k->last_insert_id);
+	else
+		duk_push_null(ctx);
+
+	return 1;
+}
+
+static int MysqlGeneratedKeys_getString(duk_context *ctx)
+{
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "generatedKeys");
+	struct generated_keys *k = duk_get_pointer(ctx, -1);
+	char *cstr;
+
+	if (k == NULL) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	if (asprintf(&cstr, "%ju", (uintmax_t)k->last_insert_id) == -1)
+		return DUK_RET_ERROR;
+
+	duk_push_string(ctx, cstr);
+	free(cstr);
+
+	return 1;
+}
+
+static int MysqlGeneratedKeys_next(duk_context *ctx)
+{
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "generatedKeys");
+	struct generated_keys *k = duk_get_pointer(ctx, -1);
+
+	if (k == NULL)
+		duk_push_false(ctx);
+
+	if (k->cursor >0)
+		k->last_insert_id++;
+
+	if (k->cursor < k->affected_rows) {
+		k->cursor++;
+		duk_push_true(ctx);
+	} else
+		duk_push_false(ctx);
+
+	return 1;
+}
+
+static int MysqlGeneratedKeys_finalize(duk_context *ctx)
+{
+	struct generated_keys *k;
+	duk_get_prop_string(ctx, 0, "generatedKeys");
+
+	k = duk_get_pointer(ctx, -1);
+	if (k) {
+		free(k);
+		k = NULL;
+	}
+
+	return 0;
+}
+
+static duk_function_list_entry MysqlGeneratedKeys_functions[] = {
+	{"getNumber",	MysqlGeneratedKeys_getNumber,	1},
+	{"getString",	MysqlGeneratedKeys_getString,	1},
+	{"next",	MysqlGeneratedKeys_next,	0},
+	{NULL,		NULL, 				0}
+};
+
+/* }}} MysqlPreparedGeneratedKeys */
+
+/* {{{ MysqlPreparedResultSet */
+
+static int MysqlResultSet_getNumber(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	uint32_t i;
+	MYSQL_BIND bind;
+	double val;
+
+	if(!validate_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	memset(&bind, 0, sizeof(MYSQL_BIND));
+	bind.buffer_type = MYSQL_TYPE_DOUBLE;
+	bind.buffer = &val;
+	bind.buffer_length = sizeof(double);
+
+	if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+
+	duk_push_number(ctx, val);
+	return 1;
+}
+
+/**
+ * fetch_row - move to the next row
+ * @ctx: duktape context, used for error reporting
+ * @pstmt: pointer to the statement structure
+ *
+ * Returns 1 if there is a current row, 0 at the end of the result.
+ */
+static int fetch_row(duk_context *ctx, struct prepared_statement *pstmt)
+{
+	switch (mysql_stmt_fetch(pstmt->stmt)) {
+	case 0:
+	case MYSQL_DATA_TRUNCATED:
+		/* Truncation is expected, as the bound buffers are empty */
+		return 1;
+	case MYSQL_NO_DATA:
+		pstmt->unbuffered = false;
+		return 0;
+	default:
+		pstmt->unbuffered = false;
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+	}
+
+	return 0;
+}
+
+/**
+ * fetch_string - fetch a column of the current row as a string
+ * @ctx: duktape context, used for error reporting
+ * @pstmt: pointer to the statement structure
+ * @i: column index (0-based)
+ *
+ * The value is stored in the scratch buffer of the statement, which is
+ * reused for all the columns and rows. Returns a pointer to the value,
+ * whose length is pstmt->r_bind_len[i].
+ */
+static char *fetch_string(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i)
+{
+	MYSQL_BIND bind;
+
+	if (pstmt->scratch_len < pstmt->r_bind_len[i] + 1) {
+		char *scratch = realloc(pstmt->scratch, pstmt->r_bind_len[i] + 1);
+
+		if (scratch == NULL)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Failed to allocate memory\n");
+		pstmt->scratch = scratch;
+		pstmt->scratch_len = pstmt->r_bind_len[i] + 1;
+	}
+
+	memset(&bind, 0, sizeof(MYSQL_BIND));
+	bind.buffer_type = MYSQL_TYPE_STRING;
+	bind.buffer = pstmt->scratch;
+	bind.buffer_length = pstmt->scratch_len;
+
+	if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+
+	return pstmt->scratch;
+}
+
+/**
+ * fetch_as - fetch a column converted by the client library
+ * @ctx: duktape context, used for error reporting
+ * @pstmt: pointer to the statement structure
+ * @i: column index (0-based)
+ * @type: MYSQL_TYPE_LONGLONG, MYSQL_TYPE_DOUBLE or MYSQL_TYPE_DATETIME (MYSQL_TIME)
+ * @value: where to store the value
+ * @is_unsigned: fetch integers as unsigned
+ */
+static void fetch_as(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i,
+		enum enum_field_types type, void *value, bool is_unsigned)
+{
+	MYSQL_BIND bind;
+
+	memset(&bind, 0, sizeof(MYSQL_BIND));
+	bind.buffer_type = type;
+	bind.buffer = value;
+	bind.is_unsigned = is_unsigned;
+
+	if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+}
+
+/* {{{ Column decoders */
+
+/*
+ * How the values of a column are converted only depends on its metadata,
+ * so it is worked out once per result instead of once per cell. For each
+ * column the decoder table holds the functions that push a value as a JS
+ * value and append it as JSON, and the kind of value used by the typed
+ * getters and the columnar and Arrow exports.
+ */
+
+typedef void (*push_decoder)(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i);
+typedef void (*json_decoder)(duk_context *ctx, struct text_writer *w, struct prepared_statement *pstmt, unsigned int i);
+
+struct column_decoder {
+	int kind;
+	/* integers are fetched as unsigned */
+	bool is_unsigned;
+	push_decoder push;
+	json_decoder json;
+	/* COLUMN_* type for fetchColumns() */
+	int column_type;
+	/* ARROW_* type for writeArrow() */
+	int arrow_type;
+};
+
+static inline bool is_exact_integer(long long ival, bool is_unsigned)
+{
+	return is_unsigned ? (unsigned long long)ival <= 9007199254740992ULL :
+		(ival >= -9007199254740992LL && ival <= 9007199254740992LL);
+}
+
+/* BIGINT values that a double cannot hold exactly are kept as strings */
+static void push_integer(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i)
+{
+	bool is_unsigned = pstmt->decoders[i].is_unsigned;
+	long long ival;
+	char *value;
+
+	fetch_as(ctx, pstmt, i, MYSQL_TYPE_LONGLONG, &ival, is_unsigned);
+	if (is_exact_integer(ival, is_unsigned)) {
+		duk_push_number(ctx, is_unsigned ? (double)(unsigned long long)ival : (double)ival);
+		return;
+	}
+	value = fetch_string(ctx, pstmt, i);
+	duk_push_lstring(ctx, value, pstmt->r_bind_len[i]);
+}
+
+static void push_double(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i)
+{
+	double dval;
+
+	fetch_as(ctx, pstmt, i, MYSQL_TYPE_DOUBLE, &dval, false);
+	duk_push_number(ctx, dval);
+}
+
+static void push_binary(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i)
+{
+	char *value = fetch_string(ctx, pstmt, i);
+
+	memcpy(duk_push_fixed_buffer(ctx, pstmt->r_bind_len[i]), value, pstmt->r_bind_len[i]);
+}
+
+static void push_text(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i)
+{
+	char *value = fetch_string(ctx, pstmt, i);
+
+	duk_push_lstring(ctx, value, pstmt->r_bind_len[i]);
+}
+
+/* The text form of integers is valid JSON, unless beyond 2^53 */
+static void json_integer(duk_context *ctx, struct text_writer *w, struct prepared_statement *pstmt, unsigned int i)
+{
+	bool is_unsigned = pstmt->decoders[i].is_unsigned;
+	long long ival;
+	char *value;
+
+	fetch_as(ctx, pstmt, i, MYSQL_TYPE_LONGLONG, &ival, is_unsigned);
+	value = fetch_string(ctx, pstmt, i);
+	if (is_exact_integer(ival, is_unsigned))
+		writer_append(ctx, w, value, pstmt->r_bind_len[i]);
+	else
+		writer_json_string(ctx, w, value, pstmt->r_bind_len[i]);
+}
+
+/* Non-finite values become null, as with JSON.stringify() */
+static void json_double(duk_context *ctx, struct text_writer *w, struct prepared_statement *pstmt, unsigned int i)
+{
+	double dval, back;
+	char num[32];
+
+	fetch_as(ctx, pstmt, i, MYSQL_TYPE_DOUBLE, &dval, false);
+	if (!isfinite(dval)) {
+		writer_append(ctx, w, "null", 4);
+		return;
+	}
+	/* Use the shortest of the usual precisions that round-trips */
+	snprintf(num, sizeof(num), "%.15g", dval);
+	if (!parse_double(num, strlen(num), &back) || back != dval)
+		snprintf(num, sizeof(num), "%.17g", dval);
+	writer_append(ctx, w, num, strlen(num));
+}
+
+static void json_raw(duk_context *ctx, struct text_writer *w, struct prepared_statement *pstmt, unsigned int i)
+{
+	char *value = fetch_string(ctx, pstmt, i);
+
+	writer_append(ctx, w, value, pstmt->r_bind_len[i]);
+}
+
+static void json_text(duk_context *ctx, struct text_writer *w, struct prepared_statement *pstmt, unsigned int i)
+{
+	char *value = fetch_string(ctx, pstmt, i);
+
+	writer_json_string(ctx, w, value, pstmt->r_bind_len[i]);
+}
+
+static const struct column_decoder text_decoder = {
+	MYSQL_DECODE_TEXT, false, push_text, json_text, COLUMN_STRING, ARROW_UTF8
+};
+
+/**
+ * init_decoder - choose the decoder of a column
+ * @dec: the decoder to fill in
+ * @field: the column metadata
+ *
+ * DECIMAL values stay text, so that no precision is lost.
+ */
+static void init_decoder(struct column_decoder *dec, const MYSQL_FIELD *field)
+{
+	bool is_unsigned = (field->flags & UNSIGNED_FLAG) != 0;
+
+	*dec = text_decoder;
+
+	switch (field->type) {
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_YEAR:
+		*dec = (struct column_decoder){MYSQL_DECODE_INTEGER, is_unsigned, push_integer, json_integer,
+			COLUMN_INT32, ARROW_INT32};
+		break;
+	case MYSQL_TYPE_LONG:
+		*dec = (struct column_decoder){MYSQL_DECODE_INTEGER, is_unsigned, push_integer, json_integer,
+			is_unsigned ? COLUMN_FLOAT64 : COLUMN_INT32, is_unsigned ? ARROW_INT64 : ARROW_INT32};
+		break;
+	case MYSQL_TYPE_LONGLONG:
+		*dec = (struct column_decoder){MYSQL_DECODE_INTEGER, is_unsigned, push_integer, json_integer,
+			COLUMN_FLOAT64, is_unsigned ? ARROW_UINT64 : ARROW_INT64};
+		break;
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE:
+		*dec = (struct column_decoder){MYSQL_DECODE_FLOAT, false, push_double, json_double,
+			COLUMN_FLOAT64, ARROW_FLOAT64};
+		break;
+	case MYSQL_TYPE_DECIMAL:
+	case MYSQL_TYPE_NEWDECIMAL:
+		dec->kind = MYSQL_DECODE_DECIMAL;
+		break;
+	case MYSQL_TYPE_BIT:
+		dec->kind = MYSQL_DECODE_BIT;
+		dec->arrow_type = ARROW_BINARY;
+		break;
+	case MYSQL_TYPE_JSON:
+		dec->kind = MYSQL_DECODE_JSON;
+		dec->json = json_raw;
+		break;
+	case MYSQL_TYPE_DATE:
+	case MYSQL_TYPE_NEWDATE:
+	case MYSQL_TYPE_DATETIME:
+	case MYSQL_TYPE_TIMESTAMP:
+		dec->kind = MYSQL_DECODE_TEMPORAL;
+		break;
+	case MYSQL_TYPE_TINY_BLOB:
+	case MYSQL_TYPE_MEDIUM_BLOB:
+	case MYSQL_TYPE_LONG_BLOB:
+	case MYSQL_TYPE_BLOB:
+	case MYSQL_TYPE_VAR_STRING:
+	case MYSQL_TYPE_STRING:
+		/* Character set 63 is "binary" */
+		if (field->charsetnr == 63) {
+			dec->kind = MYSQL_DECODE_BINARY;
+			dec->push = push_binary;
+			dec->arrow_type = ARROW_BINARY;
+		} else if (field->flags & SET_FLAG)
+			dec->kind = MYSQL_DECODE_SET;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * get_decoders - get the decoder table of the current result
+ * @ctx: duktape context, used for error reporting
+ * @pstmt: pointer to the statement structure
+ *
+ * The table is built on first use and kept as long as the result
+ * metadata. Columns without metadata are decoded as text.
+ */
+static const struct column_decoder *get_decoders(duk_context *ctx, struct prepared_statement *pstmt)
+{
+	MYSQL_FIELD *fields;
+	unsigned int i;
+
+	if (pstmt->decoders)
+		return pstmt->decoders;
+
+	pstmt->decoders = malloc((pstmt->r_len ? pstmt->r_len : 1) * sizeof(struct column_decoder));
+	if (pstmt->decoders == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Failed to allocate memory\n");
+
+	fields = pstmt->r_meta ? mysql_fetch_fields(pstmt->r_meta) : NULL;
+	for (i = 0; i < pstmt->r_len; i++) {
+		if (fields)
+			init_decoder(&pstmt->decoders[i], &fields[i]);
+		else
+			pstmt->decoders[i] = text_decoder;
+	}
+
+	return pstmt->decoders;
+}
+
+/* }}} Column decoders */
+
+static int MysqlResultSet_getString(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	uint32_t i;
+	char *value;
+
+	if(!validate_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	value = fetch_string(ctx, pstmt, i);
+	duk_push_lstring(ctx, value, pstmt->r_bind_len[i]);
+	return 1;
+}
+
+/**
+ * MysqlResultSet_getBuffer - get a value as a buffer
+ *
+ * getBuffer(col) returns an external buffer, or null for NULL values. The
+ * client library only hands out values by copying them, so the value is
+ * fetched once into a buffer of the statement that is reused for that
+ * column, and exposed without any further copy. The buffer is only valid
+ * until the cursor moves with next() or the result set is closed.
+ */
+static int MysqlResultSet_getBuffer(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	unsigned char *buf;
+	MYSQL_BIND bind;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->r_is_null[i]) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	buf = column_scratch_get(&pstmt->buffers, pstmt->r_len, i, pstmt->r_bind_len[i]);
+	if (buf == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Failed to allocate memory\n");
+
+	if (pstmt->r_bind_len[i]) {
+		memset(&bind, 0, sizeof(MYSQL_BIND));
+		bind.buffer_type = MYSQL_TYPE_BLOB;
+		bind.buffer = buf;
+		bind.buffer_length = pstmt->r_bind_len[i];
+
+		if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+	}
+
+	duk_push_external_buffer(ctx);
+	duk_config_buffer(ctx, -1, buf, pstmt->r_bind_len[i]);
+
+	return 1;
+}
+
+/*
+ * The typed getters follow the JDBC rules described in jscommon.c. Integer
+ * columns are fetched as 64-bit integers and the others as doubles,
+ * converted by the client library from the binary protocol without going
+ * through strings.
+ */
+
+static int MysqlResultSet_getInt(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	const struct column_decoder *dec;
+	long long ival;
+	double dval;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null) {
+		duk_push_int(ctx, 0);
+		return 1;
+	}
+
+	dec = get_decoders(ctx, pstmt) + i;
+	if (dec->kind == MYSQL_DECODE_INTEGER) {
+		fetch_as(ctx, pstmt, i, MYSQL_TYPE_LONGLONG, &ival, dec->is_unsigned);
+		push_int32(ctx, dec->is_unsigned ? (double)(unsigned long long)ival : (double)ival);
+	} else {
+		fetch_as(ctx, pstmt, i, MYSQL_TYPE_DOUBLE, &dval, false);
+		push_int32(ctx, dval);
+	}
+
+	return 1;
+}
+
+/**
+ * MysqlResultSet_getLong - get a 64-bit integer value
+ *
+ * The value is a number if a double holds it exactly (up to 2^53 in
+ * magnitude), and a decimal string otherwise. Fractional values are
+ * truncated.
+ */
+static int MysqlResultSet_getLong(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	const struct column_decoder *dec;
+	long long ival;
+	double dval;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null) {
+		duk_push_int(ctx, 0);
+		return 1;
+	}
+
+	dec = get_decoders(ctx, pstmt) + i;
+	if (dec->kind == MYSQL_DECODE_INTEGER) {
+		fetch_as(ctx, pstmt, i, MYSQL_TYPE_LONGLONG, &ival, dec->is_unsigned);
+		if (dec->is_unsigned)
+			push_uint64(ctx, (unsigned long long)ival);
+		else
+			push_int64(ctx, ival);
+	} else {
+		fetch_as(ctx, pstmt, i, MYSQL_TYPE_DOUBLE, &dval, false);
+		duk_push_number(ctx, trunc(dval));
+	}
+
+	return 1;
+}
+
+static int MysqlResultSet_getDouble(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	double dval;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null) {
+		duk_push_number(ctx, 0);
+		return 1;
+	}
+
+	fetch_as(ctx, pstmt, i, MYSQL_TYPE_DOUBLE, &dval, false);
+	duk_push_number(ctx, dval);
+
+	return 1;
+}
+
+/**
+ * MysqlResultSet_getBoolean - get a boolean value
+ *
+ * Numbers are true if not zero, BIT values if any bit is set, and strings
+ * as parsed by parse_boolean().
+ */
+static int MysqlResultSet_getBoolean(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	unsigned long len;
+	double dval;
+	char *value;
+	uint32_t i;
+	bool ret = false;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	switch (get_decoders(ctx, pstmt)[i].kind) {
+	case MYSQL_DECODE_INTEGER:
+	case MYSQL_DECODE_FLOAT:
+	case MYSQL_DECODE_DECIMAL:
+		fetch_as(ctx, pstmt, i, MYSQL_TYPE_DOUBLE, &dval, false);
+		ret = dval != 0;
+		break;
+	case MYSQL_DECODE_BIT:
+		value = fetch_string(ctx, pstmt, i);
+		for (len = 0; len < pstmt->r_bind_len[i] && !ret; len++)
+			ret = value[len] != 0;
+		break;
+	default:
+		value = fetch_string(ctx, pstmt, i);
+		ret = parse_boolean(value, pstmt->r_bind_len[i]);
+	}
+
+	duk_push_boolean(ctx, ret);
+	return 1;
+}
+
+/**
+ * MysqlResultSet_getBytes - get a copy of a value as a buffer
+ *
+ * Unlike getBuffer(), the buffer belongs to JS and stays valid. The value
+ * is fetched straight into it.
+ */
+static int MysqlResultSet_getBytes(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	MYSQL_BIND bind;
+	uint32_t i;
+	void *buf;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	buf = duk_push_fixed_buffer(ctx, pstmt->r_bind_len[i]);
+	if (pstmt->r_bind_len[i] == 0)
+		return 1;
+
+	memset(&bind, 0, sizeof(MYSQL_BIND));
+	bind.buffer_type = MYSQL_TYPE_BLOB;
+	bind.buffer = buf;
+	bind.buffer_length = pstmt->r_bind_len[i];
+
+	if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+
+	return 1;
+}
+
+/**
+ * MysqlResultSet_getJSON - get a JSON value as a JS value
+ *
+ * The text is decoded by the JSON parser of Duktape, without going
+ * through a JS string first. NULL values are returned as null.
+ */
+static int MysqlResultSet_getJSON(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	char *value;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	value = fetch_string(ctx, pstmt, i);
+	duk_push_lstring(ctx, value, pstmt->r_bind_len[i]);
+	duk_json_decode(ctx, -1);
+	return 1;
+}
+
+/**
+ * MysqlResultSet_getArray - get a value as a JS array
+ *
+ * MySQL has no array type: SET values are split into the array of their
+ * members, and JSON values are accepted if they hold an array. NULL
+ * values are returned as null.
+ */
+static int MysqlResultSet_getArray(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	duk_uarridx_t n = 0;
+	unsigned long j, start;
+	char *value;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	switch (get_decoders(ctx, pstmt)[i].kind) {
+	case MYSQL_DECODE_SET:
+		value = fetch_string(ctx, pstmt, i);
+		duk_push_array(ctx);
+		/* Members cannot contain commas, and the empty set is "" */
+		for (j = start = 0; j <= pstmt->r_bind_len[i] && pstmt->r_bind_len[i]; j++)
+			if (j == pstmt->r_bind_len[i] || value[j] == ',') {
+				duk_push_lstring(ctx, value + start, j - start);
+				duk_put_prop_index(ctx, -2, n++);
+				start = j + 1;
+			}
+		break;
+	case MYSQL_DECODE_JSON:
+		value = fetch_string(ctx, pstmt, i);
+		duk_push_lstring(ctx, value, pstmt->r_bind_len[i]);
+		duk_json_decode(ctx, -1);
+		if (duk_is_array(ctx, -1))
+			break;
+		/* fall through */
+	default:
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The value is not an array\n");
+	}
+
+	return 1;
+}
+
+/**
+ * push_timestamp - push a column of the current row as a Date object
+ * @ctx: duktape context
+ * @pstmt: pointer to the statement structure
+ * @i: column index (0-based)
+ * @date_only: drop the time of day
+ *
+ * DATE, DATETIME and TIMESTAMP values are fetched already broken down by
+ * the client library and other columns are parsed from their text. The
+ * values are in local time and zero dates become invalid dates.
+ */
+static void push_timestamp(duk_context *ctx, struct prepared_statement *pstmt, unsigned int i, bool date_only)
+{
+	struct timestamp ts;
+	MYSQL_TIME tm;
+	char *value;
+
+	if (get_decoders(ctx, pstmt)[i].kind == MYSQL_DECODE_TEMPORAL) {
+		fetch_as(ctx, pstmt, i, MYSQL_TYPE_DATETIME, &tm, false);
+		if (tm.year == 0 && tm.month == 0 && tm.day == 0) {
+			push_date(ctx, NAN);
+			return;
+		}
+		memset(&ts, 0, sizeof(ts));
+		ts.year = tm.year;
+		ts.month = tm.month;
+		ts.day = tm.day;
+		ts.hour = tm.hour;
+		ts.minute = tm.minute;
+		ts.second = tm.second;
+		ts.usec = tm.second_part;
+	} else {
+		value = fetch_string(ctx, pstmt, i);
+		if (!parse_timestamp(value, pstmt->r_bind_len[i], &ts))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The value is not a date\n");
+	}
+
+	if (date_only) {
+		ts.hour = ts.minute = ts.second = ts.usec = 0;
+		ts.has_zone = 0;
+	}
+
+	push_date(ctx, timestamp_to_time(&ts));
+}
+
+/* getDate(col) returns the local midnight of the date, NULL as null */
+static int MysqlResultSet_getDate(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null)
+		duk_push_null(ctx);
+	else
+		push_timestamp(ctx, pstmt, i, true);
+	return 1;
+}
+
+/* getTimestamp(col) keeps the time, truncated to milliseconds */
+static int MysqlResultSet_getTimestamp(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	uint32_t i;
+
+	if (!resolve_column_index(ctx, &pstmt, &i))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+
+	if (pstmt->was_null)
+		duk_push_null(ctx);
+	else
+		push_timestamp(ctx, pstmt, i, false);
+	return 1;
+}
+
+/**
+ * push_column - push a column of the current row, converted to a JS type
+ * @ctx: duktape context
+ * @dec: the decoder table of the result
+ * @pstmt: pointer to the statement structure
+ * @i: column index (0-based)
+ *
+ * Integer and floating point columns are pushed as numbers (BIGINT values
+ * that a double cannot hold exactly are pushed as strings), binary string
+ * columns as buffers and everything else, including DECIMAL, as strings.
+ */
+static inline void push_column(duk_context *ctx, const struct column_decoder *dec,
+		struct prepared_statement *pstmt, unsigned int i)
+{
+	if (pstmt->r_is_null[i])
+		duk_push_null(ctx);
+	else
+		dec[i].push(ctx, pstmt, i);
+}
+
+static struct prepared_statement *get_result_statement(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "pstmt");
+	pstmt = duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+
+	if (pstmt == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
+
+	return pstmt;
+}
+
+/**
+ * push_rows - push the next rows of the result as an array
+ * @ctx: duktape context
+ * @pstmt: pointer to the statement structure
+ * @limit: maximum number of rows, or negative for all the remaining rows
+ * @as_object: build objects keyed by the column labels instead of arrays
+ *
+ * The label strings are pushed once and shared by all the rows.
+ */
+static void push_rows(duk_context *ctx, struct prepared_statement *pstmt, double limit, int as_object)
+{
+	MYSQL_FIELD *fields = pstmt->r_meta ? mysql_fetch_fields(pstmt->r_meta) : NULL;
+	const struct column_decoder *dec = get_decoders(ctx, pstmt);
+	duk_idx_t keys_idx, arr_idx;
+	duk_uarridx_t count = 0;
+	unsigned int i;
+
+	as_object = as_object && fields;
+
+	keys_idx = duk_get_top(ctx);
+	if (as_object) {
+		duk_require_stack(ctx, pstmt->r_len + 4);
+		for (i = 0; i < pstmt->r_len; i++)
+			duk_push_string(ctx, fields[i].name);
+	}
+
+	arr_idx = duk_push_array(ctx);
+
+	while ((limit < 0 || count < limit) && pstmt->r_len && fetch_row(ctx, pstmt)) {
+		if (as_object) {
+			duk_push_object(ctx);
+			for (i = 0; i < pstmt->r_len; i++) {
+				duk_dup(ctx, keys_idx + i);
+				push_column(ctx, dec, pstmt, i);
+				duk_put_prop(ctx, -3);
+			}
+		} else {
+			duk_push_array(ctx);
+			for (i = 0; i < pstmt->r_len; i++) {
+				push_column(ctx, dec, pstmt, i);
+				duk_put_prop_index(ctx, -2, i);
+			}
+		}
+		duk_put_prop_index(ctx, arr_idx, count++);
+	}
+
+	/* Leave only the array on the stack */
+	if (as_object) {
+		duk_insert(ctx, keys_idx);
+		duk_set_top(ctx, keys_idx + 1);
+	}
+}
+
+/**
+ * push_column_list - resolve a list of columns
+ * @ctx: duktape context
+ * @pstmt: pointer to the statement structure
+ * @idx: stack index of the array of 1-based column indexes or labels
+ * @len: the number of columns is stored here
+ *
+ * If there is no array at @idx, all the columns are used. The 0-based
+ * indexes are stored in a buffer pushed on the stack.
+ */
+static int *push_column_list(duk_context *ctx, struct prepared_statement *pstmt, duk_idx_t idx, unsigned int *len)
+{
+	unsigned int i;
+	int *cols;
+
+	if (!duk_is_array(ctx, idx)) {
+		*len = pstmt->r_len;
+		cols = duk_push_fixed_buffer(ctx, (*len ? *len : 1) * sizeof(int));
+		for (i = 0; i < *len; i++)
+			cols[i] = i;
+		return cols;
+	}
+
+	*len = duk_get_length(ctx, idx);
+	cols = duk_push_fixed_buffer(ctx, (*len ? *len : 1) * sizeof(int));
+
+	for (i = 0; i < *len; i++) {
+		duk_get_prop_index(ctx, idx, i);
+		if (duk_is_string(ctx, -1))
+			cols[i] = column_map_lookup(pstmt->labels, duk_get_string(ctx, -1), 1);
+		else
+			cols[i] = duk_to_int(ctx, -1) - 1;
+		duk_pop(ctx);
+
+		if (cols[i] < 0 || cols[i] >= (int)pstmt->r_len)
+			duk_error(ctx, DUK_ERR_RANGE_ERROR, "Column %u does not exist\n", i + 1);
+	}
+
+	return cols;
+}
+
+/**
+ * MysqlResultSet_fetchColumns - fetch up to n rows in columnar form
+ *
+ * fetchColumns(n[, columns]) returns an array with one object per column:
+ * {name, values, nulls}. Integer columns that fit are returned as an
+ * Int32Array, other integer and floating point columns as a Float64Array
+ * and the rest as arrays of strings. Bit i of the nulls bitmap is set if
+ * the value in row i is NULL. Numeric values are fetched by the client
+ * library straight into the typed array memory.
+ */
+static int MysqlResultSet_fetchColumns(duk_context *ctx)
+{
+	struct prepared_statement *pstmt = get_result_statement(ctx);
+	double limit = duk_to_number(ctx, 0);
+	const struct column_decoder *dec;
+	MYSQL_FIELD *fields;
+	struct column_set set;
+	const char **names;
+	unsigned int i, len;
+	int *cols, *types;
+	duk_size_t row;
+	MYSQL_BIND bind;
+	char *value;
+
+	if (!(limit >= 0))
+		duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s", "The number of rows must be positive\n");
+
+	if (pstmt->r_meta == NULL) {
+		duk_push_array(ctx);
+		return 1;
+	}
+	fields = mysql_fetch_fields(pstmt->r_meta);
+	dec = get_decoders(ctx, pstmt);
+
+	cols = push_column_list(ctx, pstmt, 1, &len);
+
+	types = duk_push_fixed_buffer(ctx, (len ? len : 1) * sizeof(int));
+	names = duk_push_fixed_buffer(ctx, (len ? len : 1) * sizeof(char *));
+	for (i = 0; i < len; i++) {
+		types[i] = dec[cols[i]].column_type;
+		names[i] = fields[cols[i]].name;
+	}
+
+	/* The number of rows is not known until they are all fetched */
+	column_set_init(ctx, &set, types, len, limit < 1024 ? (duk_size_t)limit : 1024);
+
+	while (set.rows < limit && fetch_row(ctx, pstmt)) {
+		row = column_set_add_row(ctx, &set);
+
+		for (i = 0; i < len; i++) {
+			if (pstmt->r_is_null[cols[i]]) {
+				column_set_null(&set, i, row);
+				continue;
+			}
+
+			if (types[i] == COLUMN_STRING) {
+				value = fetch_string(ctx, pstmt, cols[i]);
+				column_set_string(ctx, &set, i, row, value, pstmt->r_bind_len[cols[i]]);
+				continue;
+			}
+
+			memset(&bind, 0, sizeof(MYSQL_BIND));
+			if (types[i] == COLUMN_INT32) {
+				bind.buffer_type = MYSQL_TYPE_LONG;
+				bind.buffer = (int32_t *)set.columns[i].values + row;
+			} else {
+				bind.buffer_type = MYSQL_TYPE_DOUBLE;
+				bind.buffer = (double *)set.columns[i].values + row;
+			}
+
+			if (mysql_stmt_fetch_column(pstmt->stmt, &bind, cols[i], 0))
+				duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+		}
+	}
+
+	column_set_finish(ctx, &set, names);
+	return 1;
+}
+
+/**
+ * MysqlResultSet_forEach - call a function for each of the remaining rows
+ *
+ * forEach(fn[, {columns, asObject}]) advances the cursor in C and calls
+ * fn with the values of the row as arguments (or with a single object
+ * keyed by the column labels if asObject is set). The columns option
+ * selects the columns by 1-based index or label. The iteration stops
+ * early if fn returns false. Returns the number of rows processed.
+ */
+static int MysqlResultSet_forEach(duk_context *ctx)
+{
+	struct prepared_statement *pstmt = get_result_statement(ctx);
+	const struct column_decoder *dec;
+	MYSQL_FIELD *fields;
+	duk_idx_t keys_idx;
+	unsigned int i, len;
+	double count = 0;
+	int *cols, as_object, stop;
+
+	if (!duk_is_function(ctx, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The first parameter should be a function\n");
+
+	as_object = as_object_option(ctx, 1);
+
+	if (pstmt->r_meta == NULL) {
+		duk_push_int(ctx, 0);
+		return 1;
+	}
+	fields = mysql_fetch_fields(pstmt->r_meta);
+	dec = get_decoders(ctx, pstmt);
+
+	if (duk_is_object(ctx, 1))
+		duk_get_prop_string(ctx, 1, "columns");
+	else
+		duk_push_undefined(ctx);
+	cols = push_column_list(ctx, pstmt, duk_get_top_index(ctx), &len);
+
+	duk_require_stack(ctx, 2 * len + 4);
+	keys_idx = duk_get_top(ctx);
+	if (as_object)
+		for (i = 0; i < len; i++)
+			duk_push_string(ctx, fields[cols[i]].name);
+
+	while (fetch_row(ctx, pstmt)) {
+		duk_dup(ctx, 0);
+		if (as_object) {
+			duk_push_object(ctx);
+			for (i = 0; i < len; i++) {
+				duk_dup(ctx, keys_idx + i);
+				push_column(ctx, dec, pstmt, cols[i]);
+				duk_put_prop(ctx, -3);
+			}
+			duk_call(ctx, 1);
+		} else {
+			for (i = 0; i < len; i++)
+				push_column(ctx, dec, pstmt, cols[i]);
+			duk_call(ctx, len);
+		}
+
+		count++;
+		stop = duk_is_boolean(ctx, -1) && !duk_get_boolean(ctx, -1);
+		duk_pop(ctx);
+		if (stop)
+			break;
+	}
+
+	duk_push_number(ctx, count);
+	return 1;
+}
+
+/**
+ * MysqlResultSet_nextInto - move to the next row and store its values
+ *
+ * nextInto(row) overwrites the elements of an array (by column position)
+ * or the properties of an object (by column label) in place, so a loop
+ * over a large result can reuse a single object. Returns false at the
+ * end of the result, leaving the object unchanged.
+ */
+static int MysqlResultSet_nextInto(duk_context *ctx)
+{
+	struct prepared_statement *pstmt = get_result_statement(ctx);
+	MYSQL_FIELD *fields = pstmt->r_meta ? mysql_fetch_fields(pstmt->r_meta) : NULL;
+	const struct column_decoder *dec = get_decoders(ctx, pstmt);
+	unsigned int i;
+	int is_array;
+
+	if (!duk_is_object(ctx, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The parameter should be an object or an array\n");
+
+	if (!pstmt->r_len || !fetch_row(ctx, pstmt)) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	is_array = duk_is_array(ctx, 0) || fields == NULL;
+
+	for (i = 0; i < pstmt->r_len; i++) {
+		push_column(ctx, dec, pstmt, i);
+		if (is_array)
+			duk_put_prop_index(ctx, 0, i);
+		else
+			duk_put_prop_string(ctx, 0, fields[i].name);
+	}
+
+	duk_push_true(ctx);
+	return 1;
+}
+
+/**
+ * json_column - append the JSON representation of a column
+ * @ctx: duktape context
+ * @w: the writer
+ * @dec: the decoder table of the result
+ * @pstmt: pointer to the statement structure
+ * @i: column index (0-based)
+ *
+ * Numbers are written as JSON numbers, except for BIGINT values beyond
+ * 2^53 and DECIMAL values, which are written as strings like push_column()
+ * does. JSON columns are copied as is and non-finite floats become null.
+ */
+static inline void json_column(duk_context *ctx, struct text_writer *w, const struct column_decoder *dec,
+		struct prepared_statement *pstmt, unsigned int i)
+{
+	if (pstmt->r_is_null[i])
+		writer_append(ctx, w, "null", 4);
+	else
+		dec[i].json(ctx, w, pstmt, i);
+}
+
+/**
+ * MysqlResultSet_toJSON - serialize the remaining rows as JSON
+ *
+ * toJSON([{format: "objects" | "arrays", limit: n}]) writes the rows
+ * directly into a single string, without creating a JS value per cell.
+ * With the default "objects" format each row is an object keyed by the
+ * column labels; with "arrays" each row is an array.
+ */
+static int MysqlResultSet_toJSON(duk_context *ctx)
+{
+	struct prepared_statement *pstmt = get_result_statement(ctx);
+	MYSQL_FIELD *fields = pstmt->r_meta ? mysql_fetch_fields(pstmt->r_meta) : NULL;
+	const struct column_decoder *dec = get_decoders(ctx, pstmt);
+	struct text_writer keys, w;
+	duk_size_t *offsets;
+	double limit = -1, count = 0;
+	unsigned int i;
+	int as_object = 1;
+
+	if (duk_is_object(ctx, 0)) {
+		duk_get_prop_string(ctx, 0, "format");
+		if (duk_is_string(ctx, -1) && !strcmp(duk_get_string(ctx, -1), "arrays"))
+			as_object = 0;
+		else if (!duk_is_undefined(ctx, -1) && strcmp(duk_safe_to_string(ctx, -1), "objects"))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The format should be \"objects\" or \"arrays\"\n");
+		duk_pop(ctx);
+
+		duk_get_prop_string(ctx, 0, "limit");
+		if (!duk_is_undefined(ctx, -1))
+			limit = duk_to_number(ctx, -1);
+		duk_pop(ctx);
+	}
+
+	if (fields == NULL)
+		as_object = 0;
+
+	/* Escape the keys once: "label": */
+	offsets = duk_push_fixed_buffer(ctx, (pstmt->r_len + 1) * sizeof(duk_size_t));
+	writer_init(ctx, &keys, 256);
+	for (i = 0; as_object && i < pstmt->r_len; i++) {
+		offsets[i] = keys.len;
+		writer_json_string(ctx, &keys, fields[i].name, strlen(fields[i].name));
+		writer_putc(ctx, &keys, ':');
+	}
+	offsets[i] = keys.len;
+
+	writer_init(ctx, &w, 4096);
+	writer_putc(ctx, &w, '[');
+
+	while ((limit < 0 || count < limit) && pstmt->r_len && fetch_row(ctx, pstmt)) {
+		if (count++)
+			writer_putc(ctx, &w, ',');
+		writer_putc(ctx, &w, as_object ? '{' : '[');
+		for (i = 0; i < pstmt->r_len; i++) {
+			if (i)
+				writer_putc(ctx, &w, ',');
+			if (as_object)
+				writer_append(ctx, &w, keys.data + offsets[i], offsets[i + 1] - offsets[i]);
+			json_column(ctx, &w, dec, pstmt, i);
+		}
+		writer_putc(ctx, &w, as_object ? '}' : ']');
+	}
+
+	writer_putc(ctx, &w, ']');
+	writer_finish(ctx, &w);
 
 	return 1;
 }
 
-static int validate_paramater_index(duk_context *ctx, struct prepared_statement **pstmt, uint32_t *i)
+struct csv_export {
+	struct prepared_statement *pstmt;
+	int fd;
+	char delimiter;
+	int header;
+	const char *null_string;
+	const char *line_end;
+	double rows;
+	double bytes;
+};
+
+/* Called through duk_safe_call(), so that the file can be closed on errors */
+static duk_ret_t write_csv_rows(duk_context *ctx, void *udata)
 {
-	int argc = duk_get_top(ctx);
+	struct csv_export *ex = udata;
+	struct prepared_statement *pstmt = ex->pstmt;
+	MYSQL_FIELD *fields = pstmt->r_meta ? mysql_fetch_fields(pstmt->r_meta) : NULL;
+	struct text_writer w;
+	size_t null_len = strlen(ex->null_string), end_len = strlen(ex->line_end);
+	unsigned int i;
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "pstmt");
-	*pstmt = (struct prepared_statement *)duk_get_pointer(ctx, -1);
+	writer_init_fd(ctx, &w, ex->fd, MYSQL_CSV_BUFFER_SIZE);
 
-	if (pstmt == NULL)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
+	if (ex->header && fields && pstmt->r_len) {
+		for (i = 0; i < pstmt->r_len; i++) {
+			if (i)
+				writer_putc(ctx, &w, ex->delimiter);
+			writer_csv_field(ctx, &w, fields[i].name, strlen(fields[i].name), ex->delimiter);
+		}
+		writer_append(ctx, &w, ex->line_end, end_len);
+	}
 
-	if (argc < 1)
-		return 0;
+	while (pstmt->r_len && fetch_row(ctx, pstmt)) {
+		for (i = 0; i < pstmt->r_len; i++) {
+			if (i)
+				writer_putc(ctx, &w, ex->delimiter);
+			if (pstmt->r_is_null[i])
+				writer_append(ctx, &w, ex->null_string, null_len);
+			else
+				writer_csv_field(ctx, &w, fetch_string(ctx, pstmt, i), pstmt->r_bind_len[i], ex->delimiter);
+		}
+		writer_append(ctx, &w, ex->line_end, end_len);
+		ex->rows++;
+	}
 
-	*i = duk_get_int(ctx, 0);
+	writer_flush(ctx, &w);
+	ex->bytes = w.written;
 
-	if (*i < 1 || *i > (*pstmt)->p_len)
-		return 0;
+	return 0;
+}
 
-	(*i)--;
-	if ((*pstmt)->p_bind[*i].buffer) {
-		/* Free previously assigned value (buffer) */
-		free((*pstmt)->p_bind[*i].buffer);
-		/* Prevent second free in execute_statement()
-		if we never set any other value later */
-		(*pstmt)->p_bind[*i].buffer = NULL;
+/**
+ * MysqlResultSet_writeCSV - write the remaining rows to a file in CSV format
+ *
+ * writeCSV(fdOrPath[, {delimiter, header, nullString, lineEnding}])
+ * streams the rows through a reusable buffer of MYSQL_CSV_BUFFER_SIZE
+ * bytes, with RFC 4180 quoting. The defaults are ",", true, "" and
+ * "\r\n". A path is created or truncated and closed when done; a file
+ * descriptor is left open. Returns {bytes, rows}.
+ */
+static int MysqlResultSet_writeCSV(duk_context *ctx)
+{
+	struct csv_export ex;
+	const char *path = NULL;
+	int rc;
+
+	memset(&ex, 0, sizeof(ex));
+	ex.pstmt = get_result_statement(ctx);
+	ex.delimiter = ',';
+	ex.header = 1;
+	ex.null_string = "";
+	ex.line_end = "\r\n";
+
+	if (duk_is_object(ctx, 1)) {
+		duk_get_prop_string(ctx, 1, "delimiter");
+		if (duk_is_string(ctx, -1) && duk_get_length(ctx, -1) == 1)
+			ex.delimiter = duk_get_string(ctx, -1)[0];
+		else if (!duk_is_undefined(ctx, -1))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The delimiter should be a single character\n");
+		duk_get_prop_string(ctx, 1, "header");
+		if (!duk_is_undefined(ctx, -1))
+			ex.header = duk_to_boolean(ctx, -1);
+		/* The strings are kept on the stack */
+		duk_get_prop_string(ctx, 1, "nullString");
+		if (!duk_is_undefined(ctx, -1))
+			ex.null_string = duk_to_string(ctx, -1);
+		duk_get_prop_string(ctx, 1, "lineEnding");
+		if (!duk_is_undefined(ctx, -1))
+			ex.line_end = duk_to_string(ctx, -1);
 	}
-	if (argc < 2 || duk_is_null(ctx, 1)) {
-		(*pstmt)->p_bind[*i].buffer_type = MYSQL_TYPE_NULL;
-		return 0;
+
+	if (duk_is_number(ctx, 0))
+		ex.fd = duk_get_int(ctx, 0);
+	else {
+		path = duk_require_string(ctx, 0);
+		ex.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (ex.fd < 0)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
 	}
 
+	rc = duk_safe_call(ctx, write_csv_rows, &ex, 0, 1);
+
+	if (path && close(ex.fd) && rc == DUK_EXEC_SUCCESS)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
+	if (rc != DUK_EXEC_SUCCESS)
+		duk_throw(ctx);
+
+	duk_push_object(ctx);
+	duk_push_number(ctx, ex.bytes);
+	duk_put_prop_string(ctx, -2, "bytes");
+	duk_push_number(ctx, ex.rows);
+	duk_put_prop_string(ctx, -2, "rows");
+
 	return 1;
 }
 
-/* {{{ MysqlPreparedGeneratedKeys */
+struct arrow_export {
+	struct prepared_statement *pstmt;
+	int fd;
+	duk_size_t batch_rows;
+	double rows;
+	double bytes;
+};
 
-static int MysqlGeneratedKeys_getNumber(duk_context *ctx)
+static duk_ret_t write_arrow_rows(duk_context *ctx, void *udata)
 {
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "generatedKeys");
-	struct generated_keys *k = duk_get_pointer(ctx, -1);
+	struct arrow_export *ex = udata;
+	struct prepared_statement *pstmt = ex->pstmt;
+	MYSQL_FIELD *fields = pstmt->r_meta ? mysql_fetch_fields(pstmt->r_meta) : NULL;
+	const struct column_decoder *dec = get_decoders(ctx, pstmt);
+	unsigned int i, n = fields ? pstmt->r_len : 0;
+	struct arrow_writer w;
+	MYSQL_BIND bind;
+	long long ival;
+	double dval;
+
+	arrow_init(ctx, &w, ex->fd, n, ex->batch_rows);
+	for (i = 0; i < n; i++)
+		arrow_column(ctx, &w, i, fields[i].name, dec[i].arrow_type);
+	arrow_begin(ctx, &w);
+
+	while (n && fetch_row(ctx, pstmt)) {
+		for (i = 0; i < n; i++) {
+			if (pstmt->r_is_null[i]) {
+				arrow_null(&w, i);
+				continue;
+			}
+
+			memset(&bind, 0, sizeof(MYSQL_BIND));
+
+			switch (w.columns[i].type) {
+			case ARROW_INT32:
+			case ARROW_INT64:
+			case ARROW_UINT64:
+				bind.buffer_type = MYSQL_TYPE_LONGLONG;
+				bind.buffer = &ival;
+				bind.is_unsigned = dec[i].is_unsigned;
+				break;
+			case ARROW_FLOAT64:
+				bind.buffer_type = MYSQL_TYPE_DOUBLE;
+				bind.buffer = &dval;
+				break;
+			default:
+				/* Fetch the value straight into the column data */
+				bind.buffer_type = MYSQL_TYPE_STRING;
+				bind.buffer = arrow_reserve(ctx, &w, i, pstmt->r_bind_len[i]);
+				bind.buffer_length = pstmt->r_bind_len[i];
+			}
+
+			if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
+				duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+
+			switch (w.columns[i].type) {
+			case ARROW_INT32:
+				arrow_int32(&w, i, ival);
+				break;
+			case ARROW_INT64:
+			case ARROW_UINT64:
+				arrow_int64(&w, i, ival);
+				break;
+			case ARROW_FLOAT64:
+				arrow_float64(&w, i, dval);
+				break;
+			default:
+				arrow_commit(&w, i, pstmt->r_bind_len[i]);
+			}
+		}
+		arrow_end_row(ctx, &w);
+	}
 
-	if (k)
-		duk_push_int(ctx, k->last_insert_id);
-	else
-		duk_push_null(ctx);
+	arrow_finish(ctx, &w);
+	ex->rows = w.total_rows;
+	ex->bytes = w.offset;
 
-	return 1;
+	return 0;
 }
 
-static int MysqlGeneratedKeys_getString(duk_context *ctx)
+/**
+ * MysqlResultSet_writeArrow - write the remaining rows to an Arrow IPC file
+ *
+ * writeArrow(fdOrPath[, {batchRows}]) converts the rows column-wise into
+ * record batches of batchRows rows (ARROW_DEFAULT_BATCH_ROWS by default).
+ * Integer columns map to Int32, Int64 or UInt64 depending on their range,
+ * FLOAT and DOUBLE to Float64, binary strings and BIT to Binary and all
+ * the other types, including DECIMAL, to Utf8. Returns {bytes, rows}.
+ */
+static int MysqlResultSet_writeArrow(duk_context *ctx)
 {
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "generatedKeys");
-	struct generated_keys *k = duk_get_pointer(ctx, -1);
-	char *cstr;
+	struct arrow_export ex;
+	const char *path = NULL;
+	double batch_rows;
+	int rc;
 
-	if (k == NULL) {
-		duk_push_null(ctx);
-		return 1;
+	memset(&ex, 0, sizeof(ex));
+	ex.pstmt = get_result_statement(ctx);
+	ex.batch_rows = ARROW_DEFAULT_BATCH_ROWS;
+
+	if (duk_is_object(ctx, 1)) {
+		duk_get_prop_string(ctx, 1, "batchRows");
+		if (!duk_is_undefined(ctx, -1)) {
+			batch_rows = duk_to_number(ctx, -1);
+			if (!(batch_rows >= 1 && batch_rows <= ARROW_MAX_BATCH_ROWS))
+				duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s", "Invalid batchRows\n");
+			ex.batch_rows = batch_rows;
+		}
+		duk_pop(ctx);
 	}
 
-	if (asprintf(&cstr, "%ju", (uintmax_t)k->last_insert_id) == -1)
-		return DUK_RET_ERROR;
+	if (duk_is_number(ctx, 0))
+		ex.fd = duk_get_int(ctx, 0);
+	else {
+		path = duk_require_string(ctx, 0);
+		ex.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (ex.fd < 0)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
+	}
 
-	duk_push_string(ctx, cstr);
-	free(cstr);
+	rc = duk_safe_call(ctx, write_arrow_rows, &ex, 0, 1);
 
-	return 1;
-}
+	if (path && close(ex.fd) && rc == DUK_EXEC_SUCCESS)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
+	if (rc != DUK_EXEC_SUCCESS)
+		duk_throw(ctx);
 
-static int MysqlGeneratedKeys_next(duk_context *ctx)
-{
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "generatedKeys");
-	struct generated_keys *k = duk_get_pointer(ctx, -1);
+	duk_push_object(ctx);
+	duk_push_number(ctx, ex.bytes);
+	duk_put_prop_string(ctx, -2, "bytes");
+	duk_push_number(ctx, ex.rows);
+	duk_put_prop_string(ctx, -2, "rows");
 
-	if (k == NULL)
-		duk_push_false(ctx);
+	return 1;
+}
 
-	if (k->cursor >0)
-		k->last_insert_id++;
+/* {{{ Metadata */
 
-	if (k->cursor < k->affected_rows) {
-		k->cursor++;
-		duk_push_true(ctx);
-	} else
-		duk_push_false(ctx);
+/* Floating point columns without a fixed number of decimals */
+#ifndef NOT_FIXED_DEC
+#define NOT_FIXED_DEC	31
+#endif
 
-	return 1;
+/* The SQL name of the type of a column */
+static const char *type_name(const MYSQL_FIELD *field)
+{
+	bool binary = field->charsetnr == 63;
+
+	switch (field->type) {
+	case MYSQL_TYPE_TINY:		return "TINYINT";
+	case MYSQL_TYPE_SHORT:		return "SMALLINT";
+	case MYSQL_TYPE_INT24:		return "MEDIUMINT";
+	case MYSQL_TYPE_LONG:		return "INT";
+	case MYSQL_TYPE_LONGLONG:	return "BIGINT";
+	case MYSQL_TYPE_FLOAT:		return "FLOAT";
+	case MYSQL_TYPE_DOUBLE:		return "DOUBLE";
+	case MYSQL_TYPE_DECIMAL:
+	case MYSQL_TYPE_NEWDECIMAL:	return "DECIMAL";
+	case MYSQL_TYPE_NULL:		return "NULL";
+	case MYSQL_TYPE_TIMESTAMP:	return "TIMESTAMP";
+	case MYSQL_TYPE_DATE:
+	case MYSQL_TYPE_NEWDATE:	return "DATE";
+	case MYSQL_TYPE_TIME:		return "TIME";
+	case MYSQL_TYPE_DATETIME:	return "DATETIME";
+	case MYSQL_TYPE_YEAR:		return "YEAR";
+	case MYSQL_TYPE_BIT:		return "BIT";
+	case MYSQL_TYPE_JSON:		return "JSON";
+	case MYSQL_TYPE_ENUM:		return "ENUM";
+	case MYSQL_TYPE_SET:		return "SET";
+	case MYSQL_TYPE_GEOMETRY:	return "GEOMETRY";
+	case MYSQL_TYPE_TINY_BLOB:
+	case MYSQL_TYPE_MEDIUM_BLOB:
+	case MYSQL_TYPE_LONG_BLOB:
+	case MYSQL_TYPE_BLOB:		return binary ? "BLOB" : "TEXT";
+	case MYSQL_TYPE_VARCHAR:
+	case MYSQL_TYPE_VAR_STRING:
+		return binary ? "VARBINARY" : "VARCHAR";
+	case MYSQL_TYPE_STRING:
+		/* ENUM and SET columns are reported as strings with a flag */
+		if (field->flags & ENUM_FLAG)
+			return "ENUM";
+		if (field->flags & SET_FLAG)
+			return "SET";
+		return binary ? "BINARY" : "CHAR";
+	default:
+		return NULL;
+	}
 }
 
-static int MysqlGeneratedKeys_finalize(duk_context *ctx)
+/**
+ * describe_field - describe a column of the result
+ * @info: the description to fill in
+ * @field: the column metadata
+ *
+ * The precision is the display length of the column, except for DECIMAL
+ * columns where it is the number of digits. The scale is the number of
+ * decimals (fractional seconds for temporal columns).
+ */
+static void describe_field(struct column_info *info, const MYSQL_FIELD *field)
 {
-	struct generated_keys *k;
-	duk_get_prop_string(ctx, 0, "generatedKeys");
-
-	k = duk_get_pointer(ctx, -1);
-	if (k) {
-		free(k);
-		k = NULL;
+	info->name = field->name;
+	info->type = field->type;
+	info->type_name = type_name(field);
+	info->precision = field->length;
+	info->scale = field->decimals < NOT_FIXED_DEC ? (int)field->decimals : -1;
+	info->nullable = !(field->flags & NOT_NULL_FLAG);
+
+	/* The length counts the sign and the decimal point */
+	if (field->type == MYSQL_TYPE_DECIMAL || field->type == MYSQL_TYPE_NEWDECIMAL) {
+		if (field->decimals > 0)
+			info->precision--;
+		if (!(field->flags & UNSIGNED_FLAG))
+			info->precision--;
 	}
-
-	return 0;
 }
 
-static duk_function_list_entry MysqlGeneratedKeys_functions[] = {
-	{"getNumber",	MysqlGeneratedKeys_getNumber,	1},
-	{"getString",	MysqlGeneratedKeys_getString,	1},
-	{"next",	MysqlGeneratedKeys_next,	0},
-	{NULL,		NULL, 				0}
-};
-
-/* }}} MysqlPreparedGeneratedKeys */
-
-/* {{{ MysqlPreparedResultSet */
-
-static int MysqlResultSet_getNumber(duk_context *ctx)
+/*
+ * Describe the columns of the result set as {columnCount, columns}, built
+ * on the first call and returned again afterwards
+ */
+static int MysqlResultSet_getMetaData(duk_context *ctx)
 {
 	struct prepared_statement *pstmt;
-	uint32_t i;
-	MYSQL_BIND bind;
-	double val;
+	struct column_info info;
+	MYSQL_FIELD *fields;
+	unsigned int i, n;
 
-	if(!validate_column_index(ctx, &pstmt, &i))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+	if (push_cached(ctx, "metaData"))
+		return 1;
 
-	memset(&bind, 0, sizeof(MYSQL_BIND));
-	bind.buffer_type = MYSQL_TYPE_DOUBLE;
-	bind.buffer = &val;
-	bind.buffer_length = sizeof(double);
+	pstmt = get_result_statement(ctx);
+	if (pstmt->r_meta == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement did not return a result set\n");
 
-	if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+	n = mysql_num_fields(pstmt->r_meta);
+	fields = mysql_fetch_fields(pstmt->r_meta);
+
+	duk_push_object(ctx);
+	duk_push_uint(ctx, n);
+	duk_put_prop_string(ctx, -2, "columnCount");
+
+	duk_push_array(ctx);
+	for (i = 0; i < n; i++) {
+		describe_field(&info, &fields[i]);
+		push_column_info(ctx, &info);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	duk_put_prop_string(ctx, -2, "columns");
 
-	duk_push_int(ctx, val);
+	cache_value(ctx, "metaData");
 	return 1;
 }
 
-static int MysqlResultSet_getString(duk_context *ctx)
+/* }}} Metadata */
+
+/* Report whether the last value read by a getter was NULL */
+static int MysqlResultSet_wasNull(duk_context *ctx)
 {
-	struct prepared_statement *pstmt;
-	uint32_t i;
-	MYSQL_BIND bind;
-	char *cbuf;
+	struct prepared_statement *pstmt = get_result_statement(ctx);
 
-	if(!validate_column_index(ctx, &pstmt, &i))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Index is not valid\n");
+	duk_push_boolean(ctx, pstmt->was_null);
+	return 1;
+}
 
-	if (!pstmt->r_bind_len[i]) {
-		duk_push_string(ctx, "");
-		return 1;
-	}
+static int MysqlResultSet_next(duk_context *ctx)
+{
+	struct prepared_statement *pstmt = get_result_statement(ctx);
 
-	cbuf = malloc(pstmt->r_bind_len[i]);
-	assert(cbuf);
+	duk_push_boolean(ctx, fetch_row(ctx, pstmt));
 
-	memset(&bind, 0, sizeof(MYSQL_BIND));
-	bind.buffer_type = MYSQL_TYPE_STRING;
-	bind.buffer = cbuf;
-	bind.buffer_length = pstmt->r_bind_len[i];
+	return 1;
+}
 
-	if (mysql_stmt_fetch_column(pstmt->stmt, &bind, i, 0))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
+/**
+ * MysqlResultSet_toArray - get all the remaining rows
+ *
+ * toArray([{asObject: true}]) returns an array of rows, built entirely
+ * in C, instead of calling next() and the getters for each cell.
+ */
+static int MysqlResultSet_toArray(duk_context *ctx)
+{
+	struct prepared_statement *pstmt = get_result_statement(ctx);
 
-	duk_push_lstring(ctx, cbuf, pstmt->r_bind_len[i]);
+	push_rows(ctx, pstmt, -1, as_object_option(ctx, 0));
 	return 1;
 }
 
-static int MysqlResultSet_next(duk_context *ctx)
+/**
+ * MysqlResultSet_fetchRows - get up to n of the remaining rows
+ *
+ * fetchRows(n[, {asObject: true}]) returns an empty array at the end of
+ * the result.
+ */
+static int MysqlResultSet_fetchRows(duk_context *ctx)
 {
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "pstmt");
-	struct prepared_statement *pstmt = duk_get_pointer(ctx, -1);
-	if (pstmt == NULL)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
+	struct prepared_statement *pstmt = get_result_statement(ctx);
+	double limit = duk_to_number(ctx, 0);
 
-	switch (mysql_stmt_fetch(pstmt->stmt)) {
-	case 0:
-	case MYSQL_DATA_TRUNCATED:
-		duk_push_true(ctx);
-		break;
-	case MYSQL_NO_DATA:
-		duk_push_false(ctx);
-		break;
-	default:
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", mysql_stmt_error(pstmt->stmt));
-	}
+	if (!(limit >= 0))
+		duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s", "The number of rows must be positive\n");
 
+	push_rows(ctx, pstmt, limit, as_object_option(ctx, 1));
 	return 1;
 }
 
+static int MysqlResultSet_finalize(duk_context *ctx)
+{
+	duk_get_prop_string(ctx, 0, "pstmt");
+	release_statement(duk_get_pointer(ctx, -1));
+
+	return 0;
+}
+
 static duk_function_list_entry MysqlResultSet_functions[] = {
 	{"getNumber",	MysqlResultSet_getNumber,	1},
 	{"getString",	MysqlResultSet_getString,	1},
+	{"getBuffer",	MysqlResultSet_getBuffer,	1},
+	{"getInt",	MysqlResultSet_getInt,		1},
+	{"getLong",	MysqlResultSet_getLong,		1},
+	{"getDouble",	MysqlResultSet_getDouble,	1},
+	{"getBoolean",	MysqlResultSet_getBoolean,	1},
+	{"getBytes",	MysqlResultSet_getBytes,	1},
+	{"getJSON",	MysqlResultSet_getJSON,		1},
+	{"getArray",	MysqlResultSet_getArray,	1},
+	{"getDate",	MysqlResultSet_getDate,		1},
+	{"getTimestamp",	MysqlResultSet_getTimestamp,	1},
+	{"getMetaData",		MysqlResultSet_getMetaData,	0},
+	{"wasNull",	MysqlResultSet_wasNull,		0},
 	{"next",	MysqlResultSet_next,		0},
+	{"toArray",	MysqlResultSet_toArray,		DUK_VARARGS},
+	{"fetchRows",	MysqlResultSet_fetchRows,	DUK_VARARGS},
+	{"fetchColumns",	MysqlResultSet_fetchColumns,	DUK_VARARGS},
+	{"forEach",	MysqlResultSet_forEach,		DUK_VARARGS},
+	{"nextInto",	MysqlResultSet_nextInto,	1},
+	{"toJSON",	MysqlResultSet_toJSON,		DUK_VARARGS},
+	{"writeCSV",	MysqlResultSet_writeCSV,	DUK_VARARGS},
+	{"writeArrow",	MysqlResultSet_writeArrow,	DUK_VARARGS},
 	{NULL,		NULL, 				0}
 };
 
@@ -510,6 +2204,7 @@ out:
 
 static int MysqlStatement_execute(duk_context *ctx)
 {
+	struct prepared_statement *pstmt;
 	int argc = duk_get_top(ctx);
 	bool generated_keys;
 
@@ -519,11 +2214,7 @@ static int MysqlStatement_execute(duk_context *ctx)
 	generated_keys = return_generated_keys(ctx);
 
 	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "pstmt");
-	struct prepared_statement *pstmt = duk_get_pointer(ctx, -1);
-
-	if (pstmt)
-		clear_statement(pstmt);
+	detach_statement(ctx, -1);
 
 	/* Must push the Statement object on the stack as it is used by
 	set_statement function */
@@ -547,17 +2238,14 @@ static int MysqlStatement_execute(duk_context *ctx)
 
 static int MysqlStatement_executeQuery(duk_context *ctx)
 {
+	struct prepared_statement *pstmt;
 	int argc = duk_get_top(ctx);
 
 	if (argc != 1) 
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Wrong number of arguments\n");
 
 	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "pstmt");
-	struct prepared_statement *pstmt = duk_get_pointer(ctx, -1);
-
-	if (pstmt)
-		clear_statement(pstmt);
+	detach_statement(ctx, -1);
 
 	/* Must push the Statement object on the stack as it is used by
 	set_statement function */
@@ -574,21 +2262,16 @@ static int MysqlStatement_executeQuery(duk_context *ctx)
 
 	execute_statement(ctx, pstmt);
 
-
 	/* Create MySQL Result Set object */
-	duk_push_object(ctx);
-
-	duk_get_global_string(ctx, "MysqlResultSet");
-	duk_set_prototype(ctx, -2);
-
-	duk_push_pointer(ctx, (void *) pstmt);
-	duk_put_prop_string(ctx, -2, "pstmt");
+	duk_push_this(ctx);
+	push_result_set(ctx, -1, pstmt);
 
 	return 1;
 }
 
 static int MysqlStatement_executeUpdate(duk_context *ctx)
 {
+	struct prepared_statement *pstmt;
 	int argc = duk_get_top(ctx);
 	bool generated_keys;
 
@@ -598,11 +2281,7 @@ static int MysqlStatement_executeUpdate(duk_context *ctx)
 	generated_keys = return_generated_keys(ctx);
 
 	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "pstmt");
-	struct prepared_statement *pstmt = duk_get_pointer(ctx, -1);
-
-	if(pstmt)
-		clear_statement(pstmt);
+	detach_statement(ctx, -1);
 
 	/* Must push the Statement object on the stack as it is used by
 	set_statement function */
@@ -675,17 +2354,13 @@ static int MysqlStatement_getResultSet(duk_context *ctx)
 	if (pstmt == NULL)
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
 
-	if (!pstmt->r_len)
+	if (!pstmt->r_len) {
 		duk_push_null(ctx);
+		return 1;
+	}
 
 	/* Create MySQL Result set object */
-	duk_push_object(ctx);
-
-	duk_get_global_string(ctx, "MysqlPreparedStatement");
-	duk_set_prototype(ctx, -2);
-
-	duk_push_pointer(ctx, (void *) pstmt);
-	duk_put_prop_string(ctx, -2, "pstmt");
+	push_result_set(ctx, -2, pstmt);
 
 	return 1;
 }
@@ -712,12 +2387,15 @@ static int MysqlStatement_getUpdateCount(duk_context *ctx)
 static int MysqlStatement_finalize(duk_context *ctx)
 {
 	struct prepared_statement *pstmt;
-	duk_get_prop_string(ctx, 0, "pstmt");
 
+	duk_get_prop_string(ctx, 0, "pstmt");
 	pstmt = duk_get_pointer(ctx, -1);
 
-	if (pstmt)
-		clear_statement(pstmt);
+	/* Errors cannot be thrown from a finalizer, so a failure to buffer
+	 * the rows is left for the result sets to run into */
+	if (pstmt != NULL && pstmt->refs > 1)
+		buffer_result(pstmt);
+	release_statement(pstmt);
 
 	return 0;
 }
@@ -798,6 +2476,7 @@ static int MysqlPreparedStatement_execute(duk_context *ctx)
 	if (pstmt == NULL)
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
 
+	pstmt = own_statement(ctx, pstmt);
 	execute_statement(ctx, pstmt);
 
 	duk_push_boolean(ctx, pstmt->r_len > 0);
@@ -819,16 +2498,12 @@ static int MysqlPreparedStatement_executeQuery(duk_context *ctx)
 	if (pstmt == NULL)
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
 
+	pstmt = own_statement(ctx, pstmt);
 	execute_statement(ctx, pstmt);
 
 	/* Create MySQL Result Set object */
-	duk_push_object(ctx);
-
-	duk_get_global_string(ctx, "MysqlResultSet");
-	duk_set_prototype(ctx, -2);
-
-	duk_push_pointer(ctx, (void *) pstmt);
-	duk_put_prop_string(ctx, -2, "pstmt");
+	duk_push_this(ctx);
+	push_result_set(ctx, -1, pstmt);
 
 	return 1;
 }
@@ -847,6 +2522,7 @@ static int MysqlPreparedStatement_executeUpdate(duk_context *ctx)
 	if (pstmt == NULL)
 		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
 
+	pstmt = own_statement(ctx, pstmt);
 	execute_statement(ctx, pstmt);
 
 	my_ulonglong rows = mysql_stmt_affected_rows(pstmt->stmt);
@@ -899,12 +2575,48 @@ static int MysqlPreparedStatement_setString(duk_context *ctx)
 	return 0;
 }
 
+/**
+ * MysqlPreparedStatement_getParameterMetaData - describe the parameters
+ * @ctx: duktape context
+ *
+ * Returns {parameterCount, parameters}. The server does not send the
+ * types of the parameters (mysql_stmt_param_metadata() always returns
+ * NULL), so every parameter is described with an unknown type. The
+ * object is built on the first call and returned again afterwards.
+ */
+static int MysqlPreparedStatement_getParameterMetaData(duk_context *ctx)
+{
+	struct prepared_statement *pstmt;
+	struct column_info info = {NULL, -1, NULL, -1, -1, -1};
+	unsigned int i;
+
+	if (push_cached(ctx, "parameterMetaData"))
+		return 1;
+
+	pstmt = get_result_statement(ctx);
+
+	duk_push_object(ctx);
+	duk_push_uint(ctx, pstmt->p_len);
+	duk_put_prop_string(ctx, -2, "parameterCount");
+
+	duk_push_array(ctx);
+	for (i = 0; i < pstmt->p_len; i++) {
+		push_column_info(ctx, &info);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	duk_put_prop_string(ctx, -2, "parameters");
+
+	cache_value(ctx, "parameterMetaData");
+	return 1;
+}
+
 static duk_function_list_entry MysqlPreparedStatement_functions[] = {
 	{"execute",		MysqlPreparedStatement_execute,		0},
 	{"executeQuery",	MysqlPreparedStatement_executeQuery,		0},
 	{"executeUpdate",	MysqlPreparedStatement_executeUpdate,	0},
 	{"setNumber",		MysqlPreparedStatement_setNumber,	2},
 	{"setString",		MysqlPreparedStatement_setString,	2},
+	{"getParameterMetaData",	MysqlPreparedStatement_getParameterMetaData,	0},
 	{NULL,			NULL,					0}
 };
 
@@ -1116,6 +2828,8 @@ duk_bool_t js_mysql_construct_and_register(duk_context *ctx)
 
 	/* Create MysqlResultSet "class" */
 	duk_push_object(ctx);
+	duk_push_c_function(ctx, MysqlResultSet_finalize, 2);
+	duk_set_finalizer(ctx, -2);
 	duk_put_function_list(ctx, -1, MysqlResultSet_functions);
 	duk_put_global_string(ctx, "MysqlResultSet");
 
@@ -3,6 +3,19 @@
 #ifndef jsmysql_h___
 #define jsmysql_h___
 
+#define MYSQL_CSV_BUFFER_SIZE		65536
+
+/* Column decoder kinds, derived from the metadata of a column */
+#define MYSQL_DECODE_TEXT		0
+#define MYSQL_DECODE_INTEGER		1
+#define MYSQL_DECODE_FLOAT		2
+#define MYSQL_DECODE_DECIMAL		3
+#define MYSQL_DECODE_BIT		4
+#define MYSQL_DECODE_BINARY		5
+#define MYSQL_DECODE_JSON		6
+#define MYSQL_DECODE_TEMPORAL		7
+#define MYSQL_DECODE_SET		8
+
 duk_bool_t js_mysql_construct_and_register(duk_context *ctx);
 
 #endif
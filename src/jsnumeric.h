@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef jsnumeric_h___
+#define jsnumeric_h___
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Locale independent parsing of the text form of numbers, as sent by the
+ * database servers. The strings do not need to be NUL-terminated.
+ */
+
+int parse_int64(const char *str, size_t len, int64_t *value);
+int parse_double(const char *str, size_t len, double *value);
+
+/* The number in @str, or NaN if it is not one */
+static inline double text_to_double(const char *str, size_t len)
+{
+	double value;
+
+	return parse_double(str, len, &value) ? value : NAN;
+}
+
+/* The integer in @str, or 0 if it is not one */
+static inline int64_t text_to_int64(const char *str, size_t len)
+{
+	int64_t value;
+
+	return parse_int64(str, len, &value) ? value : 0;
+}
+
+#endif
@@ -1,19 +1,76 @@
 /* SPDX-License-Identifier: MIT */
 
 #define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 #include <jsmisc.h>
 #include <libpq-fe.h>
 
+#include "config.h"
 #include "jspgsql.h"
 #include "jssql.h"
 #include "jscommon.h"
+#include "jsarrow.h"
+#include "jsnumeric.h"
 
+/* Shared by a statement and its results, see free_agk_columns() */
 struct agk_columns {
+	unsigned int refs;
 	uint32_t len;
 	int *indexes;
 	char **names;
 };
 
+/* One parameter set added by addBatch() */
+struct batch_entry {
+	char **values;
+	int *lengths;
+	int *formats;
+};
+
+/**
+ * The result of an execution, with the position of the result sets that
+ * read it. The statement keeps a reference to its last result and each
+ * result set holds another one, so that the statement can be executed
+ * again while the result sets created before are still being read. The
+ * result is freed when the last reference is dropped.
+ */
+struct result {
+	unsigned int refs;
+	PGconn *conn;
+	PGresult *pg;
+	int row_index;
+	struct column_map *labels;
+	/* built from the first result, see get_decoders() */
+	struct column_decoder *decoders;
+	/* the last value read by a getter was NULL */
+	int was_null;
+	/* bytea values decoded by getBuffer() */
+	struct column_scratch decoded;
+
+	/* the rest of the rows are still being streamed */
+	int stream_active;
+	/* the rest of the streamed rows were discarded, see clear_result() */
+	int discarded;
+
+	/* cursor based fetching */
+	int fetch_size;
+	char cursor[POSTGRES_CURSOR_NAME_LEN];
+
+	/* the result is retrieved in parts and cannot be rewound */
+	int forward_only;
+
+	/* the generated key columns requested by the statement, if any */
+	struct agk_columns *columns;
+};
+
 struct statement {
 	char *command;
 	int type;	//this can be removed because we can identify the type
@@ -22,974 +79,4729 @@ struct statement {
 	// parameters
 	uint32_t p_len;
 	char **p_values;
+	/* only used by binary (array) parameters, 0 otherwise */
+	Oid *p_types;
+	int *p_lengths;
+	int *p_formats;
 
 	//connection
 	PGconn *conn;
 
-	// results
-	PGresult *result;
-	int row_index;
-	int column_index;
+	/* the result of the last execution */
+	struct result *result;
+
+	/* the next results are streamed (single-row / chunked mode) */
+	int streaming;
+	/* the next queries are fetched through a cursor, in batches */
+	int fetch_size;
+
+	/* parameter sets added by addBatch() */
+	struct batch_entry *batch;
+	unsigned int batch_len;
+	unsigned int batch_size;
 
 	//generatedkey
 	int autoGeneratedKeys;
 	struct agk_columns *columns;
 };
 
-static void postgres_pstmt_conversion(char *dest, const char *source)
+/* {{{ Placeholder translation */
+
+struct sql_cache_entry {
+	char *sql;
+	char *command;
+	unsigned int p_len;
+};
+
+/**
+ * Translated statements, per connection. The cache is direct-mapped: each
+ * statement text can only live in the slot given by its hash, and a new
+ * statement simply replaces the previous occupant of the slot.
+ */
+struct sql_cache {
+	struct sql_cache_entry entries[POSTGRES_SQL_CACHE_SIZE];
+};
+
+static int is_identifier_char(char c)
 {
-	int i = 1;
+	return isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
 
-	// FIXME what about literal '?' ... should it be converted?
-	while (*source) {
-		if ((*source) == '?') {
-			*dest++ = '$';
-			// FIXME calculate remaining room in dest and pass to sprintf
-			int len = snprintf(dest, 12, "%d", i++);
-			// FIXME check len against remaining room
-			dest += len;
-			source++;
-		} else {
-			*dest++ = *source++;
-		}
+/**
+ * @brief Skip a quoted literal or identifier
+ *
+ * A doubled quote character stands for the quote itself. If @escapes is
+ * set (E'...' strings), backslash escapes the next character as well.
+ * Returns a pointer past the closing quote.
+ */
+static const char *skip_quoted(const char *p, char quote, int escapes)
+{
+	for (p++; *p; p++) {
+		if (escapes && *p == '\\' && p[1])
+			p++;
+		else if (*p == quote && *++p != quote)
+			return p;
 	}
 
-	*dest = '\0';
+	return p;
 }
 
-static void clear_statement(struct statement *stmt)
+/* Block comments nest in PostgreSQL */
+static const char *skip_block_comment(const char *p)
 {
-	if(stmt == NULL)
-		return;
+	int depth = 0;
+
+	while (*p) {
+		if (p[0] == '/' && p[1] == '*') {
+			depth++;
+			p += 2;
+		} else if (p[0] == '*' && p[1] == '/') {
+			p += 2;
+			if (!--depth)
+				return p;
+		} else
+			p++;
+	}
 
-	free(stmt->command);
-	stmt->command = NULL;
+	return p;
+}
 
-	if (stmt->type == PREPARED_STATEMENT) {
-		unsigned int i;
-		for (i = 0; i < stmt->p_len; i++) {
-			free(stmt->p_values[i]);
-			stmt->p_values[i] = NULL;
-		}
-		free(stmt->p_values);
-		stmt->p_values = NULL;
+/**
+ * @brief Skip a dollar-quoted string ($$...$$ or $tag$...$tag$)
+ *
+ * A dollar sign that does not start a dollar quote (part of an identifier
+ * or a positional parameter such as $1) is skipped alone.
+ */
+static const char *skip_dollar_quoted(const char *sql, const char *p)
+{
+	const char *tag_end = p + 1, *close;
+
+	if (p > sql && is_identifier_char(p[-1]))
+		return p + 1;
+
+	if (*tag_end != '$') {
+		if (!isalpha((unsigned char)*tag_end) && *tag_end != '_' && (unsigned char)*tag_end < 0x80)
+			return p + 1;
+		while (is_identifier_char(*tag_end) && *tag_end != '$')
+			tag_end++;
+		if (*tag_end != '$')
+			return p + 1;
 	}
+	tag_end++;
 
-	if (stmt->result) {
-		PQclear(stmt->result);
-		stmt->result = NULL;
-	}
+	for (close = tag_end; (close = strchr(close, '$')) != NULL; close++)
+		if (!strncmp(close, p, tag_end - p))
+			return close + (tag_end - p);
 
-	if (stmt->autoGeneratedKeys == RETURN_GENERATED_KEYS && stmt->columns) {
-		unsigned int i;
+	return p + strlen(p);
+}
 
-		if (stmt->columns->names) {
-			for (i = 0; i < stmt->columns->len; i++) {
-				free(stmt->columns->names[i]);
-				stmt->columns->names[i] = NULL;
+/**
+ * @brief Replace JDBC style placeholders with PostgreSQL ones
+ *
+ * The statement is scanned once, and every '?' that stands for a
+ * parameter is replaced with $1, $2 and so on. Question marks inside
+ * string literals, quoted identifiers, comments and dollar-quoted strings
+ * are left alone. Since ?, ?| and ?& are also jsonb operators, a literal
+ * '?' is written as '??', as in pgjdbc: '??|' and '??&' stand for the
+ * operators, while '?||' is a parameter followed by concatenation.
+ *
+ * Returns the translated statement (to be freed by the caller) or NULL if
+ * memory allocation fails or there are more than MAX_PARAMETERS
+ * parameters. The number of parameters is stored in @p_len.
+ */
+static char *translate_placeholders(const char *sql, unsigned int *p_len)
+{
+	const char *p, *end;
+	size_t marks = 0;
+	char *command, *q;
+	unsigned int n = 0;
+
+	/* Each '?' becomes at most "$65535" */
+	for (p = strchr(sql, '?'); p; p = strchr(p + 1, '?'))
+		marks++;
+
+	command = malloc(strlen(sql) + 5 * marks + 1);
+	if (command == NULL)
+		return NULL;
+
+	for (p = sql, q = command; *p; p = end) {
+		switch (*p) {
+		case '\'':
+			end = skip_quoted(p, '\'', p > sql && (p[-1] == 'E' || p[-1] == 'e') &&
+					(p - 1 == sql || !is_identifier_char(p[-2])));
+			break;
+		case '"':
+			end = skip_quoted(p, '"', 0);
+			break;
+		case '-':
+			end = p[1] == '-' ? p + strcspn(p, "\n") : p + 1;
+			break;
+		case '/':
+			end = p[1] == '*' ? skip_block_comment(p) : p + 1;
+			break;
+		case '$':
+			end = skip_dollar_quoted(sql, p);
+			break;
+		case '?':
+			if (p[1] == '?') {
+				*q++ = '?';
+				end = p + 2;
+				continue;
 			}
-			free(stmt->columns->names);
-			stmt->columns->names = NULL;
-		} else {
-			free(stmt->columns->indexes);
-			stmt->columns->indexes = NULL;
+			if (++n > MAX_PARAMETERS) {
+				free(command);
+				*p_len = n;
+				return NULL;
+			}
+			q += sprintf(q, "$%u", n);
+			end = p + 1;
+			continue;
+		default:
+			end = p + 1;
 		}
 
-		free(stmt->columns);
-		stmt->columns = NULL;
+		memcpy(q, p, end - p);
+		q += end - p;
 	}
 
-	free(stmt);
-	stmt = NULL;
+	*q = '\0';
+	*p_len = n;
+
+	return command;
 }
 
-static int execute_statement(duk_context *ctx, int argc, struct statement *stmt)
+static unsigned int sql_hash(const char *sql)
 {
-	char *error_message;
+	unsigned int hash = 2166136261u;
 
-	if (stmt == NULL)
-		return 0;
+	while (*sql)
+		hash = (hash ^ (unsigned char)*sql++) * 16777619u;
 
-	/* If there is an old result clear the memory */
-	if (stmt->result) {
-		PQclear(stmt->result);
-		stmt->result = NULL;
-	}
+	return hash;
+}
 
-	if (argc == 1 && stmt->type != SIMPLE_STATEMENT) {
-		clear_statement(stmt);
-		return 0;
-	} else if (argc == 0 && stmt->type != PREPARED_STATEMENT) {
-		clear_statement(stmt);
-		return 0;
+/**
+ * @brief Get the translated statement from the connection cache
+ *
+ * Repeated statements skip the translation entirely. The returned string
+ * belongs to the cache and is only valid until the next call.
+ */
+static const char *get_translation(struct sql_cache *cache, const char *sql, unsigned int *p_len)
+{
+	struct sql_cache_entry *entry = &cache->entries[sql_hash(sql) % POSTGRES_SQL_CACHE_SIZE];
+	char *command, *copy;
+
+	if (entry->sql && !strcmp(entry->sql, sql)) {
+		*p_len = entry->p_len;
+		return entry->command;
 	}
 
-	stmt->result = PQexecParams(stmt->conn,
-			stmt->command,
-			stmt->p_len,	/* parameters' length */
-			NULL,		/* let the backend deduce param type */
-			(const char **)stmt->p_values,
-			NULL,		/* don't need param lengths since text */
-			NULL,		/* default to all text params */
-			TEXT_RESULT);	/* ask for text results */
+	command = translate_placeholders(sql, p_len);
+	if (command == NULL)
+		return NULL;
 
-	if (PQresultStatus(stmt->result) != PGRES_COMMAND_OK &&
-			PQresultStatus(stmt->result) != PGRES_TUPLES_OK) {
-		error_message = PQerrorMessage(stmt->conn);
-		clear_statement(stmt);
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", error_message);
+	copy = strdup(sql);
+	if (copy == NULL) {
+		free(command);
+		return NULL;
 	}
 
-	return 1;
+	free(entry->sql);
+	free(entry->command);
+	entry->sql = copy;
+	entry->command = command;
+	entry->p_len = *p_len;
+
+	return command;
 }
 
-static int get_plen(const char *nativeSQL)
+static void free_sql_cache(struct sql_cache *cache)
 {
-	int i, p_len;
+	unsigned int i;
 
-	p_len = 0;
+	if (cache == NULL)
+		return;
 
-	for (i = 0; nativeSQL[i]; i++) {
-		if (nativeSQL[i] == '?')
-			p_len++;
+	for (i = 0; i < POSTGRES_SQL_CACHE_SIZE; i++) {
+		free(cache->entries[i].sql);
+		free(cache->entries[i].command);
 	}
 
-	return p_len;
+	free(cache);
 }
 
+/* }}} Placeholder translation */
 
-static struct statement *generate_statement(duk_context *ctx, const char *nativeSQL, int autoGeneratedKeys)
+/* Drop a reference to the generated key columns, freeing them with the last one */
+static void free_agk_columns(struct agk_columns *columns)
 {
-	struct statement *stmt = malloc(sizeof(struct statement));
+	unsigned int i;
 
-	if (stmt == NULL)
-		return NULL;
+	if (--columns->refs > 0)
+		return;
 
-	memset(stmt, 0, sizeof(struct statement));
+	if (columns->names) {
+		for (i = 0; i < columns->len; i++)
+			free(columns->names[i]);
+		free(columns->names);
+	}
+	free(columns->indexes);
+	free(columns);
+}
 
-	stmt->p_len = get_plen(nativeSQL);
-	stmt->row_index = -1;
-	stmt->column_index = 0;
-	stmt->autoGeneratedKeys = autoGeneratedKeys;
+/**
+ * @brief Discard the rest of an unfinished streaming result
+ *
+ * While a streaming query is active, the connection cannot be used for
+ * any other command. The remaining results are read and discarded, which
+ * leaves the connection (and the current transaction) in a usable state.
+ */
+static void finish_streaming(struct result *rs)
+{
+	PGresult *res;
 
-	/* it supports maximum 99 parameters */
-	if (stmt->p_len > MAX_PARAMETERS) {
-		free(stmt);
-		stmt = NULL;
-		return NULL;
+	if (!rs->stream_active || rs->conn == NULL)
+		return;
+
+	while ((res = PQgetResult(rs->conn)) != NULL)
+		PQclear(res);
+
+	rs->stream_active = 0;
+}
+
+static int is_streaming_chunk(PGresult *result)
+{
+	switch (PQresultStatus(result)) {
+	case PGRES_SINGLE_TUPLE:
+#ifdef HAVE_PQSETCHUNKEDROWSMODE
+	case PGRES_TUPLES_CHUNK:
+#endif
+		return 1;
+	default:
+		return 0;
 	}
-	if (autoGeneratedKeys == RETURN_GENERATED_KEYS)
-		stmt->command = malloc((strlen(nativeSQL) + stmt->p_len + stmt->p_len / 10 + 1 +
-					POSTGRES_AUTOGENERATED_STRING_LENGTH) * sizeof(char));
-	else
-		stmt->command = malloc((strlen(nativeSQL) + stmt->p_len + stmt->p_len / 10 + 1) *
-				sizeof(char));
-	if (stmt->command == NULL) {
-		free(stmt);
-		stmt = NULL;
+}
+
+/**
+ * @brief Send the statement to the server without waiting for the result
+ *
+ * Rows are retrieved one at a time (or one chunk at a time, if libpq
+ * supports chunked mode), so client memory usage does not depend on the
+ * size of the result. The first result is fetched right away to catch
+ * errors early; the rest are pulled by fetch_next_rows() on demand.
+ */
+static PGresult *send_statement(struct statement *stmt, struct result *rs)
+{
+	if (!PQsendQueryParams(stmt->conn,
+			stmt->command,
+			stmt->p_len,
+			stmt->p_types,
+			(const char **)stmt->p_values,
+			stmt->p_lengths,
+			stmt->p_formats,
+			TEXT_RESULT))
 		return NULL;
-	}
 
-	if (stmt->p_len > 0) {
-		stmt->type = PREPARED_STATEMENT;
-		stmt->p_values = calloc(stmt->p_len, sizeof(char *));
-		if (stmt->p_values == NULL) {
-			free(stmt->command);
-			stmt->command = NULL;
-			free(stmt);
-			stmt = NULL;
-			return NULL;
-		}
-		postgres_pstmt_conversion(stmt->command, nativeSQL);
-		if (autoGeneratedKeys == RETURN_GENERATED_KEYS)
-			strncat(stmt->command, POSTGRES_AUTOGENERATED_STRING, POSTGRES_CONNECTOR_LEN);
-	} else {
-		stmt->type = SIMPLE_STATEMENT;
-		strcpy(stmt->command, nativeSQL);
-		if (autoGeneratedKeys == RETURN_GENERATED_KEYS)
-			strncat(stmt->command, POSTGRES_AUTOGENERATED_STRING, POSTGRES_CONNECTOR_LEN);
+#ifdef HAVE_PQSETCHUNKEDROWSMODE
+	PQsetChunkedRowsMode(stmt->conn, POSTGRES_STREAMING_CHUNK_ROWS);
+#else
+	PQsetSingleRowMode(stmt->conn);
+#endif
+	rs->stream_active = 1;
 
-		stmt->p_values = NULL;
-	}
+	rs->pg = PQgetResult(stmt->conn);
+	if (!is_streaming_chunk(rs->pg))
+		finish_streaming(rs);
 
-	return stmt;
+	return rs->pg;
 }
 
 /**
- * @brief Extract the array of auto generated keys from JS function parameter
+ * @brief Replace the current streaming chunk with the next one
  *
- * This is a helper function that examines the 2nd JS function parameter and
- * builds an array of either indices or column names that correspond to the
- * auto generated keys to be retrieved. The function is used to implement the
- * overloaded versions of the following functions:
- *   Connection.prepareStatement()
- *   Statement.execute()
- *   Statement.executeUpdate()
+ * The final (empty) PGRES_TUPLES_OK result is kept as the current result
+ * so that column information remains available after the last row.
  */
-static int get_columns_values(duk_context *ctx, struct agk_columns **columns)
+static void fetch_next_rows(duk_context *ctx, struct result *rs)
 {
-	duk_size_t i, len;
+	PGresult *res = PQgetResult(rs->conn);
 
-	if (duk_is_null(ctx, 1))
-		return 0;
+	if (res == NULL) {
+		rs->stream_active = 0;
+		return;
+	}
 
-	*columns = malloc (1 * sizeof(struct agk_columns));
-	if (*columns == NULL)
-		return 0;
+	if (is_streaming_chunk(res) || PQresultStatus(res) == PGRES_TUPLES_OK) {
+		PQclear(rs->pg);
+		rs->pg = res;
+		rs->row_index = 0;
+		if (!is_streaming_chunk(res))
+			finish_streaming(rs);
+		return;
+	}
 
-	len = duk_get_length(ctx, 1);
-	if (len == 0)
-		return 0;
+	duk_push_string(ctx, PQresultErrorMessage(res));
+	PQclear(res);
+	finish_streaming(rs);
+	duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
+}
 
-	(*columns)->len = len;
+static PGresult *fetch_cursor(struct result *rs)
+{
+	char *query;
+	PGresult *res;
 
-	duk_get_prop_index(ctx, 1, 0);
+	if (asprintf(&query, "FETCH FORWARD %d FROM %s", rs->fetch_size, rs->cursor) == -1)
+		return NULL;
 
-	if (duk_is_number(ctx, -1)) {
-		duk_pop(ctx);
-		(*columns)->indexes = malloc(len * sizeof(int));
-		if ((*columns)->indexes == NULL)
-			return 0;
-		(*columns)->names = NULL;
+	res = PQexec(rs->conn, query);
+	free(query);
 
-		for (i = 0; i < len; i++) {
-			duk_get_prop_index(ctx, 1, i);
-			if (duk_is_undefined(ctx, -1)) {
-				free((*columns)->indexes);
-				(*columns)->indexes = NULL;
-				return 0;
-			}
+	return res;
+}
 
-			if (!duk_is_number(ctx, -1)) {
-				free((*columns)->indexes);
-				(*columns)->indexes = NULL;
-				return 0;
-			}
+/**
+ * @brief Close the server side cursor of the result, if any
+ *
+ * Cursors are dropped by the server at the end of the transaction, so an
+ * explicit CLOSE is only sent while the transaction is still in progress.
+ */
+static void close_cursor(struct result *rs)
+{
+	char *query;
 
-			(*columns)->indexes[i] = duk_get_number(ctx, -1);
-			duk_pop(ctx);
-		}
-	} else if (duk_is_string(ctx, -1)) {
-		duk_pop(ctx);
-		(*columns)->names = malloc(len * sizeof(char *));
-		if ((*columns)->names == NULL) {
-			return 0;
-		}
-		(*columns)->indexes = NULL;
+	if (!rs->cursor[0])
+		return;
 
-		for (i = 0; i < len; i++) {
-			duk_get_prop_index(ctx, 1, i);
-			if (duk_is_undefined(ctx, -1)) {
-				free((*columns)->names);
-				(*columns)->names = NULL;
-				return 0;
-			}
+	if (rs->conn && PQtransactionStatus(rs->conn) == PQTRANS_INTRANS &&
+			asprintf(&query, "CLOSE %s", rs->cursor) != -1) {
+		PQclear(PQexec(rs->conn, query));
+		free(query);
+	}
 
-			if (!duk_is_string(ctx, -1)) {
-				duk_size_t j;
-				for (j = 0; j < i; j++) {
-					free((*columns)->names[j]);
-					(*columns)->names[j] = NULL;
-				}
-				free((*columns)->names);
-				(*columns)->names = NULL;
-				return 0;
-			}
+	rs->cursor[0] = '\0';
+}
 
-			const char *value = duk_get_string(ctx, -1);
-			(*columns)->names[i] = malloc (strlen(value) * sizeof(char));
-			if ((*columns)->names[i] == NULL) {
-				duk_size_t j;
-				for (j = 0; j < i; j++) {
-					free((*columns)->names[j]);
-					(*columns)->names[j] = NULL;
-				}
-				free((*columns)->names);
-				(*columns)->names = NULL;
-				return 0;
-			}
-			strcpy((*columns)->names[i], value);
-			duk_pop(ctx);
-		}
-	} else
-		return 0;
+/**
+ * @brief Check whether a statement can be run through a cursor
+ *
+ * DECLARE ... CURSOR only accepts SELECT and VALUES queries (TABLE and
+ * WITH being forms of SELECT). Anything else, such as SHOW, EXPLAIN or
+ * INSERT ... RETURNING, would make the DECLARE fail and abort the
+ * transaction, so those statements are run directly.
+ */
+static int is_cursor_query(const char *sql)
+{
+	static const char *const keywords[] = {"select", "values", "table", "with"};
+	const char *p = sql;
+	size_t i, len;
+
+	for (;;) {
+		if (isspace((unsigned char)*p) || *p == '(')
+			p++;
+		else if (p[0] == '-' && p[1] == '-')
+			p += strcspn(p, "\n");
+		else if (p[0] == '/' && p[1] == '*')
+			p = skip_block_comment(p);
+		else
+			break;
+	}
 
-	return 1;
+	for (i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+		len = strlen(keywords[i]);
+		if (!strncasecmp(p, keywords[i], len) && !is_identifier_char(p[len]))
+			return 1;
+	}
+
+	return 0;
 }
 
 /**
- * @brief Retrieve one value from a result set
- *
- * This is the implementation of the following JS functions:
- *   ResultSet.getNumber()
- *   ResultSet.getString()
+ * @brief Run a query through a server side cursor
  *
- * The actual native C functions that correspond to the JS functions are just
- * thin wrappers around this function.
+ * The query is wrapped in DECLARE ... CURSOR and only the first fetch_size
+ * rows are retrieved. Unlike streaming mode, the connection remains free
+ * to run other statements between batches. Cursors only live as long as
+ * the current transaction, so this is used only inside a transaction.
  */
-static char *get_value_from_index(duk_context *ctx)
+static PGresult *open_cursor(struct statement *stmt, struct result *rs)
 {
-	struct statement *stmt;
-	int column_index;
-	const char *column_name;
-	char *value;
-	int argc = duk_get_top(ctx);
+	static unsigned int cursor_count;
+	char *query;
+	PGresult *res;
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
+	snprintf(rs->cursor, sizeof(rs->cursor), "jssql_cursor_%u", ++cursor_count);
 
+	if (asprintf(&query, "DECLARE %s NO SCROLL CURSOR FOR %s", rs->cursor, stmt->command) == -1) {
+		rs->cursor[0] = '\0';
+		return NULL;
+	}
+
+	res = PQexecParams(stmt->conn,
+			query,
+			stmt->p_len,
+			stmt->p_types,
+			(const char **)stmt->p_values,
+			stmt->p_lengths,
+			stmt->p_formats,
+			TEXT_RESULT);
+	free(query);
+
+	if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+		rs->cursor[0] = '\0';
+		return res;
+	}
+
+	PQclear(res);
+	return fetch_cursor(rs);
+}
+
+/**
+ * @brief Replace the current cursor batch with the next one
+ */
+static void fetch_next_batch(duk_context *ctx, struct result *rs)
+{
+	PGresult *res;
+
+	/* A short batch means the cursor is exhausted */
+	if (PQntuples(rs->pg) < rs->fetch_size) {
+		close_cursor(rs);
+		return;
+	}
+
+	res = fetch_cursor(rs);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+		duk_push_string(ctx, PQerrorMessage(rs->conn));
+		PQclear(res);
+		rs->cursor[0] = '\0';
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
+	}
+
+	PQclear(rs->pg);
+	rs->pg = res;
+	rs->row_index = 0;
+
+	if (PQntuples(res) == 0)
+		close_cursor(rs);
+}
+
+/**
+ * @brief Create the result of an execution of the statement
+ *
+ * The result starts with the reference held by the statement.
+ */
+static struct result *create_result(struct statement *stmt)
+{
+	struct result *rs = calloc(1, sizeof(struct result));
+
+	if (rs == NULL)
+		return NULL;
+
+	rs->refs = 1;
+	rs->conn = stmt->conn;
+	rs->row_index = -1;
+	rs->fetch_size = stmt->fetch_size;
+
+	if (stmt->autoGeneratedKeys == RETURN_GENERATED_KEYS && stmt->columns) {
+		rs->columns = stmt->columns;
+		rs->columns->refs++;
+	}
+
+	return rs;
+}
+
+/* Take another reference to the result, for a result set */
+static struct result *hold_result(struct result *rs)
+{
+	rs->refs++;
+	return rs;
+}
+
+/**
+ * @brief Drop a reference to the result
+ *
+ * The last reference reads the rest of a streamed result, closes the
+ * cursor, if any, and frees the result.
+ */
+static void release_result(struct result *rs)
+{
+	if (rs == NULL || --rs->refs > 0)
+		return;
+
+	finish_streaming(rs);
+	close_cursor(rs);
+	column_map_free(rs->labels);
+	free(rs->decoders);
+	column_scratch_free(&rs->decoded);
+	PQclear(rs->pg);
+	if (rs->columns)
+		free_agk_columns(rs->columns);
+	free(rs);
+}
+
+/**
+ * @brief Release the last result of the statement
+ *
+ * The rest of a streamed result is discarded first, since the connection
+ * is needed for the next command even if result sets still hold it. The
+ * result is marked, so that these result sets fail instead of ending
+ * early.
+ */
+static void clear_result(struct statement *stmt)
+{
+	if (stmt->result == NULL)
+		return;
+
+	if (stmt->result->stream_active && stmt->result->refs > 1)
+		stmt->result->discarded = 1;
+	finish_streaming(stmt->result);
+	release_result(stmt->result);
+	stmt->result = NULL;
+}
+
+static void clear_batch(struct statement *stmt)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < stmt->batch_len; i++) {
+		for (j = 0; j < stmt->p_len; j++)
+			free(stmt->batch[i].values[j]);
+		free(stmt->batch[i].values);
+		free(stmt->batch[i].lengths);
+	}
+
+	free(stmt->batch);
+	stmt->batch = NULL;
+	stmt->batch_len = 0;
+	stmt->batch_size = 0;
+}
+
+static void clear_statement(struct statement *stmt)
+{
+	if(stmt == NULL)
+		return;
+
+	release_result(stmt->result);
+	stmt->result = NULL;
+	clear_batch(stmt);
+
+	free(stmt->command);
+	stmt->command = NULL;
+
+	if (stmt->type == PREPARED_STATEMENT) {
+		unsigned int i;
+		for (i = 0; i < stmt->p_len; i++) {
+			free(stmt->p_values[i]);
+			stmt->p_values[i] = NULL;
+		}
+		free(stmt->p_values);
+		stmt->p_values = NULL;
+		free(stmt->p_types);
+		stmt->p_types = NULL;
+		free(stmt->p_lengths);
+		stmt->p_lengths = NULL;
+		free(stmt->p_formats);
+		stmt->p_formats = NULL;
+	}
+
+	if (stmt->autoGeneratedKeys == RETURN_GENERATED_KEYS && stmt->columns) {
+		free_agk_columns(stmt->columns);
+		stmt->columns = NULL;
+	}
+
+	free(stmt);
+	stmt = NULL;
+}
+
+/**
+ * @brief Execute a statement and store its result
+ *
+ * If @query is set, the statement is expected to return rows and, when
+ * a fetch size is set, queries that a cursor accepts (see
+ * is_cursor_query()) are executed through one (see open_cursor()).
+ *
+ * The previous result is released; result sets created from it keep
+ * their own reference and can still be read, except for the rest of a
+ * streamed result, which has to be discarded to free the connection.
+ */
+static int execute_statement(duk_context *ctx, int argc, struct statement *stmt, int query)
+{
+	struct result *rs;
+
+	if (stmt == NULL)
+		return 0;
+
+	clear_result(stmt);
+
+	if (argc == 1 && stmt->type != SIMPLE_STATEMENT)
+		return 0;
+	else if (argc == 0 && stmt->type != PREPARED_STATEMENT)
+		return 0;
+
+	rs = create_result(stmt);
+	if (rs == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
+
+	/* Generated keys are read after the update count, so the result must
+	 * be complete; streaming only makes sense for plain queries. */
+	rs->forward_only = 1;
+	if (query && stmt->fetch_size > 0 && stmt->autoGeneratedKeys != RETURN_GENERATED_KEYS &&
+			PQtransactionStatus(stmt->conn) == PQTRANS_INTRANS && is_cursor_query(stmt->command))
+		rs->pg = open_cursor(stmt, rs);
+	else if (stmt->streaming && stmt->autoGeneratedKeys != RETURN_GENERATED_KEYS)
+		send_statement(stmt, rs);
+	else {
+		rs->forward_only = 0;
+
+		rs->pg = PQexecParams(stmt->conn,
+				stmt->command,
+				stmt->p_len,	/* parameters' length */
+				stmt->p_types,	/* 0 lets the backend deduce the type */
+				(const char **)stmt->p_values,
+				stmt->p_lengths,	/* only used by binary params */
+				stmt->p_formats,	/* text unless set by setArray() */
+				TEXT_RESULT);	/* ask for text results */
+	}
+
+	if (PQresultStatus(rs->pg) != PGRES_COMMAND_OK &&
+			PQresultStatus(rs->pg) != PGRES_TUPLES_OK &&
+			!is_streaming_chunk(rs->pg)) {
+		release_result(rs);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", PQerrorMessage(stmt->conn));
+	}
+
+	stmt->result = rs;
+	return 1;
+}
+
+static struct statement *generate_statement(duk_context *ctx, struct sql_cache *cache,
+		const char *nativeSQL, int autoGeneratedKeys)
+{
+	struct statement *stmt;
+	const char *command;
+	unsigned int p_len = 0;
+	size_t len;
+
+	command = get_translation(cache, nativeSQL, &p_len);
+	if (command == NULL) {
+		if (p_len > MAX_PARAMETERS)
+			duk_error(ctx, DUK_ERR_RANGE_ERROR, "Too many parameters (maximum %d)\n", MAX_PARAMETERS);
+		return NULL;
+	}
+
+	stmt = malloc(sizeof(struct statement));
+	if (stmt == NULL)
+		return NULL;
+
+	memset(stmt, 0, sizeof(struct statement));
+
+	stmt->p_len = p_len;
+	stmt->autoGeneratedKeys = autoGeneratedKeys;
+
+	len = strlen(command);
+	stmt->command = malloc(len + POSTGRES_AUTOGENERATED_STRING_LENGTH + 1);
+	if (stmt->command == NULL) {
+		free(stmt);
+		stmt = NULL;
+		return NULL;
+	}
+
+	memcpy(stmt->command, command, len + 1);
+	if (autoGeneratedKeys == RETURN_GENERATED_KEYS)
+		strcat(stmt->command, POSTGRES_AUTOGENERATED_STRING);
+
+	if (stmt->p_len > 0) {
+		stmt->type = PREPARED_STATEMENT;
+		stmt->p_values = calloc(stmt->p_len, sizeof(char *));
+		stmt->p_types = calloc(stmt->p_len, sizeof(Oid));
+		stmt->p_lengths = calloc(stmt->p_len, sizeof(int));
+		stmt->p_formats = calloc(stmt->p_len, sizeof(int));
+		if (stmt->p_values == NULL || stmt->p_types == NULL ||
+				stmt->p_lengths == NULL || stmt->p_formats == NULL) {
+			free(stmt->p_values);
+			free(stmt->p_types);
+			free(stmt->p_lengths);
+			free(stmt->p_formats);
+			free(stmt->command);
+			stmt->command = NULL;
+			free(stmt);
+			stmt = NULL;
+			return NULL;
+		}
+	} else {
+		stmt->type = SIMPLE_STATEMENT;
+		stmt->p_values = NULL;
+	}
+
+	return stmt;
+}
+
+/**
+ * @brief Extract the array of auto generated keys from JS function parameter
+ *
+ * This is a helper function that examines the 2nd JS function parameter and
+ * builds an array of either indices or column names that correspond to the
+ * auto generated keys to be retrieved. The function is used to implement the
+ * overloaded versions of the following functions:
+ *   Connection.prepareStatement()
+ *   Statement.execute()
+ *   Statement.executeUpdate()
+ */
+static int get_columns_values(duk_context *ctx, struct agk_columns **columns)
+{
+	duk_size_t i, len;
+
+	if (duk_is_null(ctx, 1))
+		return 0;
+
+	*columns = malloc (1 * sizeof(struct agk_columns));
+	if (*columns == NULL)
+		return 0;
+
+	len = duk_get_length(ctx, 1);
+	if (len == 0) {
+		free(*columns);
+		*columns = NULL;
+		return 0;
+	}
+
+	(*columns)->refs = 1;
+	(*columns)->len = len;
+
+	duk_get_prop_index(ctx, 1, 0);
+
+	if (duk_is_number(ctx, -1)) {
+		duk_pop(ctx);
+		(*columns)->indexes = malloc(len * sizeof(int));
+		if ((*columns)->indexes == NULL)
+			return 0;
+		(*columns)->names = NULL;
+
+		for (i = 0; i < len; i++) {
+			duk_get_prop_index(ctx, 1, i);
+			if (duk_is_undefined(ctx, -1)) {
+				free((*columns)->indexes);
+				(*columns)->indexes = NULL;
+				return 0;
+			}
+
+			if (!duk_is_number(ctx, -1)) {
+				free((*columns)->indexes);
+				(*columns)->indexes = NULL;
+				return 0;
+			}
+
+			(*columns)->indexes[i] = duk_get_number(ctx, -1);
+			duk_pop(ctx);
+		}
+	} else if (duk_is_string(ctx, -1)) {
+		duk_pop(ctx);
+		(*columns)->names = malloc(len * sizeof(char *));
+		if ((*columns)->names == NULL) {
+			return 0;
+		}
+		(*columns)->indexes = NULL;
+
+		for (i = 0; i < len; i++) {
+			duk_get_prop_index(ctx, 1, i);
+			if (duk_is_undefined(ctx, -1)) {
+				free((*columns)->names);
+				(*columns)->names = NULL;
+				return 0;
+			}
+
+			if (!duk_is_string(ctx, -1)) {
+				duk_size_t j;
+				for (j = 0; j < i; j++) {
+					free((*columns)->names[j]);
+					(*columns)->names[j] = NULL;
+				}
+				free((*columns)->names);
+				(*columns)->names = NULL;
+				return 0;
+			}
+
+			const char *value = duk_get_string(ctx, -1);
+			(*columns)->names[i] = malloc (strlen(value) + 1);
+			if ((*columns)->names[i] == NULL) {
+				duk_size_t j;
+				for (j = 0; j < i; j++) {
+					free((*columns)->names[j]);
+					(*columns)->names[j] = NULL;
+				}
+				free((*columns)->names);
+				(*columns)->names = NULL;
+				return 0;
+			}
+			strcpy((*columns)->names[i], value);
+			duk_pop(ctx);
+		}
+	} else
+		return 0;
+
+	return 1;
+}
+
+/**
+ * @brief Find a column by its label, the same way PQfnumber() does
+ *
+ * Labels are treated like SQL identifiers: they are folded to lower case
+ * unless they are double-quoted. Instead of scanning all the columns on
+ * each call, a hash map of the labels is built on first use and then
+ * reused for all the rows of the result (including streaming chunks and
+ * cursor batches, which share the same columns).
+ *
+ * Returns the 0-based column index or -1 if there is no such column.
+ */
+static int find_column(struct result *rs, const char *name)
+{
+	const char **names;
+	const char *p;
+	char *copy, *q;
+	int i, n, index;
+
+	if (rs->labels == NULL) {
+		n = PQnfields(rs->pg);
+		names = malloc((n + 1) * sizeof(char *));
+		if (names == NULL)
+			return PQfnumber(rs->pg, name);
+		for (i = 0; i < n; i++)
+			names[i] = PQfname(rs->pg, i);
+		rs->labels = column_map_create(names, n);
+		free(names);
+		if (rs->labels == NULL)
+			return PQfnumber(rs->pg, name);
+	}
+
+	/* Fast path: nothing to unquote or fold */
+	for (p = name; *p && *p != '"' && !isupper((unsigned char)*p); p++)
+		;
+	if (*p == '\0')
+		return column_map_lookup(rs->labels, name, 0);
+
+	copy = malloc(strlen(name) + 1);
+	if (copy == NULL)
+		return PQfnumber(rs->pg, name);
+
+	q = copy;
+	if (*name == '"') {
+		for (p = name + 1; *p; p++) {
+			if (*p == '"' && *++p != '"')
+				break;
+			*q++ = *p;
+		}
+	} else {
+		for (p = name; *p; p++)
+			*q++ = tolower((unsigned char)*p);
+	}
+	*q = '\0';
+
+	index = column_map_lookup(rs->labels, copy, 0);
+	free(copy);
+
+	return index;
+}
+
+/**
+ * @brief Resolve the column argument of the ResultSet getters
+ *
+ * The column is given by its position (1-based) or label. Errors are
+ * thrown if there is no such column or no current row. Returns the
+ * 0-based column index and the result in @prs.
+ */
+static int get_column_index(duk_context *ctx, struct result **prs)
+{
+	struct result *rs;
+	int column_index;
+	const char *column_name;
+	int argc = duk_get_top(ctx);
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "result");
+	rs = duk_get_pointer(ctx, -1);
+
+	if (rs == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The result property is not set");
+
+	if (argc != 1)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Wrong number of arguments");
+
+	if (duk_is_number(ctx, 0)) {
+		column_index = duk_get_int(ctx, 0);
+
+		if (rs->columns != NULL) {
+			if (column_index < 1 || column_index > rs->columns->len)
+				duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Column index out of bounds");
+
+			if (rs->columns->indexes) {
+					column_index = rs->columns->indexes[column_index - 1];
+			} else {
+				column_index = find_column(rs, rs->columns->names[column_index - 1]);
+				if (column_index == -1)
+					duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The given name does not match any column.");
+				/* Increment it because the column index is expected to start from 1 */
+				column_index++;
+			}
+		}
+
+		if (column_index < 1 || column_index > PQnfields(rs->pg)) {
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Column index out of bounds");
+		}
+		column_index--;
+	} else if (duk_is_string(ctx, 0)) {
+		column_name = duk_get_string(ctx, 0);
+
+		column_index = find_column(rs, column_name);
+		if (column_index == -1)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The given name does not match any column.");
+	} else {
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "[Wrong argument type]The first parameter should be a number \
+				which represents the position of the parameter or a string (column label)");
+	}
+
+	if (rs->row_index < 0 || rs->row_index >= PQntuples(rs->pg))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Row index out of bounds");
+
+	rs->was_null = PQgetisnull(rs->pg, rs->row_index, column_index);
+	*prs = rs;
+	return column_index;
+}
+
+static void set_parameter(duk_context *ctx)
+{
+	int pos;
+	const char *value;
+	struct statement *stmt;
+	int argc = duk_get_top(ctx);
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+
+	if (stmt == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The statement property is not set");;
+
+	if (argc < 1)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Wrong number of arguments");
+
+	if (!duk_is_number(ctx, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The first parameter should be a \
+			number which represents the position of the parameter");
+
+	pos = duk_get_int(ctx, 0);
+
+	if (pos > stmt->p_len || pos < 1)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The position is incorrect!");
+
+	pos--;
+
+	if (stmt->p_values[pos] != NULL) {
+		/* The element was already set */
+		free(stmt->p_values[pos]);
+		stmt->p_values[pos] = NULL;
+	}
+	stmt->p_types[pos] = 0;
+	stmt->p_lengths[pos] = 0;
+	stmt->p_formats[pos] = TEXT_PARAMETER;
+
+	/* If the parameter is NULL, let the value to remain NULL */
+	if (argc < 2 || duk_is_null(ctx, 1)) {
+		stmt->p_values[pos] = NULL;
+	} else {
+		value = duk_to_string(ctx, 1);
+		stmt->p_values[pos] = malloc (strlen(value) + 1);
+		if (stmt->p_values[pos] == NULL)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
+		strcpy(stmt->p_values[pos], value);
+	}
+}
+
+/**
+ * @brief Get the name of a generated key column, quoted for RETURNING
+ *
+ * Names follow the same rules as column labels: they are folded to lower
+ * case unless they are double-quoted, in which case they are unquoted and
+ * quoted again, so that nothing but an identifier reaches the SQL. Returns
+ * NULL for a malformed quoted name. Indexes refer to the
+ * columns of "RETURNING *", whose names are taken from the description of
+ * the statement, since a table has no column order that SQL could use.
+ */
+static char *quote_agk_column(PGconn *conn, struct agk_columns *columns, PGresult *desc, unsigned int i)
+{
+	const char *name;
+	char *folded, *quoted, *p;
+
+	if (columns->names) {
+		name = columns->names[i];
+		folded = malloc(strlen(name) + 1);
+		if (folded == NULL)
+			return NULL;
+
+		if (name[0] == '"') {
+			/* Unquote, and give up on anything but a single
+			 * quoted identifier */
+			for (p = folded, name++; *name; name++) {
+				if (*name == '"' && *++name != '"')
+					break;
+				*p++ = *name;
+			}
+			*p = '\0';
+			if (name[-1] != '"' || *name != '\0' || folded[0] == '\0') {
+				free(folded);
+				return NULL;
+			}
+		} else {
+			for (p = folded; *name; name++)
+				*p++ = tolower((unsigned char)*name);
+			*p = '\0';
+		}
+
+		p = PQescapeIdentifier(conn, folded, strlen(folded));
+		free(folded);
+	} else {
+		if (columns->indexes[i] < 1 || columns->indexes[i] > PQnfields(desc))
+			return NULL;
+		name = PQfname(desc, columns->indexes[i] - 1);
+		p = PQescapeIdentifier(conn, name, strlen(name));
+	}
+
+	if (p == NULL)
+		return NULL;
+
+	/* PQescapeIdentifier() results must be released with PQfreemem() */
+	quoted = strdup(p);
+	PQfreemem(p);
+
+	return quoted;
+}
+
+/**
+ * @brief Return only the requested generated key columns
+ *
+ * Replace "RETURNING *" with the list of columns given by name or index,
+ * so that inserts into wide tables do not send back every column. Once
+ * the list is in place, the result has exactly the requested columns in
+ * the requested order and the column mapping is no longer needed.
+ *
+ * If the columns cannot be resolved (e.g. the parameter types cannot be
+ * inferred to describe the statement), "RETURNING *" is kept and the
+ * columns are mapped when the values are read.
+ *
+ * Indexes are resolved by describing the statement, which may fail; a
+ * failed command would abort the transaction of the user, so this is only
+ * done when no transaction is in progress.
+ */
+static void set_returning_columns(struct statement *stmt)
+{
+	struct agk_columns *columns = stmt->columns;
+	PGresult *res, *desc = NULL;
+	char **quoted, *command, *p;
+	size_t len;
+	unsigned int i, n = columns->len;
+
+	if (columns->indexes) {
+		if (PQtransactionStatus(stmt->conn) != PQTRANS_IDLE)
+			return;
+
+		res = PQprepare(stmt->conn, "", stmt->command, 0, NULL);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			PQclear(res);
+			return;
+		}
+		PQclear(res);
+
+		desc = PQdescribePrepared(stmt->conn, "");
+		if (PQresultStatus(desc) != PGRES_COMMAND_OK) {
+			PQclear(desc);
+			return;
+		}
+	}
+
+	quoted = calloc(n, sizeof(char *));
+	if (quoted == NULL)
+		goto out;
+
+	/* The command already ends with "RETURNING *" */
+	len = strlen(stmt->command) - 1;
+	for (i = 0; i < n; i++) {
+		quoted[i] = quote_agk_column(stmt->conn, columns, desc, i);
+		if (quoted[i] == NULL)
+			goto out;
+		len += strlen(quoted[i]) + 2;
+	}
+
+	command = malloc(len + 1);
+	if (command == NULL)
+		goto out;
+
+	len = strlen(stmt->command) - 1;
+	memcpy(command, stmt->command, len);
+	for (i = 0, p = command + len; i < n; i++)
+		p += sprintf(p, "%s%s", i ? ", " : "", quoted[i]);
+
+	free(stmt->command);
+	stmt->command = command;
+	free_agk_columns(columns);
+	stmt->columns = NULL;
+
+out:
+	if (quoted) {
+		for (i = 0; i < n; i++)
+			free(quoted[i]);
+		free(quoted);
+	}
+	PQclear(desc);
+}
+
+static int set_statement(duk_context *ctx, const char *query, int argc)
+{
+	const char *nativeSQL;
+	int autoGeneratedKeys = NO_GENERATED_KEYS;
+	struct agk_columns *columns = NULL;
+
+	/* Call nativeSQL method on the connection object in the PreparedStatement given */
+	duk_get_prop_string(ctx, -1, "connection");
+	if (duk_is_undefined(ctx, -1)) {
+		duk_pop(ctx);
+		return 0;
+	}
+
+	duk_push_string(ctx, "nativeSQL");
+	duk_push_string(ctx, query);
+	duk_pcall_prop(ctx, -3, 1);
+	nativeSQL = duk_get_string(ctx, -1);
+	duk_pop(ctx);
+
+	duk_get_prop_string(ctx, -1, "connection");
+	PGconn *conn = (PGconn *)duk_get_pointer(ctx, -1);
+	duk_pop(ctx);
+	if (conn == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "PGconn property is not set\n");
+
+	duk_get_prop_string(ctx, -1, "sqlCache");
+	struct sql_cache *cache = duk_get_pointer(ctx, -1);
+	duk_pop(ctx);
+
+	if (argc == 2) {
+		if (duk_get_number(ctx, 1) == 1  || duk_get_boolean(ctx, 1) == 1)
+			autoGeneratedKeys = RETURN_GENERATED_KEYS;
+		else if (duk_is_array(ctx, 1)) {
+			if (get_columns_values(ctx, &columns) == 0)
+				duk_error(ctx, DUK_ERR_TYPE_ERROR, "Failed to extract column names/indexes\n");
+			else
+				autoGeneratedKeys = RETURN_GENERATED_KEYS;
+		}
+	}
+
+	struct statement *stmt = generate_statement(ctx, cache, nativeSQL, autoGeneratedKeys);
+	if (stmt == NULL)
+		return 0;
+
+	stmt->columns = columns;
+	stmt->conn = conn;
+
+	if (columns && PQstatus(conn) == CONNECTION_OK)
+		set_returning_columns(stmt);
+
+	/* The statement object is just below the connection object */
+	duk_get_prop_string(ctx, -2, "streaming");
+	stmt->streaming = duk_get_boolean(ctx, -1);
+	duk_pop(ctx);
+
+	duk_get_prop_string(ctx, -2, "fetchSize");
+	stmt->fetch_size = duk_get_int(ctx, -1);
+	duk_pop(ctx);
+	if (PQstatus(stmt->conn) != CONNECTION_OK) {
+		clear_statement(stmt);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "Wrong connection status %s\n", PQerrorMessage(stmt->conn));
+	}
+
+	/* Remove the connection object */
+	duk_pop(ctx);
+
+	/* Add property to the given Statement object */
+	duk_push_pointer(ctx, (void *) stmt);
+	duk_put_prop_string(ctx, -2, "stmt");
+
+	return 1;
+}
+
+#if 0
+
+#if 0
+/**
+ * pretty_printer - internal function used for debugging
+ * @stmt: pointer to the structure
+ */
+static void pretty_printer(struct statement *stmt)
+{
+	unsigned int i;
+
+	JS_Log(JS_LOG_INFO, "Statement type: %s | Parameters number %d\n",
+			(stmt->type == SIMPLE_STATEMENT)? "SIMPLE_STATEMENT":"PREPARED_STATEMENT",
+			stmt->p_len);
+	JS_Log(JS_LOG_INFO, "Statement :\"%s\"\n", stmt->command);
+
+	for (i = 0; i < stmt->p_len; i++) {
+		JS_Log(JS_LOG_INFO, "%d argument: %s\n", i + 1,
+				(stmt->p_values[i] == NULL)? "NULL":stmt->p_values[i]);
+	}
+
+	if (stmt->autoGeneratedKeys == RETURN_GENERATED_KEYS && stmt->columns) {
+		if (stmt->columns->indexes) {
+			for (i = 0; i < stmt->columns->len; i++) {
+				JS_Log(JS_LOG_INFO, "Column index[%d] = %d\n", i, stmt->columns->indexes[i]);
+			}
+		} else {
+			for (i = 0; i < stmt->columns->len; i++) {
+				JS_Log(JS_LOG_INFO, "Column name[%d] = %s\n", i, stmt->columns->names[i]);
+			}
+		}
+	}
+}
+
+/**
+ * result_pretty_printer - internal function used for debugging
+ * @stmt: pointer to the structure
+ */
+static void result_pretty_printer(struct statement *stmt)
+{
+	PQprint(stdout, stmt->result->pg, NULL);
+}
+#endif
+
+#endif
+
+/**
+ * @brief Move to the next row, fetching more rows if needed
+ *
+ * Returns 1 if there is a current row, 0 at the end of the result. Throws
+ * past the current chunk of a streamed result that was discarded.
+ */
+static int next_row(duk_context *ctx, struct result *rs)
+{
+	if (rs->pg == NULL)
+		return 0;
+
+	rs->row_index += 1;
+
+	if (rs->discarded && rs->row_index >= PQntuples(rs->pg))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n",
+				"The result was discarded because the statement was re-executed");
+
+	if (rs->stream_active && rs->row_index >= PQntuples(rs->pg))
+		fetch_next_rows(ctx, rs);
+	else if (rs->cursor[0] && rs->row_index >= PQntuples(rs->pg))
+		fetch_next_batch(ctx, rs);
+
+	return rs->row_index >= 0 && rs->row_index < PQntuples(rs->pg);
+}
+
+/* {{{ Column decoders */
+
+/*
+ * How the values of a column are converted only depends on its type and
+ * format, so it is worked out once per result instead of once per cell.
+ * For each column the decoder table holds the functions that push a value
+ * as a JS value and append it as JSON, and the kind of value used by the
+ * typed getters and the columnar and Arrow exports.
+ */
+
+typedef void (*push_decoder)(duk_context *ctx, const char *value, int len);
+typedef void (*json_decoder)(duk_context *ctx, struct text_writer *w, const char *value, int len);
+
+struct column_decoder {
+	int kind;
+	push_decoder push;
+	json_decoder json;
+	/* COLUMN_* type for fetchColumns() */
+	int column_type;
+	/* ARROW_* type for writeArrow() */
+	int arrow_type;
+};
+
+static void push_text(duk_context *ctx, const char *value, int len)
+{
+	duk_push_lstring(ctx, value, len);
+}
+
+static void push_bool(duk_context *ctx, const char *value, int len)
+{
+	duk_push_boolean(ctx, value[0] == 't');
+}
+
+static void push_double(duk_context *ctx, const char *value, int len)
+{
+	duk_push_number(ctx, text_to_double(value, len));
+}
+
+/* int8 values that a double cannot hold exactly are kept as strings */
+static void push_int8(duk_context *ctx, const char *value, int len)
+{
+	int64_t ival = text_to_int64(value, len);
+
+	if (ival >= -9007199254740992LL && ival <= 9007199254740992LL)
+		duk_push_number(ctx, (double)ival);
+	else
+		duk_push_lstring(ctx, value, len);
+}
+
+static void json_text(duk_context *ctx, struct text_writer *w, const char *value, int len)
+{
+	writer_json_string(ctx, w, value, len);
+}
+
+/* The text form of integers and json/jsonb values is valid JSON */
+static void json_raw(duk_context *ctx, struct text_writer *w, const char *value, int len)
+{
+	writer_append(ctx, w, value, len);
+}
+
+static void json_bool(duk_context *ctx, struct text_writer *w, const char *value, int len)
+{
+	if (value[0] == 't')
+		writer_append(ctx, w, "true", 4);
+	else
+		writer_append(ctx, w, "false", 5);
+}
+
+static void json_int8(duk_context *ctx, struct text_writer *w, const char *value, int len)
+{
+	int64_t ival = text_to_int64(value, len);
+
+	if (ival >= -9007199254740992LL && ival <= 9007199254740992LL)
+		writer_append(ctx, w, value, len);
+	else
+		writer_json_string(ctx, w, value, len);
+}
+
+/* NaN, Infinity and -Infinity become null, as with JSON.stringify() */
+static void json_float(duk_context *ctx, struct text_writer *w, const char *value, int len)
+{
+	if (isalpha((unsigned char)value[len - 1]))
+		writer_append(ctx, w, "null", 4);
+	else
+		writer_append(ctx, w, value, len);
+}
+
+static const struct {
+	Oid type;
+	struct column_decoder decoder;
+} column_decoders[] = {
+	{BOOLOID,	{DECODE_BOOL,	push_bool,	json_bool,	COLUMN_STRING,	ARROW_BOOL}},
+	{INT2OID,	{DECODE_INT32,	push_double,	json_raw,	COLUMN_INT32,	ARROW_INT32}},
+	{INT4OID,	{DECODE_INT32,	push_double,	json_raw,	COLUMN_INT32,	ARROW_INT32}},
+	{INT8OID,	{DECODE_INT64,	push_int8,	json_int8,	COLUMN_FLOAT64,	ARROW_INT64}},
+	{OIDOID,	{DECODE_INT64,	push_double,	json_raw,	COLUMN_FLOAT64,	ARROW_INT64}},
+	{FLOAT4OID,	{DECODE_FLOAT,	push_double,	json_float,	COLUMN_FLOAT64,	ARROW_FLOAT64}},
+	{FLOAT8OID,	{DECODE_FLOAT,	push_double,	json_float,	COLUMN_FLOAT64,	ARROW_FLOAT64}},
+	{BYTEAOID,	{DECODE_BYTEA,	push_text,	json_text,	COLUMN_STRING,	ARROW_BINARY}},
+	{JSONOID,	{DECODE_JSON,	push_text,	json_raw,	COLUMN_STRING,	ARROW_UTF8}},
+	{JSONBOID,	{DECODE_JSON,	push_text,	json_raw,	COLUMN_STRING,	ARROW_UTF8}},
+};
+
+/* Everything else, including numeric (arbitrary precision), is text */
+static const struct column_decoder text_decoder = {
+	DECODE_TEXT, push_text, json_text, COLUMN_STRING, ARROW_UTF8
+};
+
+static const struct column_decoder *find_decoder(Oid type)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(column_decoders) / sizeof(column_decoders[0]); i++)
+		if (column_decoders[i].type == type)
+			return &column_decoders[i].decoder;
+
+	return &text_decoder;
+}
+
+/**
+ * @brief Get the decoder table of the current result
+ *
+ * The table is built on first use and kept with the result; streaming
+ * chunks and cursor batches share the columns of the first result, and
+ * so the table.
+ */
+static const struct column_decoder *get_decoders(duk_context *ctx, struct result *rs)
+{
+	int i, n;
+
+	if (rs->decoders || rs->pg == NULL)
+		return rs->decoders;
+
+	n = PQnfields(rs->pg);
+	rs->decoders = malloc((n ? n : 1) * sizeof(struct column_decoder));
+	if (rs->decoders == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
+
+	/* Results are requested in text format */
+	for (i = 0; i < n; i++)
+		rs->decoders[i] = PQfformat(rs->pg, i) == TEXT_RESULT ?
+			*find_decoder(PQftype(rs->pg, i)) : text_decoder;
+
+	return rs->decoders;
+}
+
+/* }}} Column decoders */
+
+/**
+ * @brief Push the value of a cell, converted according to the column type
+ *
+ * Booleans and numbers are converted to their JS counterparts. int8 values
+ * that a double cannot hold exactly and numeric values (arbitrary
+ * precision) are kept as strings, like all the other types.
+ */
+static inline void push_value(duk_context *ctx, const struct column_decoder *dec, PGresult *res, int row, int col)
+{
+	if (PQgetisnull(res, row, col))
+		duk_push_null(ctx);
+	else
+		dec[col].push(ctx, PQgetvalue(res, row, col), PQgetlength(res, row, col));
+}
+
+static struct result *get_result(duk_context *ctx)
+{
+	struct result *rs;
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "result");
+	rs = duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+
+	if (rs == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The result property is not set");
+
+	return rs;
+}
+
+/**
+ * @brief Push the next @limit rows (all if negative) as an array
+ *
+ * Rows are arrays of values, or objects keyed by the column labels if
+ * @as_object is set. The label strings are pushed once, and shared by
+ * all the rows.
+ */
+static void push_rows(duk_context *ctx, struct result *rs, double limit, int as_object)
+{
+	const struct column_decoder *dec = get_decoders(ctx, rs);
+	duk_idx_t keys_idx, arr_idx;
+	duk_uarridx_t count = 0;
+	int i, n;
+
+	n = rs->pg ? PQnfields(rs->pg) : 0;
+
+	keys_idx = duk_get_top(ctx);
+	if (as_object) {
+		duk_require_stack(ctx, n + 4);
+		for (i = 0; i < n; i++)
+			duk_push_string(ctx, PQfname(rs->pg, i));
+	}
+
+	arr_idx = duk_push_array(ctx);
+
+	while ((limit < 0 || count < limit) && next_row(ctx, rs)) {
+		if (as_object) {
+			duk_push_object(ctx);
+			for (i = 0; i < n; i++) {
+				duk_dup(ctx, keys_idx + i);
+				push_value(ctx, dec, rs->pg, rs->row_index, i);
+				duk_put_prop(ctx, -3);
+			}
+		} else {
+			duk_push_array(ctx);
+			for (i = 0; i < n; i++) {
+				push_value(ctx, dec, rs->pg, rs->row_index, i);
+				duk_put_prop_index(ctx, -2, i);
+			}
+		}
+		duk_put_prop_index(ctx, arr_idx, count++);
+	}
+
+	/* Leave only the array on the stack */
+	if (as_object) {
+		duk_insert(ctx, keys_idx);
+		duk_set_top(ctx, keys_idx + 1);
+	}
+}
+
+/**
+ * @brief Get all the remaining rows
+ *
+ * toArray([{asObject: true}]) returns an array of rows, built entirely
+ * in C, instead of calling next() and the getters for each cell.
+ */
+static int PgsqlResultSet_toArray(duk_context *ctx)
+{
+	struct result *rs = get_result(ctx);
+
+	push_rows(ctx, rs, -1, as_object_option(ctx, 0));
+	return 1;
+}
+
+/**
+ * @brief Get up to n of the remaining rows
+ *
+ * fetchRows(n[, {asObject: true}]) returns an empty array at the end of
+ * the result. With streaming or cursor based fetching, this allows
+ * processing a large result in blocks of rows.
+ */
+static int PgsqlResultSet_fetchRows(duk_context *ctx)
+{
+	struct result *rs = get_result(ctx);
+	double limit = duk_to_number(ctx, 0);
+
+	if (!(limit >= 0))
+		duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s\n", "The number of rows must be positive");
+
+	push_rows(ctx, rs, limit, as_object_option(ctx, 1));
+	return 1;
+}
+
+/**
+ * @brief Resolve the column list of fetchColumns()
+ *
+ * The columns at @idx are given by 1-based index or label; if there is no
+ * array, all the columns are used. The 0-based indexes are stored in a
+ * buffer pushed on the stack, and their number in @len.
+ */
+static int *push_column_list(duk_context *ctx, struct result *rs, duk_idx_t idx, unsigned int *len)
+{
+	int *cols;
+	int i, n = PQnfields(rs->pg);
+
+	if (!duk_is_array(ctx, idx)) {
+		cols = duk_push_fixed_buffer(ctx, (n ? n : 1) * sizeof(int));
+		for (i = 0; i < n; i++)
+			cols[i] = i;
+		*len = n;
+		return cols;
+	}
+
+	*len = duk_get_length(ctx, idx);
+	cols = duk_push_fixed_buffer(ctx, (*len ? *len : 1) * sizeof(int));
+
+	for (i = 0; i < *len; i++) {
+		duk_get_prop_index(ctx, idx, i);
+		if (duk_is_string(ctx, -1))
+			cols[i] = find_column(rs, duk_get_string(ctx, -1));
+		else
+			cols[i] = duk_to_int(ctx, -1) - 1;
+		duk_pop(ctx);
+
+		if (cols[i] < 0 || cols[i] >= n)
+			duk_error(ctx, DUK_ERR_RANGE_ERROR, "Column %d does not exist\n", i + 1);
+	}
+
+	return cols;
+}
+
+/**
+ * @brief Fetch up to n rows in columnar form
+ *
+ * fetchColumns(n[, columns]) returns an array with one object per column:
+ * {name, values, nulls}. int2/int4 columns are returned as an Int32Array,
+ * the other numeric columns (except numeric) as a Float64Array and the
+ * rest as arrays of strings. Bit i of the nulls bitmap is set if the value
+ * in row i is NULL.
+ *
+ * The rows available in the current result (or chunk) are processed one
+ * column at a time, so each column is filled by a simple loop.
+ */
+static int PgsqlResultSet_fetchColumns(duk_context *ctx)
+{
+	struct result *rs = get_result(ctx);
+	double limit = duk_to_number(ctx, 0);
+	const struct column_decoder *dec;
+	struct column_set set;
+	const char **names;
+	int *cols, *types;
+	unsigned int i, len;
+	duk_size_t k, r, row;
+	long capacity;
+	PGresult *res;
+
+	if (!(limit >= 0))
+		duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s\n", "The number of rows must be positive");
+
+	if (rs->pg == NULL) {
+		duk_push_array(ctx);
+		return 1;
+	}
+
+	cols = push_column_list(ctx, rs, 1, &len);
+	dec = get_decoders(ctx, rs);
+
+	types = duk_push_fixed_buffer(ctx, (len ? len : 1) * sizeof(int));
+	names = duk_push_fixed_buffer(ctx, (len ? len : 1) * sizeof(char *));
+	for (i = 0; i < len; i++) {
+		types[i] = dec[cols[i]].column_type;
+		names[i] = PQfname(rs->pg, cols[i]);
+	}
+	/* The names point into the PGresult, which may be replaced by the
+	 * next chunk; keep copies on the stack */
+	duk_require_stack(ctx, len + 4);
+	for (i = 0; i < len; i++)
+		names[i] = duk_push_string(ctx, names[i]);
+
+	/* A good guess unless the rows are fetched in parts */
+	capacity = PQntuples(rs->pg) - rs->row_index;
+	if (capacity > limit)
+		capacity = limit;
+	column_set_init(ctx, &set, types, len, capacity > 0 ? capacity : 1);
+
+	while (set.rows < limit && next_row(ctx, rs)) {
+		res = rs->pg;
+		k = PQntuples(res) - rs->row_index;
+		if (k > limit - set.rows)
+			k = limit - set.rows;
+		column_set_reserve(ctx, &set, set.rows + k);
+
+		/* Dispatch on the column type once per column and block */
+		for (i = 0; i < len; i++) {
+			switch (types[i]) {
+			case COLUMN_INT32:
+				for (r = 0, row = rs->row_index; r < k; r++, row++)
+					if (PQgetisnull(res, row, cols[i]))
+						column_set_null(&set, i, set.rows + r);
+					else
+						column_set_int32(&set, i, set.rows + r,
+								text_to_int64(PQgetvalue(res, row, cols[i]), PQgetlength(res, row, cols[i])));
+				break;
+			case COLUMN_FLOAT64:
+				for (r = 0, row = rs->row_index; r < k; r++, row++)
+					if (PQgetisnull(res, row, cols[i]))
+						column_set_null(&set, i, set.rows + r);
+					else
+						column_set_float64(&set, i, set.rows + r,
+								text_to_double(PQgetvalue(res, row, cols[i]), PQgetlength(res, row, cols[i])));
+				break;
+			default:
+				for (r = 0, row = rs->row_index; r < k; r++, row++)
+					if (PQgetisnull(res, row, cols[i]))
+						column_set_null(&set, i, set.rows + r);
+					else
+						column_set_string(ctx, &set, i, set.rows + r, PQgetvalue(res, row, cols[i]),
+								PQgetlength(res, row, cols[i]));
+			}
+		}
+
+		/* The last row of the block becomes the current row */
+		set.rows += k;
+		rs->row_index += k - 1;
+	}
+
+	column_set_finish(ctx, &set, names);
+	return 1;
+}
+
+/**
+ * @brief Call a function for each of the remaining rows
+ *
+ * forEach(fn[, {columns, asObject}]) advances the cursor in C and calls
+ * fn with the values of the row as arguments (or with a single object
+ * keyed by the column labels if asObject is set). The columns option
+ * selects the columns by 1-based index or label. The iteration stops
+ * early if fn returns false. Returns the number of rows processed.
+ */
+static int PgsqlResultSet_forEach(duk_context *ctx)
+{
+	struct result *rs = get_result(ctx);
+	const struct column_decoder *dec;
+	duk_idx_t list_idx = 1, keys_idx;
+	unsigned int i, len;
+	double count = 0;
+	int *cols, as_object, stop;
+
+	if (!duk_is_function(ctx, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The first parameter should be a function");
+
+	as_object = as_object_option(ctx, 1);
+
+	if (rs->pg == NULL) {
+		duk_push_int(ctx, 0);
+		return 1;
+	}
+
+	if (duk_is_object(ctx, 1)) {
+		duk_get_prop_string(ctx, 1, "columns");
+		list_idx = duk_get_top_index(ctx);
+	}
+	cols = push_column_list(ctx, rs, list_idx, &len);
+	dec = get_decoders(ctx, rs);
+
+	duk_require_stack(ctx, 2 * len + 4);
+	keys_idx = duk_get_top(ctx);
+	if (as_object)
+		for (i = 0; i < len; i++)
+			duk_push_string(ctx, PQfname(rs->pg, cols[i]));
+
+	while (next_row(ctx, rs)) {
+		duk_dup(ctx, 0);
+		if (as_object) {
+			duk_push_object(ctx);
+			for (i = 0; i < len; i++) {
+				duk_dup(ctx, keys_idx + i);
+				push_value(ctx, dec, rs->pg, rs->row_index, cols[i]);
+				duk_put_prop(ctx, -3);
+			}
+			duk_call(ctx, 1);
+		} else {
+			for (i = 0; i < len; i++)
+				push_value(ctx, dec, rs->pg, rs->row_index, cols[i]);
+			duk_call(ctx, len);
+		}
+
+		count++;
+		stop = duk_is_boolean(ctx, -1) && !duk_get_boolean(ctx, -1);
+		duk_pop(ctx);
+		if (stop)
+			break;
+	}
+
+	duk_push_number(ctx, count);
+	return 1;
+}
+
+/**
+ * @brief Move to the next row and store its values in the given object
+ *
+ * nextInto(row) overwrites the elements of an array (by column position)
+ * or the properties of an object (by column label) in place, so a loop
+ * over a large result can reuse a single object. Returns false at the
+ * end of the result, leaving the object unchanged.
+ */
+static int PgsqlResultSet_nextInto(duk_context *ctx)
+{
+	struct result *rs = get_result(ctx);
+	const struct column_decoder *dec;
+	int i, n, is_array;
+
+	if (!duk_is_object(ctx, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The parameter should be an object or an array");
+
+	if (!next_row(ctx, rs)) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	is_array = duk_is_array(ctx, 0);
+	n = PQnfields(rs->pg);
+	dec = get_decoders(ctx, rs);
+
+	for (i = 0; i < n; i++) {
+		push_value(ctx, dec, rs->pg, rs->row_index, i);
+		if (is_array)
+			duk_put_prop_index(ctx, 0, i);
+		else
+			duk_put_prop_string(ctx, 0, PQfname(rs->pg, i));
+	}
+
+	duk_push_true(ctx);
+	return 1;
+}
+
+/**
+ * @brief Append the JSON representation of a cell
+ *
+ * Like push_value(), int8 values beyond 2^53 and numeric values are
+ * written as strings; non-finite floats become null.
+ */
+static inline void json_value(duk_context *ctx, struct text_writer *w, const struct column_decoder *dec,
+		PGresult *res, int row, int col)
+{
+	if (PQgetisnull(res, row, col))
+		writer_append(ctx, w, "null", 4);
+	else
+		dec[col].json(ctx, w, PQgetvalue(res, row, col), PQgetlength(res, row, col));
+}
+
+/**
+ * @brief Serialize the remaining rows as JSON
+ *
+ * toJSON([{format: "objects" | "arrays", limit: n}]) writes the rows
+ * directly from the result into a single string, without creating a JS
+ * value per cell. With the default "objects" format each row is an
+ * object keyed by the column labels; with "arrays" each row is an array.
+ */
+static int PgsqlResultSet_toJSON(duk_context *ctx)
+{
+	struct result *rs = get_result(ctx);
+	const struct column_decoder *dec;
+	struct text_writer keys, w;
+	duk_size_t *offsets;
+	double limit = -1, count = 0;
+	int i, n, as_object = 1;
+
+	if (duk_is_object(ctx, 0)) {
+		duk_get_prop_string(ctx, 0, "format");
+		if (duk_is_string(ctx, -1) && !strcmp(duk_get_string(ctx, -1), "arrays"))
+			as_object = 0;
+		else if (!duk_is_undefined(ctx, -1) && strcmp(duk_safe_to_string(ctx, -1), "objects"))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The format should be \"objects\" or \"arrays\"");
+		duk_pop(ctx);
+
+		duk_get_prop_string(ctx, 0, "limit");
+		if (!duk_is_undefined(ctx, -1))
+			limit = duk_to_number(ctx, -1);
+		duk_pop(ctx);
+	}
+
+	n = rs->pg ? PQnfields(rs->pg) : 0;
+	dec = get_decoders(ctx, rs);
+
+	/* Escape the keys once: "label": */
+	offsets = duk_push_fixed_buffer(ctx, (n + 1) * sizeof(duk_size_t));
+	writer_init(ctx, &keys, 256);
+	for (i = 0; as_object && i < n; i++) {
+		offsets[i] = keys.len;
+		writer_json_string(ctx, &keys, PQfname(rs->pg, i), strlen(PQfname(rs->pg, i)));
+		writer_putc(ctx, &keys, ':');
+	}
+	offsets[i] = keys.len;
+
+	writer_init(ctx, &w, 4096);
+	writer_putc(ctx, &w, '[');
+
+	while ((limit < 0 || count < limit) && next_row(ctx, rs)) {
+		if (count++)
+			writer_putc(ctx, &w, ',');
+		writer_putc(ctx, &w, as_object ? '{' : '[');
+		for (i = 0; i < n; i++) {
+			if (i)
+				writer_putc(ctx, &w, ',');
+			if (as_object)
+				writer_append(ctx, &w, keys.data + offsets[i], offsets[i + 1] - offsets[i]);
+			json_value(ctx, &w, dec, rs->pg, rs->row_index, i);
+		}
+		writer_putc(ctx, &w, as_object ? '}' : ']');
+	}
+
+	writer_putc(ctx, &w, ']');
+	writer_finish(ctx, &w);
+
+	return 1;
+}
+
+struct csv_export {
+	struct result *rs;
+	int fd;
+	char delimiter;
+	int header;
+	const char *null_string;
+	const char *line_end;
+	double rows;
+	double bytes;
+};
+
+/* Called through duk_safe_call(), so that the file can be closed on errors */
+static duk_ret_t write_csv_rows(duk_context *ctx, void *udata)
+{
+	struct csv_export *ex = udata;
+	struct result *rs = ex->rs;
+	struct text_writer w;
+	size_t null_len = strlen(ex->null_string), end_len = strlen(ex->line_end);
+	int i, n = rs->pg ? PQnfields(rs->pg) : 0;
+
+	writer_init_fd(ctx, &w, ex->fd, POSTGRES_COPY_BUFFER_SIZE);
+
+	if (ex->header && n) {
+		for (i = 0; i < n; i++) {
+			if (i)
+				writer_putc(ctx, &w, ex->delimiter);
+			writer_csv_field(ctx, &w, PQfname(rs->pg, i), strlen(PQfname(rs->pg, i)), ex->delimiter);
+		}
+		writer_append(ctx, &w, ex->line_end, end_len);
+	}
+
+	while (next_row(ctx, rs)) {
+		for (i = 0; i < n; i++) {
+			if (i)
+				writer_putc(ctx, &w, ex->delimiter);
+			if (PQgetisnull(rs->pg, rs->row_index, i))
+				writer_append(ctx, &w, ex->null_string, null_len);
+			else
+				writer_csv_field(ctx, &w, PQgetvalue(rs->pg, rs->row_index, i),
+						PQgetlength(rs->pg, rs->row_index, i), ex->delimiter);
+		}
+		writer_append(ctx, &w, ex->line_end, end_len);
+		ex->rows++;
+	}
+
+	writer_flush(ctx, &w);
+	ex->bytes = w.written;
+
+	return 0;
+}
+
+/**
+ * @brief Write the remaining rows to a file in CSV format
+ *
+ * writeCSV(fdOrPath[, options]) iterates the rows in C and writes them
+ * through a reusable buffer of POSTGRES_COPY_BUFFER_SIZE bytes, with
+ * RFC 4180 quoting. The options are:
+ *   delimiter - field delimiter (",")
+ *   header    - write the column labels first (true)
+ *   nullString - text written for NULL values ("")
+ *   lineEnding - record terminator ("\r\n")
+ *
+ * A path is created or truncated, and closed when done; a file descriptor
+ * is left open. Returns {bytes, rows}.
+ */
+static int PgsqlResultSet_writeCSV(duk_context *ctx)
+{
+	struct csv_export ex;
+	const char *path = NULL;
+	int rc;
+
+	memset(&ex, 0, sizeof(ex));
+	ex.rs = get_result(ctx);
+	ex.delimiter = ',';
+	ex.header = 1;
+	ex.null_string = "";
+	ex.line_end = "\r\n";
+
+	if (duk_is_object(ctx, 1)) {
+		duk_get_prop_string(ctx, 1, "delimiter");
+		if (duk_is_string(ctx, -1) && duk_get_length(ctx, -1) == 1)
+			ex.delimiter = duk_get_string(ctx, -1)[0];
+		else if (!duk_is_undefined(ctx, -1))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The delimiter should be a single character\n");
+		duk_get_prop_string(ctx, 1, "header");
+		if (!duk_is_undefined(ctx, -1))
+			ex.header = duk_to_boolean(ctx, -1);
+		/* The strings are kept on the stack */
+		duk_get_prop_string(ctx, 1, "nullString");
+		if (!duk_is_undefined(ctx, -1))
+			ex.null_string = duk_to_string(ctx, -1);
+		duk_get_prop_string(ctx, 1, "lineEnding");
+		if (!duk_is_undefined(ctx, -1))
+			ex.line_end = duk_to_string(ctx, -1);
+	}
+
+	if (duk_is_number(ctx, 0))
+		ex.fd = duk_get_int(ctx, 0);
+	else {
+		path = duk_require_string(ctx, 0);
+		ex.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (ex.fd < 0)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
+	}
+
+	rc = duk_safe_call(ctx, write_csv_rows, &ex, 0, 1);
+
+	if (path && close(ex.fd) && rc == DUK_EXEC_SUCCESS)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
+	if (rc != DUK_EXEC_SUCCESS)
+		duk_throw(ctx);
+
+	duk_push_object(ctx);
+	duk_push_number(ctx, ex.bytes);
+	duk_put_prop_string(ctx, -2, "bytes");
+	duk_push_number(ctx, ex.rows);
+	duk_put_prop_string(ctx, -2, "rows");
+
+	return 1;
+}
+
+static inline int hex_value(char c)
+{
+	return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/*
+ * Decode a bytea value in text format, either hex ("\x0a1b") or escape
+ * ("a\001\\") format. The output is never longer than the input.
+ */
+static size_t decode_bytea(unsigned char *dst, const char *src, size_t len)
+{
+	unsigned char *out = dst;
+	size_t i;
+
+	if (len >= 2 && src[0] == '\\' && src[1] == 'x') {
+		for (i = 2; i + 1 < len; i += 2)
+			*out++ = hex_value(src[i]) << 4 | hex_value(src[i + 1]);
+		return out - dst;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (src[i] != '\\' || i + 1 == len)
+			*out++ = src[i];
+		else if (src[i + 1] == '\\')
+			*out++ = src[++i];
+		else if (i + 3 < len) {
+			*out++ = (src[i + 1] - '0') << 6 | (src[i + 2] - '0') << 3 | (src[i + 3] - '0');
+			i += 3;
+		}
+	}
+
+	return out - dst;
+}
+
+struct arrow_export {
+	struct result *rs;
+	int fd;
+	duk_size_t batch_rows;
+	double rows;
+	double bytes;
+};
+
+static duk_ret_t write_arrow_rows(duk_context *ctx, void *udata)
+{
+	struct arrow_export *ex = udata;
+	struct result *rs = ex->rs;
+	const struct column_decoder *dec = get_decoders(ctx, rs);
+	struct arrow_writer w;
+	int i, n = rs->pg ? PQnfields(rs->pg) : 0;
+	const char *value;
+	int len;
+
+	arrow_init(ctx, &w, ex->fd, n, ex->batch_rows);
+	for (i = 0; i < n; i++)
+		arrow_column(ctx, &w, i, PQfname(rs->pg, i), dec[i].arrow_type);
+	arrow_begin(ctx, &w);
+
+	while (next_row(ctx, rs)) {
+		for (i = 0; i < n; i++) {
+			if (PQgetisnull(rs->pg, rs->row_index, i)) {
+				arrow_null(&w, i);
+				continue;
+			}
+
+			value = PQgetvalue(rs->pg, rs->row_index, i);
+			len = PQgetlength(rs->pg, rs->row_index, i);
+
+			switch (w.columns[i].type) {
+			case ARROW_BOOL:
+				arrow_bool(&w, i, value[0] == 't');
+				break;
+			case ARROW_INT32:
+				arrow_int32(&w, i, text_to_int64(value, len));
+				break;
+			case ARROW_INT64:
+				arrow_int64(&w, i, text_to_int64(value, len));
+				break;
+			case ARROW_FLOAT64:
+				arrow_float64(&w, i, text_to_double(value, len));
+				break;
+			case ARROW_BINARY:
+				arrow_commit(&w, i, decode_bytea(arrow_reserve(ctx, &w, i, len), value, len));
+				break;
+			default:
+				arrow_bytes(ctx, &w, i, value, len);
+			}
+		}
+		arrow_end_row(ctx, &w);
+	}
+
+	arrow_finish(ctx, &w);
+	ex->rows = w.total_rows;
+	ex->bytes = w.offset;
+
+	return 0;
+}
+
+/**
+ * @brief Write the remaining rows to an Apache Arrow IPC file
+ *
+ * writeArrow(fdOrPath[, {batchRows}]) converts the rows column-wise into
+ * record batches of batchRows rows (ARROW_DEFAULT_BATCH_ROWS by default).
+ * bool, int2/int4, int8/oid, float4/float8 and bytea columns map to Bool,
+ * Int32, Int64, Float64 and Binary; all the other types, including
+ * numeric, are written as Utf8. Returns {bytes, rows}.
+ */
+static int PgsqlResultSet_writeArrow(duk_context *ctx)
+{
+	struct arrow_export ex;
+	const char *path = NULL;
+	double batch_rows;
+	int rc;
+
+	memset(&ex, 0, sizeof(ex));
+	ex.rs = get_result(ctx);
+	ex.batch_rows = ARROW_DEFAULT_BATCH_ROWS;
+
+	if (duk_is_object(ctx, 1)) {
+		duk_get_prop_string(ctx, 1, "batchRows");
+		if (!duk_is_undefined(ctx, -1)) {
+			batch_rows = duk_to_number(ctx, -1);
+			if (!(batch_rows >= 1 && batch_rows <= ARROW_MAX_BATCH_ROWS))
+				duk_error(ctx, DUK_ERR_RANGE_ERROR, "%s", "Invalid batchRows\n");
+			ex.batch_rows = batch_rows;
+		}
+		duk_pop(ctx);
+	}
+
+	if (duk_is_number(ctx, 0))
+		ex.fd = duk_get_int(ctx, 0);
+	else {
+		path = duk_require_string(ctx, 0);
+		ex.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (ex.fd < 0)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
+	}
+
+	rc = duk_safe_call(ctx, write_arrow_rows, &ex, 0, 1);
+
+	if (path && close(ex.fd) && rc == DUK_EXEC_SUCCESS)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s: %s\n", path, strerror(errno));
+	if (rc != DUK_EXEC_SUCCESS)
+		duk_throw(ctx);
+
+	duk_push_object(ctx);
+	duk_push_number(ctx, ex.bytes);
+	duk_put_prop_string(ctx, -2, "bytes");
+	duk_push_number(ctx, ex.rows);
+	duk_put_prop_string(ctx, -2, "rows");
+
+	return 1;
+}
+
+/**
+ * @brief Get a value as a number
+ *
+ * NULL values are returned as 0, like the typed getters do, and values
+ * that are not numbers as NaN.
+ */
+static int PgsqlResultSet_getNumber(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+
+	if (rs->was_null)
+		duk_push_number(ctx, 0);
+	else
+		duk_push_number(ctx, text_to_double(PQgetvalue(rs->pg, rs->row_index, col),
+				PQgetlength(rs->pg, rs->row_index, col)));
+	return 1;
+}
+
+static int PgsqlResultSet_getString(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+
+	if (PQgetisnull(rs->pg, rs->row_index, col))
+		duk_push_null(ctx);
+	else
+		duk_push_lstring(ctx, PQgetvalue(rs->pg, rs->row_index, col),
+				PQgetlength(rs->pg, rs->row_index, col));
+	return 1;
+}
+
+/**
+ * @brief Get a value as a buffer, without copying it
+ *
+ * getBuffer(col) returns an external buffer over the memory of the
+ * result, or null for NULL values. Text format bytea values are decoded
+ * into a buffer of the result that is reused for that column. Either
+ * way, the buffer is only valid until the cursor moves with next() or the
+ * result set is closed; copy it to keep the data.
+ */
+static int PgsqlResultSet_getBuffer(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+	const char *value;
+	unsigned char *buf;
+	size_t len;
+
+	if (PQgetisnull(rs->pg, rs->row_index, col)) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	value = PQgetvalue(rs->pg, rs->row_index, col);
+	len = PQgetlength(rs->pg, rs->row_index, col);
+
+	if (get_decoders(ctx, rs)[col].kind == DECODE_BYTEA) {
+		buf = column_scratch_get(&rs->decoded, PQnfields(rs->pg), col, len);
+		if (buf == NULL)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
+		len = decode_bytea(buf, value, len);
+		value = (const char *)buf;
+	}
+
+	duk_push_external_buffer(ctx);
+	duk_config_buffer(ctx, -1, (void *)value, len);
+
+	return 1;
+}
+
+/*
+ * The typed getters follow the JDBC rules described in jscommon.c. Values
+ * are parsed from the text format with the conversion that suits the
+ * kind of decoder of the column.
+ */
+
+/* Parse a number for a typed getter, which fails if it is not one */
+static double parse_number(duk_context *ctx, const char *value, int len)
+{
+	double d;
+
+	if (!parse_double(value, len, &d))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The value is not a number");
+
+	return d;
+}
+
+static int PgsqlResultSet_getInt(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+	const char *value;
+	int len;
+
+	if (rs->was_null) {
+		duk_push_int(ctx, 0);
+		return 1;
+	}
+
+	value = PQgetvalue(rs->pg, rs->row_index, col);
+	len = PQgetlength(rs->pg, rs->row_index, col);
+
+	switch (get_decoders(ctx, rs)[col].kind) {
+	case DECODE_BOOL:
+		duk_push_int(ctx, value[0] == 't');
+		break;
+	case DECODE_INT32:
+	case DECODE_INT64:
+		push_int32(ctx, text_to_int64(value, len));
+		break;
+	default:
+		push_int32(ctx, parse_number(ctx, value, len));
+	}
+
+	return 1;
+}
+
+/**
+ * @brief Get a 64-bit integer value
+ *
+ * The value is a number if a double holds it exactly (up to 2^53 in
+ * magnitude), and a decimal string otherwise. Fractional values are
+ * truncated.
+ */
+static int PgsqlResultSet_getLong(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+	const char *value;
+	int64_t ival;
+	int len;
+
+	if (rs->was_null) {
+		duk_push_int(ctx, 0);
+		return 1;
+	}
+
+	value = PQgetvalue(rs->pg, rs->row_index, col);
+	len = PQgetlength(rs->pg, rs->row_index, col);
+
+	switch (get_decoders(ctx, rs)[col].kind) {
+	case DECODE_BOOL:
+		duk_push_int(ctx, value[0] == 't');
+		break;
+	case DECODE_INT32:
+	case DECODE_INT64:
+		push_int64(ctx, text_to_int64(value, len));
+		break;
+	default:
+		/* Integers in numeric or text columns keep all their digits */
+		if (parse_int64(value, len, &ival))
+			push_int64(ctx, ival);
+		else
+			duk_push_number(ctx, trunc(parse_number(ctx, value, len)));
+	}
+
+	return 1;
+}
+
+static int PgsqlResultSet_getDouble(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+	const char *value;
+
+	if (rs->was_null) {
+		duk_push_number(ctx, 0);
+		return 1;
+	}
+
+	value = PQgetvalue(rs->pg, rs->row_index, col);
+
+	if (get_decoders(ctx, rs)[col].kind == DECODE_BOOL)
+		duk_push_number(ctx, value[0] == 't');
+	else
+		duk_push_number(ctx, parse_number(ctx, value, PQgetlength(rs->pg, rs->row_index, col)));
+
+	return 1;
+}
+
+static int PgsqlResultSet_getBoolean(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+	const char *value;
+
+	if (rs->was_null) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	value = PQgetvalue(rs->pg, rs->row_index, col);
+
+	if (get_decoders(ctx, rs)[col].kind == DECODE_BOOL)
+		duk_push_boolean(ctx, value[0] == 't');
+	else
+		duk_push_boolean(ctx, parse_boolean(value, PQgetlength(rs->pg, rs->row_index, col)));
+
+	return 1;
+}
+
+/**
+ * @brief Get a copy of a value as a buffer
+ *
+ * Unlike getBuffer(), the buffer belongs to JS and stays valid. bytea
+ * values are decoded straight into it.
+ */
+static int PgsqlResultSet_getBytes(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+	const char *value;
+	unsigned char *buf;
+	size_t len;
+
+	if (rs->was_null) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	value = PQgetvalue(rs->pg, rs->row_index, col);
+	len = PQgetlength(rs->pg, rs->row_index, col);
+
+	if (get_decoders(ctx, rs)[col].kind == DECODE_BYTEA) {
+		buf = duk_push_dynamic_buffer(ctx, len);
+		duk_resize_buffer(ctx, -1, decode_bytea(buf, value, len));
+	} else
+		memcpy(duk_push_fixed_buffer(ctx, len), value, len);
+
+	return 1;
+}
+
+static void push_json(duk_context *ctx, const char *value, int len)
+{
+	duk_push_lstring(ctx, value, len);
+	duk_json_decode(ctx, -1);
+}
+
+/**
+ * @brief Get a json or jsonb value as a JS value
+ *
+ * The text is decoded by the JSON parser of Duktape, without going
+ * through a JS string first. NULL values are returned as null.
+ */
+static int PgsqlResultSet_getJSON(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+
+	if (rs->was_null) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	push_json(ctx, PQgetvalue(rs->pg, rs->row_index, col),
+			PQgetlength(rs->pg, rs->row_index, col));
+	return 1;
+}
+
+/* Unlike json columns in toArray(), json array elements are decoded */
+static const struct {
+	Oid type;
+	push_decoder push;
+} array_elements[] = {
+	{BOOLARRAYOID,		push_bool},
+	{INT2ARRAYOID,		push_double},
+	{INT4ARRAYOID,		push_double},
+	{INT8ARRAYOID,		push_int8},
+	{OIDARRAYOID,		push_double},
+	{FLOAT4ARRAYOID,	push_double},
+	{FLOAT8ARRAYOID,	push_double},
+	{JSONARRAYOID,		push_json},
+	{JSONBARRAYOID,		push_json},
+};
+
+/**
+ * @brief Push the JS array of an array literal
+ *
+ * @param buf Scratch space for unquoting elements, as long as the literal
+ * @param push Decoder of the elements
+ * @param depth Number of enclosing arrays
+ * @return Pointer past the closing brace, or NULL on a syntax error
+ *
+ * Elements are separated by commas and may be quoted with double quotes,
+ * in which backslashes escape the next character. An unquoted NULL is a
+ * NULL element. Multidimensional arrays are nested arrays.
+ */
+static const char *parse_array(duk_context *ctx, const char *p, const char *end, char *buf,
+		push_decoder push, int depth)
+{
+	duk_uarridx_t n = 0;
+	const char *start;
+	int len;
+
+	if (p == end || *p++ != '{' || depth >= MAX_ARRAY_DIMENSIONS)
+		return NULL;
+
+	duk_push_array(ctx);
+	if (p < end && *p == '}')
+		return p + 1;
+
+	for (;;) {
+		if (p == end)
+			return NULL;
+
+		if (*p == '{') {
+			p = parse_array(ctx, p, end, buf, push, depth + 1);
+			if (p == NULL)
+				return NULL;
+		} else if (*p == '"') {
+			for (p++, len = 0; p < end && *p != '"'; p++) {
+				if (*p == '\\' && ++p == end)
+					return NULL;
+				buf[len++] = *p;
+			}
+			if (p++ == end)
+				return NULL;
+			push(ctx, buf, len);
+		} else {
+			for (start = p; p < end && *p != ',' && *p != '}'; p++);
+			if (p - start == 4 && !strncmp(start, "NULL", 4))
+				duk_push_null(ctx);
+			else
+				push(ctx, start, p - start);
+		}
+		duk_put_prop_index(ctx, -2, n++);
+
+		if (p == end)
+			return NULL;
+		if (*p == '}')
+			return p + 1;
+		if (*p++ != ',')
+			return NULL;
+	}
+}
+
+/**
+ * @brief Get an array value as a JS array
+ *
+ * The elements of boolean, integer and floating point arrays are
+ * converted like the columns of those types in toArray(), the elements
+ * of json and jsonb arrays are decoded like getJSON() does, and the
+ * elements of all the other arrays are strings. NULL values are returned
+ * as null.
+ */
+static int PgsqlResultSet_getArray(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+	push_decoder push = push_text;
+	const char *value, *end;
+	unsigned int i;
+	char *buf;
+	int len;
+
+	if (rs->was_null) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	value = PQgetvalue(rs->pg, rs->row_index, col);
+	len = PQgetlength(rs->pg, rs->row_index, col);
+	end = value + len;
+
+	for (i = 0; i < sizeof(array_elements) / sizeof(array_elements[0]); i++)
+		if (array_elements[i].type == PQftype(rs->pg, col)) {
+			push = array_elements[i].push;
+			break;
+		}
+
+	/* Skip the bounds that precede arrays not starting at 1: [0:1]={..} */
+	if (len && value[0] == '[') {
+		while (value < end && *value != '=')
+			value++;
+		if (value < end)
+			value++;
+	}
+
+	buf = duk_push_fixed_buffer(ctx, len ? len : 1);
+	if (parse_array(ctx, value, end, buf, push, 0) != end)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The value is not an array");
+
+	return 1;
+}
+
+static void push_timestamp(duk_context *ctx, struct result *rs, int col, int date_only)
+{
+	struct timestamp ts;
+
+	if (!parse_timestamp(PQgetvalue(rs->pg, rs->row_index, col),
+				PQgetlength(rs->pg, rs->row_index, col), &ts))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The value is not a date");
+
+	if (date_only) {
+		ts.hour = ts.minute = ts.second = ts.usec = 0;
+		ts.has_zone = 0;
+	}
+
+	push_date(ctx, timestamp_to_time(&ts));
+}
+
+/**
+ * @brief Get a date as a Date object
+ *
+ * The time of day and the time zone, if any, are dropped: the result is
+ * the local midnight of the date. Values are expected in the ISO format
+ * (DateStyle), and infinite dates become invalid dates. NULL values are
+ * returned as null.
+ */
+static int PgsqlResultSet_getDate(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+
+	if (rs->was_null)
+		duk_push_null(ctx);
+	else
+		push_timestamp(ctx, rs, col, 1);
+	return 1;
+}
+
+/**
+ * @brief Get a timestamp as a Date object
+ *
+ * timestamptz values are converted using their offset, and timestamp
+ * values are in local time. Microseconds are truncated to milliseconds.
+ */
+static int PgsqlResultSet_getTimestamp(duk_context *ctx)
+{
+	struct result *rs;
+	int col = get_column_index(ctx, &rs);
+
+	if (rs->was_null)
+		duk_push_null(ctx);
+	else
+		push_timestamp(ctx, rs, col, 0);
+	return 1;
+}
+
+/* {{{ Metadata */
+
+/* Names of the built-in types, as in pg_type.typname */
+static const struct {
+	Oid oid;
+	const char *name;
+} type_names[] = {
+	{BOOLOID,		"bool"},
+	{BYTEAOID,		"bytea"},
+	{18,			"char"},
+	{19,			"name"},
+	{INT8OID,		"int8"},
+	{INT2OID,		"int2"},
+	{INT4OID,		"int4"},
+	{25,			"text"},
+	{OIDOID,		"oid"},
+	{JSONOID,		"json"},
+	{142,			"xml"},
+	{FLOAT4OID,		"float4"},
+	{FLOAT8OID,		"float8"},
+	{790,			"money"},
+	{1042,			"bpchar"},
+	{1043,			"varchar"},
+	{1082,			"date"},
+	{1083,			"time"},
+	{1114,			"timestamp"},
+	{1184,			"timestamptz"},
+	{1186,			"interval"},
+	{1266,			"timetz"},
+	{1560,			"bit"},
+	{1562,			"varbit"},
+	{NUMERICOID,		"numeric"},
+	{2950,			"uuid"},
+	{JSONBOID,		"jsonb"},
+	{JSONARRAYOID,		"_json"},
+	{BOOLARRAYOID,		"_bool"},
+	{BYTEAARRAYOID,		"_bytea"},
+	{INT2ARRAYOID,		"_int2"},
+	{INT4ARRAYOID,		"_int4"},
+	{TEXTARRAYOID,		"_text"},
+	{VARCHARARRAYOID,	"_varchar"},
+	{INT8ARRAYOID,		"_int8"},
+	{FLOAT4ARRAYOID,	"_float4"},
+	{FLOAT8ARRAYOID,	"_float8"},
+	{OIDARRAYOID,		"_oid"},
+	{1182,			"_date"},
+	{1115,			"_timestamp"},
+	{1185,			"_timestamptz"},
+	{NUMERICARRAYOID,	"_numeric"},
+	{2951,			"_uuid"},
+	{JSONBARRAYOID,		"_jsonb"},
+};
+
+/* The name of a built-in type, NULL for the other ones */
+static const char *type_name(Oid oid)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(type_names) / sizeof(type_names[0]); i++)
+		if (type_names[i].oid == oid)
+			return type_names[i].name;
+
+	return NULL;
+}
+
+/**
+ * @brief Describe a column or a parameter of the given type
+ *
+ * The precision and the scale are taken from the type modifier of
+ * numeric and character columns, and are unknown for parameters and
+ * for the other types. libpq does not report the nullability.
+ */
+static void describe_type(struct column_info *info, Oid type, int mod)
+{
+	info->type = type;
+	info->type_name = type_name(type);
+	info->precision = -1;
+	info->scale = -1;
+	info->nullable = -1;
+
+	if (mod < 4)
+		return;
+
+	switch (type) {
+	case NUMERICOID:
+		info->precision = ((mod - 4) >> 16) & 0xffff;
+		info->scale = (mod - 4) & 0xffff;
+		break;
+	case 1042:	/* bpchar */
+	case 1043:	/* varchar */
+		info->precision = mod - 4;
+		break;
+	}
+}
+
+/**
+ * @brief Describe the columns of the result set
+ *
+ * Returns {columnCount, columns}, where every column has a name, the
+ * type OID, the typeName and the precision, scale and nullable flags
+ * (null if not known). The object is built on the first call and the
+ * same object is returned afterwards.
+ */
+static int PgsqlResultSet_getMetaData(duk_context *ctx)
+{
+	struct result *rs;
+	struct column_info info;
+	int i, n;
+
+	if (push_cached(ctx, "metaData"))
+		return 1;
+
+	rs = get_result(ctx);
+	if (rs->pg == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The result set is closed");
+
+	n = PQnfields(rs->pg);
+
+	duk_push_object(ctx);
+	duk_push_int(ctx, n);
+	duk_put_prop_string(ctx, -2, "columnCount");
+
+	duk_push_array(ctx);
+	for (i = 0; i < n; i++) {
+		describe_type(&info, PQftype(rs->pg, i), PQfmod(rs->pg, i));
+		info.name = PQfname(rs->pg, i);
+		push_column_info(ctx, &info);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	duk_put_prop_string(ctx, -2, "columns");
+
+	cache_value(ctx, "metaData");
+	return 1;
+}
+
+/* }}} Metadata */
+
+/* Report whether the last value read by a getter was NULL */
+static int PgsqlResultSet_wasNull(duk_context *ctx)
+{
+	struct result *rs = get_result(ctx);
+
+	duk_push_boolean(ctx, rs->was_null);
+	return 1;
+}
+
+static int PgsqlResultSet_next(duk_context *ctx)
+{
+	struct result *rs;
+	int argc = duk_get_top(ctx);
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "result");
+	rs = duk_get_pointer(ctx, -1);
+
+	if (rs == NULL) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	if (argc != 0) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	duk_push_boolean(ctx, next_row(ctx, rs));
+	return 1;
+}
+
+static int PgsqlResultSet_first(duk_context *ctx)
+{
+	struct result *rs;
+	int argc = duk_get_top(ctx);
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "result");
+	rs = duk_get_pointer(ctx, -1);
+
+	if (rs == NULL) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	if (argc != 0) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	if (rs->forward_only)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The result set is forward only");
+
+	rs->row_index = 0;
+
+	duk_push_true(ctx);
+	return 1;
+}
+
+static int PgsqlResultSet_last(duk_context *ctx)
+{
+	struct result *rs;
+	int argc = duk_get_top(ctx);
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "result");
+	rs = duk_get_pointer(ctx, -1);
+
+	if (rs == NULL) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	if (argc != 0) {
+		duk_push_false(ctx);
+		return 1;
+	}
+
+	if (rs->forward_only)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The result set is forward only");
+
+	rs->row_index = PQntuples(rs->pg) - 1;
+
+	duk_push_true(ctx);
+	return 1;
+}
+
+static int PgsqlResultSet_finalize(duk_context *ctx)
+{
+	struct result *rs;
+	duk_get_prop_string(ctx, 0, "result");
+	rs = duk_get_pointer(ctx, -1);
+
+	if (rs != NULL) {
+		/* When the heap is destroyed, the connection may be
+		 * finalized first; don't talk to the server then. */
+		duk_get_prop_string(ctx, 0, "connection");
+		duk_get_prop_string(ctx, -1, "connection");
+		if (duk_get_pointer(ctx, -1) == NULL)
+			rs->conn = NULL;
+		release_result(rs);
+	}
+
+	printf("in finalize la result set: ");
+	return 0;
+}
+
+static duk_function_list_entry PgsqlResultSet_functions[] = {
+	{"getNumber",	PgsqlResultSet_getNumber,	1},
+	{"getString",	PgsqlResultSet_getString,	1},
+	{"getBuffer",	PgsqlResultSet_getBuffer,	1},
+	{"getInt",	PgsqlResultSet_getInt,		1},
+	{"getLong",	PgsqlResultSet_getLong,		1},
+	{"getDouble",	PgsqlResultSet_getDouble,	1},
+	{"getBoolean",	PgsqlResultSet_getBoolean,	1},
+	{"getBytes",	PgsqlResultSet_getBytes,	1},
+	{"getJSON",	PgsqlResultSet_getJSON,		1},
+	{"getArray",	PgsqlResultSet_getArray,	1},
+	{"getDate",	PgsqlResultSet_getDate,		1},
+	{"getTimestamp",	PgsqlResultSet_getTimestamp,	1},
+	{"getMetaData",		PgsqlResultSet_getMetaData,	0},
+	{"wasNull",	PgsqlResultSet_wasNull,		0},
+	{"next",	PgsqlResultSet_next,		0},
+	{"first",	PgsqlResultSet_first,		0},
+	{"last",	PgsqlResultSet_last,		0},
+	{"toArray",	PgsqlResultSet_toArray,		DUK_VARARGS},
+	{"fetchRows",	PgsqlResultSet_fetchRows,	DUK_VARARGS},
+	{"fetchColumns",	PgsqlResultSet_fetchColumns,	DUK_VARARGS},
+	{"forEach",	PgsqlResultSet_forEach,		DUK_VARARGS},
+	{"nextInto",	PgsqlResultSet_nextInto,	1},
+	{"toJSON",	PgsqlResultSet_toJSON,		DUK_VARARGS},
+	{"writeCSV",	PgsqlResultSet_writeCSV,	DUK_VARARGS},
+	{"writeArrow",	PgsqlResultSet_writeArrow,	DUK_VARARGS},
+	{NULL,		NULL, 				0}
+};
+
+/**
+ * @brief Push a result set for the last result of the statement
+ *
+ * The statement object must be at @stmt_idx. The result set holds its own
+ * reference to the result, so it stays valid when the statement is
+ * executed again or finalized, and keeps the connection object alive.
+ */
+static void push_result_set(duk_context *ctx, duk_idx_t stmt_idx, struct statement *stmt)
+{
+	stmt_idx = duk_normalize_index(ctx, stmt_idx);
+
+	if (stmt->result == NULL) {
+		duk_push_null(ctx);
+		return;
+	}
+
+	duk_push_object(ctx);
+
+	duk_get_global_string(ctx, "PgsqlResultSet");
+	duk_set_prototype(ctx, -2);
+
+	duk_push_pointer(ctx, (void *) hold_result(stmt->result));
+	duk_put_prop_string(ctx, -2, "result");
+
+	duk_get_prop_string(ctx, stmt_idx, "connection");
+	duk_put_prop_string(ctx, -2, "connection");
+}
+
+static int PgsqlStatement_execute(duk_context *ctx)
+{
+	struct statement *stmt;
+	int argc = duk_get_top(ctx);
+
+	if (argc < 0 || argc > 2)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Wrong number of arguments\n");
+
+	if (argc > 0) {
+		/* if there is an old statement clear the memory */
+		duk_push_this(ctx);
+		duk_get_prop_string(ctx, -1, "stmt");
+		stmt = duk_get_pointer(ctx, -1);
+		if (stmt) {
+			clear_result(stmt);
+			clear_statement(stmt);
+			duk_push_pointer(ctx, NULL);
+			duk_put_prop_string(ctx, -3, "stmt");
+		}
+
+		duk_push_this(ctx);
+		if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
+			/* TODO error */
+			return DUK_RET_ERROR;
+		}
+	}
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
 	if (stmt == NULL)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The statement property is not set");
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
 
-	if (argc != 1)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Wrong number of arguments");
+	if (execute_statement(ctx, argc, stmt, 0))
+		duk_push_true(ctx);
+	else
+		duk_push_false(ctx);
 
-	if (duk_is_number(ctx, 0)) {
-		column_index = duk_get_int(ctx, 0);
+	return 1;
+}
 
-		if (stmt->autoGeneratedKeys == RETURN_GENERATED_KEYS && stmt->columns != NULL) {
-			if (column_index < 1 || column_index > stmt->columns->len)
-				duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Column index out of bounds");
+static int PgsqlStatement_executeQuery(duk_context *ctx)
+{
+	int argc = duk_get_top(ctx);
+	struct statement *stmt;
+
+	/* if it is a simple statement set the SQL command*/
+	if (argc == 1) {
+		duk_push_this(ctx);
+		duk_get_prop_string(ctx, -1, "stmt");
+		stmt = duk_get_pointer(ctx, -1);
+		if (stmt) {
+			clear_result(stmt);
+			clear_statement(stmt);
+			duk_push_pointer(ctx, NULL);
+			duk_put_prop_string(ctx, -3, "stmt");
+		}
+
+		duk_push_this(ctx);
+		if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
+			/* TODO error */
+			return DUK_RET_ERROR;
+		}
+	}
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+	if (stmt == NULL) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	if (!execute_statement(ctx, argc, stmt, 1)) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	/* Create PostgreSQL Result Set object */
+	push_result_set(ctx, -2, stmt);
+
+	return 1;
+}
+
+static int PgsqlStatement_executeUpdate(duk_context *ctx)
+{
+	int argc = duk_get_top(ctx);
+	struct statement *stmt;
+
+	if (argc < 0 || argc > 2)
+		return DUK_RET_ERROR;
+
+	if (argc > 0) {
+		duk_push_this(ctx);
+		duk_get_prop_string(ctx, -1, "stmt");
+		stmt = duk_get_pointer(ctx, -1);
+		if (stmt) {
+			clear_result(stmt);
+			clear_statement(stmt);
+			duk_push_pointer(ctx, NULL);
+			duk_put_prop_string(ctx, -3, "stmt");
+		}
+
+		duk_push_this(ctx);
+		if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
+			/* TODO error */
+			return DUK_RET_ERROR;
+		}
+	}
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+	if (stmt == NULL) {
+		duk_push_number(ctx, -1);
+		return 1;
+	}
+
+	if (!execute_statement(ctx, argc, stmt, 0)) {
+		duk_push_number(ctx, -1);
+		return 1;
+	}
+
+	duk_push_number(ctx, atoi(PQcmdTuples(stmt->result->pg)));
+	return 1;
+}
+
+static int PgsqlStatement_getConnection(duk_context *ctx)
+{
+	duk_push_this(ctx);
+
+	duk_get_prop_string(ctx, -1, "connection");
+
+	return 1;
+}
+
+static int PgsqlStatement_getGeneratedKeys(duk_context *ctx)
+{
+	struct statement *stmt;
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+
+	if (stmt == NULL) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	if (stmt->autoGeneratedKeys != RETURN_GENERATED_KEYS) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	push_result_set(ctx, -2, stmt);
+
+	return 1;
+}
+
+static int PgsqlStatement_getResultSet(duk_context *ctx)
+{
+	struct statement *stmt;
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+
+	if (stmt == NULL) {
+		duk_push_null(ctx);
+		return 1;
+	}
+
+	push_result_set(ctx, -2, stmt);
+
+	return 1;
+}
+
+static int PgsqlStatement_getUpdateCount(duk_context *ctx)
+{
+	struct statement *stmt;
+
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+
+	if (stmt == NULL || stmt->result == NULL) {
+		duk_push_number(ctx, -1);
+		return 1;
+	}
+
+	duk_push_number(ctx, atoi(PQcmdTuples(stmt->result->pg)));
+	return 1;
+}
+
+/**
+ * @brief Enable or disable streaming of query results
+ *
+ * In streaming mode the rows are pulled from the server as the result set
+ * is iterated instead of being materialized when the query is executed.
+ * Streaming result sets are forward only, and the connection cannot run
+ * any other command until the result set has been read completely (or the
+ * statement has been re-executed).
+ */
+static int PgsqlStatement_setStreaming(duk_context *ctx)
+{
+	struct statement *stmt;
+	duk_bool_t streaming = duk_to_boolean(ctx, 0);
+
+	duk_push_this(ctx);
+	duk_push_boolean(ctx, streaming);
+	duk_put_prop_string(ctx, -2, "streaming");
+
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+	if (stmt)
+		stmt->streaming = streaming;
+
+	return 0;
+}
+
+/**
+ * @brief Set the number of rows fetched at once through a cursor
+ *
+ * When the fetch size is positive and a query is executed inside a
+ * transaction, the rows are retrieved in batches of this size through a
+ * server side cursor. Outside a transaction the setting has no effect.
+ */
+static int PgsqlStatement_setFetchSize(duk_context *ctx)
+{
+	struct statement *stmt;
+	int fetch_size = duk_to_int(ctx, 0);
+
+	if (fetch_size < 0)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The fetch size must not be negative");
+
+	duk_push_this(ctx);
+	duk_push_int(ctx, fetch_size);
+	duk_put_prop_string(ctx, -2, "fetchSize");
+
+	duk_get_prop_string(ctx, -1, "stmt");
+	stmt = duk_get_pointer(ctx, -1);
+	if (stmt)
+		stmt->fetch_size = fetch_size;
+
+	return 0;
+}
+
+static int PgsqlStatement_getFetchSize(duk_context *ctx)
+{
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "fetchSize");
+	duk_push_int(ctx, duk_get_int(ctx, -1));
+
+	return 1;
+}
+
+static int PgsqlStatement_finalize(duk_context *ctx)
+{
+	struct statement *stmt;
+	duk_get_prop_string(ctx, 0, "stmt");
+	if (!duk_is_undefined(ctx, -1)) {
+		stmt = duk_get_pointer(ctx, -1);
+
+		if (stmt != NULL) {
+			/* When the heap is destroyed, the connection may be
+			 * finalized first; don't talk to the server then. */
+			duk_get_prop_string(ctx, 0, "connection");
+			duk_get_prop_string(ctx, -1, "connection");
+			if (duk_get_pointer(ctx, -1) == NULL) {
+				stmt->conn = NULL;
+				if (stmt->result)
+					stmt->result->conn = NULL;
+			}
+			clear_statement(stmt);
+		}
+	}
+
+	printf("in finalize la statement: ");
+	return 0;
+}
+
+static duk_function_list_entry PgsqlStatement_functions[] = {
+	{"execute",		PgsqlStatement_execute,			DUK_VARARGS},
+	{"executeQuery",	PgsqlStatement_executeQuery,		DUK_VARARGS},
+	{"executeUpdate",	PgsqlStatement_executeUpdate,		DUK_VARARGS},
+	{"getConnection",	PgsqlStatement_getConnection,		0},
+	{"getGeneratedKeys",	PgsqlStatement_getGeneratedKeys,	0},
+	{"getResultSet",	PgsqlStatement_getResultSet,		0},
+	{"getUpdateCount",	PgsqlStatement_getUpdateCount,		0},
+	{"getFetchSize",	PgsqlStatement_getFetchSize,		0},
+	{"setFetchSize",	PgsqlStatement_setFetchSize,		1},
+	{"setStreaming",	PgsqlStatement_setStreaming,		1},
+	{NULL,			NULL, 					0}
+};
 
-			if (stmt->columns->indexes) {
-					column_index = stmt->columns->indexes[column_index - 1];
-			} else {
-				column_index = PQfnumber(stmt->result, stmt->columns->names[column_index - 1]);
-				if (column_index == -1)
-					duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The given name does not match any column.");
-				/* Increment it because the column index is expected to start from 1 */
-				column_index++;
-			}
-		}
+static int PgsqlPreparedStatement_setNumber(duk_context *ctx)
+{
+	if (!duk_is_number(ctx, 1) || duk_is_null(ctx, 1))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The value is not a number!\n");
 
-		if (column_index < 1 || column_index > PQnfields(stmt->result)) {
-			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Column index out of bounds");
-		}
-		column_index--;
-	} else if (duk_is_string(ctx, 0)) {
-		column_name = duk_get_string(ctx, 0);
+	set_parameter(ctx);
 
-		column_index = PQfnumber(stmt->result, column_name);
-		if (column_index == -1)
-			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The given name does not match any column.");
-	} else {
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "[Wrong argument type]The first parameter should be a number \
-				which represents the position of the parameter or a string (column label)");
-	}
+	return 0;
+}
 
-	if (stmt->row_index < 0 || stmt->row_index >= PQntuples(stmt->result))
-			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Row index out of bounds");
+static int PgsqlPreparedStatement_setString(duk_context *ctx)
+{
+	if (!duk_is_string(ctx, 1) || duk_is_null(ctx, 1))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The value is not a string!\n");
 
-	if (PQgetisnull(stmt->result, stmt->row_index, column_index)) {
-		return NULL;
-	}
+	set_parameter(ctx);
 
-	value = PQgetvalue(stmt->result, stmt->row_index, column_index);
-	return value;
+	return 0;
 }
 
-static void set_parameter(duk_context *ctx)
+static struct statement *get_prepared_statement(duk_context *ctx)
 {
-	int pos;
-	const char *value;
 	struct statement *stmt;
-	int argc = duk_get_top(ctx);
 
 	duk_push_this(ctx);
 	duk_get_prop_string(ctx, -1, "stmt");
 	stmt = duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
 
 	if (stmt == NULL)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The statement property is not set");;
-
-	if (argc < 1)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Wrong number of arguments");
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The statement property is not set");
 
-	if (!duk_is_number(ctx, 0))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The first parameter should be a \
-			number which represents the position of the parameter");
+	return stmt;
+}
 
-	pos = duk_get_int(ctx, 0);
+static int PgsqlPreparedStatement_addBatch(duk_context *ctx)
+{
+	struct statement *stmt = get_prepared_statement(ctx);
+	char **values;
+	int *lengths;
+	unsigned int i;
 
-	if (pos > stmt->p_len || pos < 1)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The position is incorrect!");
+	if (stmt->batch_len == stmt->batch_size) {
+		unsigned int size = stmt->batch_size ? 2 * stmt->batch_size : 16;
+		struct batch_entry *batch = realloc(stmt->batch, size * sizeof(struct batch_entry));
 
-	pos--;
+		if (batch == NULL)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
+		stmt->batch = batch;
+		stmt->batch_size = size;
+	}
 
-	if (stmt->p_values[pos] != NULL) {
-		/* The element was already set */
-		free(stmt->p_values[pos]);
-		stmt->p_values[pos] = NULL;
+	values = calloc(stmt->p_len + 1, sizeof(char *));
+	/* The formats follow the lengths in the same allocation */
+	lengths = calloc(2 * stmt->p_len + 1, sizeof(int));
+	if (values == NULL || lengths == NULL) {
+		free(values);
+		free(lengths);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
 	}
 
-	/* If the parameter is NULL, let the value to remain NULL */
-	if (argc < 2 || duk_is_null(ctx, 1)) {
-		stmt->p_values[pos] = NULL;
-	} else {
-		value = duk_to_string(ctx, 1);
-		stmt->p_values[pos] = malloc (strlen(value) * sizeof(char));
-		if (stmt->p_values[pos] == NULL)
+	for (i = 0; i < stmt->p_len; i++) {
+		if (stmt->p_values[i] == NULL)
+			continue;
+		if (stmt->p_formats[i] == BINARY_PARAMETER) {
+			values[i] = malloc(stmt->p_lengths[i] + 1);
+			if (values[i] != NULL)
+				memcpy(values[i], stmt->p_values[i], stmt->p_lengths[i]);
+		} else
+			values[i] = strdup(stmt->p_values[i]);
+		if (values[i] == NULL) {
+			while (i--)
+				free(values[i]);
+			free(values);
+			free(lengths);
 			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
-		strcpy(stmt->p_values[pos], value);
+		}
+		lengths[i] = stmt->p_lengths[i];
+		lengths[stmt->p_len + i] = stmt->p_formats[i];
 	}
+
+	stmt->batch[stmt->batch_len].values = values;
+	stmt->batch[stmt->batch_len].lengths = lengths;
+	stmt->batch[stmt->batch_len].formats = lengths + stmt->p_len;
+	stmt->batch_len++;
+
+	return 0;
 }
 
-static int set_statement(duk_context *ctx, const char *query, int argc)
+static int PgsqlPreparedStatement_clearBatch(duk_context *ctx)
 {
-	const char *nativeSQL;
-	int autoGeneratedKeys = NO_GENERATED_KEYS;
-	struct agk_columns *columns = NULL;
+	clear_batch(get_prepared_statement(ctx));
 
-	/* Call nativeSQL method on the connection object in the PreparedStatement given */
-	duk_get_prop_string(ctx, -1, "connection");
-	if (duk_is_undefined(ctx, -1)) {
-		duk_pop(ctx);
-		return 0;
+	return 0;
+}
+
+#ifdef HAVE_PQENTERPIPELINEMODE
+/**
+ * @brief Read the result of one pipelined command
+ *
+ * Returns the update count, or -1 if the command failed or was skipped
+ * because an earlier command failed. The first error message is pushed
+ * onto the stack and @failed is set.
+ */
+static int read_pipeline_result(duk_context *ctx, struct statement *stmt, int *failed)
+{
+	PGresult *res;
+	int count = -1;
+
+	res = PQgetResult(stmt->conn);
+	if (res == NULL) {
+		if (!*failed)
+			duk_push_string(ctx, PQerrorMessage(stmt->conn));
+		*failed = 1;
+		return -1;
 	}
 
-	duk_push_string(ctx, "nativeSQL");
-	duk_push_string(ctx, query);
-	duk_pcall_prop(ctx, -3, 1);
-	nativeSQL = duk_get_string(ctx, -1);
-	duk_pop(ctx);
+	switch (PQresultStatus(res)) {
+	case PGRES_COMMAND_OK:
+	case PGRES_TUPLES_OK:
+		count = atoi(PQcmdTuples(res));
+		break;
+	case PGRES_PIPELINE_ABORTED:
+		break;
+	default:
+		if (!*failed)
+			duk_push_string(ctx, PQresultErrorMessage(res));
+		*failed = 1;
+		break;
+	}
+	PQclear(res);
 
-	duk_get_prop_string(ctx, -1, "connection");
-	PGconn *conn = (PGconn *)duk_get_pointer(ctx, -1);
-	duk_pop(ctx);
-	if (conn == NULL)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "PGconn property is not set\n");
+	/* The result of every command is terminated by NULL */
+	while ((res = PQgetResult(stmt->conn)) != NULL)
+		PQclear(res);
 
-	if (argc == 2) {
-		if (duk_get_number(ctx, 1) == 1  || duk_get_boolean(ctx, 1) == 1)
-			autoGeneratedKeys = RETURN_GENERATED_KEYS;
-		else if (duk_is_array(ctx, 1)) {
-			if (get_columns_values(ctx, &columns) == 0)
-				duk_error(ctx, DUK_ERR_TYPE_ERROR, "Failed to extract column names/indexes\n");
-			else
-				autoGeneratedKeys = RETURN_GENERATED_KEYS;
+	return count;
+}
+
+/**
+ * @brief Synchronize the pipeline and discard the pending results
+ *
+ * This ends the implicit transaction of the batch, so an error reported
+ * here (for instance, a deferred constraint that is violated at commit
+ * time) fails the whole batch. The first error message is pushed onto
+ * the stack and @failed is set.
+ */
+static void sync_pipeline(duk_context *ctx, struct statement *stmt, int *failed)
+{
+	PGresult *res;
+	int nulls = 0;
+
+	if (!PQpipelineSync(stmt->conn)) {
+		if (!*failed)
+			duk_push_string(ctx, PQerrorMessage(stmt->conn));
+		*failed = 1;
+		return;
+	}
+
+	for (;;) {
+		res = PQgetResult(stmt->conn);
+
+		/* NULL separates the results of consecutive commands; two in
+		 * a row means there is nothing left to read */
+		if (res == NULL) {
+			if (++nulls > 1)
+				break;
+			continue;
+		}
+		nulls = 0;
+
+		switch (PQresultStatus(res)) {
+		case PGRES_PIPELINE_SYNC:
+			PQclear(res);
+			return;
+		case PGRES_COMMAND_OK:
+		case PGRES_TUPLES_OK:
+		case PGRES_PIPELINE_ABORTED:
+			break;
+		default:
+			if (!*failed)
+				duk_push_string(ctx, PQresultErrorMessage(res));
+			*failed = 1;
+			break;
 		}
+		PQclear(res);
 	}
 
-	struct statement *stmt = generate_statement(ctx, nativeSQL, autoGeneratedKeys);
-	if (stmt == NULL)
-		return 0;
+	if (!*failed)
+		duk_push_string(ctx, PQerrorMessage(stmt->conn));
+	*failed = 1;
+}
 
-	stmt->columns = columns;
-	stmt->conn = conn;
-	if (PQstatus(stmt->conn) != CONNECTION_OK) {
-		clear_statement(stmt);
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "Wrong connection status %s\n", PQerrorMessage(stmt->conn));
+/**
+ * @brief Execute the batch using libpq pipeline mode
+ *
+ * The statement is prepared once and then all parameter sets are sent
+ * without waiting for the individual results. To keep the socket buffers
+ * from filling up on both ends, the results are read back every
+ * POSTGRES_PIPELINE_DEPTH commands after a flush request. The pipeline
+ * is only synchronized once, at the end, so the whole batch runs in a
+ * single implicit transaction and either all commands take effect or
+ * none does.
+ */
+static void execute_batch(duk_context *ctx, struct statement *stmt, duk_idx_t arr_idx)
+{
+	unsigned int i, j, n, done = 0;
+	int count, sent, failed = 0, prepared = 0;
+
+	if (!PQenterPipelineMode(stmt->conn)) {
+		clear_batch(stmt);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", PQerrorMessage(stmt->conn));
 	}
 
-	/* Remove the connection object */
-	duk_pop(ctx);
+	sent = PQsendPrepare(stmt->conn, "", stmt->command, stmt->p_len, stmt->p_types);
+
+	for (i = 0; i < stmt->batch_len && sent && !failed; i += n) {
+		n = stmt->batch_len - i;
+		if (n > POSTGRES_PIPELINE_DEPTH)
+			n = POSTGRES_PIPELINE_DEPTH;
+
+		for (j = i; sent && j < i + n; j++)
+			sent = PQsendQueryPrepared(stmt->conn, "", stmt->p_len,
+					(const char **)stmt->batch[j].values, stmt->batch[j].lengths,
+					stmt->batch[j].formats, TEXT_RESULT);
+
+		/* Have the server send the results of the segment without
+		 * ending the implicit transaction */
+		sent = sent && PQsendFlushRequest(stmt->conn) && !PQflush(stmt->conn);
+		if (!sent)
+			break;
+
+		/* A failed prepare is not the fault of any parameter set */
+		if (i == 0 && read_pipeline_result(ctx, stmt, &failed) >= 0)
+			prepared = 1;
+
+		for (j = i; j < i + n && !failed; j++) {
+			count = read_pipeline_result(ctx, stmt, &failed);
+			if (failed)
+				break;
+			duk_push_int(ctx, count);
+			duk_put_prop_index(ctx, arr_idx, done++);
+		}
+	}
 
-	/* Add property to the given Statement object */
-	duk_push_pointer(ctx, (void *) stmt);
-	duk_put_prop_string(ctx, -2, "stmt");
+	if (!sent) {
+		duk_push_string(ctx, PQerrorMessage(stmt->conn));
+		failed = 1;
+	}
 
-	return 1;
-}
+	/* Also discards the results that were not read after a failure */
+	sync_pipeline(ctx, stmt, &failed);
 
-#if 0
+	PQexitPipelineMode(stmt->conn);
+	clear_batch(stmt);
 
-#if 0
+	if (failed && prepared && done < stmt->batch_len)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "Batch entry %u failed: %s", done + 1, duk_get_string(ctx, -1));
+	if (failed)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "Batch failed: %s", duk_get_string(ctx, -1));
+}
+#else
 /**
- * pretty_printer - internal function used for debugging
- * @stmt: pointer to the structure
+ * @brief Execute the batch one command at a time
+ *
+ * Unless a transaction is already in progress, the batch is wrapped in
+ * a transaction of its own, so that either all commands take effect or
+ * none does, as with pipeline mode.
  */
-static void pretty_printer(struct statement *stmt)
+static void execute_batch(duk_context *ctx, struct statement *stmt, duk_idx_t arr_idx)
 {
+	PGresult *res;
 	unsigned int i;
+	int own_transaction = PQtransactionStatus(stmt->conn) == PQTRANS_IDLE;
+
+	if (own_transaction) {
+		res = PQexec(stmt->conn, "BEGIN");
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			duk_push_string(ctx, PQresultErrorMessage(res));
+			PQclear(res);
+			clear_batch(stmt);
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
+		}
+		PQclear(res);
+	}
 
-	JS_Log(JS_LOG_INFO, "Statement type: %s | Parameters number %d\n",
-			(stmt->type == SIMPLE_STATEMENT)? "SIMPLE_STATEMENT":"PREPARED_STATEMENT",
-			stmt->p_len);
-	JS_Log(JS_LOG_INFO, "Statement :\"%s\"\n", stmt->command);
+	for (i = 0; i < stmt->batch_len; i++) {
+		res = PQexecParams(stmt->conn, stmt->command, stmt->p_len, stmt->p_types,
+				(const char **)stmt->batch[i].values, stmt->batch[i].lengths,
+				stmt->batch[i].formats, TEXT_RESULT);
+
+		if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+				PQresultStatus(res) != PGRES_TUPLES_OK) {
+			duk_push_string(ctx, PQresultErrorMessage(res));
+			PQclear(res);
+			if (own_transaction)
+				PQclear(PQexec(stmt->conn, "ROLLBACK"));
+			clear_batch(stmt);
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "Batch entry %u failed: %s", i + 1, duk_get_string(ctx, -1));
+		}
 
-	for (i = 0; i < stmt->p_len; i++) {
-		JS_Log(JS_LOG_INFO, "%d argument: %s\n", i + 1,
-				(stmt->p_values[i] == NULL)? "NULL":stmt->p_values[i]);
+		duk_push_int(ctx, atoi(PQcmdTuples(res)));
+		duk_put_prop_index(ctx, arr_idx, i);
+		PQclear(res);
 	}
 
-	if (stmt->autoGeneratedKeys == RETURN_GENERATED_KEYS && stmt->columns) {
-		if (stmt->columns->indexes) {
-			for (i = 0; i < stmt->columns->len; i++) {
-				JS_Log(JS_LOG_INFO, "Column index[%d] = %d\n", i, stmt->columns->indexes[i]);
-			}
+	clear_batch(stmt);
+
+	if (own_transaction) {
+		res = PQexec(stmt->conn, "COMMIT");
+		if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+			duk_push_string(ctx, PQresultErrorMessage(res));
+			PQclear(res);
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "Batch failed: %s", duk_get_string(ctx, -1));
+		}
+		PQclear(res);
+	}
+}
+#endif
+
+/**
+ * @brief Execute all parameter sets added by addBatch()
+ *
+ * Returns an array with the update count of each command. The batch is
+ * atomic: outside of a transaction, it runs in a transaction of its own,
+ * so if any command fails, none of them takes effect and the error names
+ * the first failed entry. Inside a transaction, the failure aborts that
+ * transaction as usual.
+ *
+ * The batch is cleared afterwards, whether the execution succeeded or
+ * not. execute_batch() is responsible for clearing it, since it may throw.
+ */
+static int PgsqlPreparedStatement_executeBatch(duk_context *ctx)
+{
+	struct statement *stmt = get_prepared_statement(ctx);
+	duk_idx_t arr_idx;
+
+	clear_result(stmt);
+
+	arr_idx = duk_push_array(ctx);
+
+	if (stmt->batch_len)
+		execute_batch(ctx, stmt, arr_idx);
+
+	return 1;
+}
+
+/**
+ * @brief Describe the parameters of the prepared statement
+ *
+ * Returns {parameterCount, parameters}, where every parameter has the
+ * type OID and typeName inferred by the server. The statement is
+ * described once, with an unnamed prepared statement, and the same
+ * object is returned afterwards.
+ */
+static int PgsqlPreparedStatement_getParameterMetaData(duk_context *ctx)
+{
+	struct statement *stmt;
+	struct column_info info;
+	PGresult *res;
+	int i, n;
+
+	if (push_cached(ctx, "parameterMetaData"))
+		return 1;
+
+	stmt = get_prepared_statement(ctx);
+	if (stmt->result && stmt->result->stream_active)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The connection is busy with a streamed result");
+
+	res = PQprepare(stmt->conn, "", stmt->command, 0, NULL);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+		PQclear(res);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", PQerrorMessage(stmt->conn));
+	}
+	PQclear(res);
+
+	res = PQdescribePrepared(stmt->conn, "");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+		PQclear(res);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", PQerrorMessage(stmt->conn));
+	}
+
+	n = PQnparams(res);
+
+	duk_push_object(ctx);
+	duk_push_int(ctx, n);
+	duk_put_prop_string(ctx, -2, "parameterCount");
+
+	duk_push_array(ctx);
+	for (i = 0; i < n; i++) {
+		describe_type(&info, PQparamtype(res, i), -1);
+		info.name = NULL;
+		push_column_info(ctx, &info);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	duk_put_prop_string(ctx, -2, "parameters");
+	PQclear(res);
+
+	cache_value(ctx, "parameterMetaData");
+	return 1;
+}
+
+/* {{{ Array parameters */
+
+struct array_type {
+	const char *name;
+	Oid element;
+	Oid array;
+	/* size of the binary representation, 0 to send the array as text */
+	int size;
+	int is_float;
+};
+
+static const struct array_type array_types[] = {
+	{"int2",		21,	1005,	2,	0},
+	{"smallint",		21,	1005,	2,	0},
+	{"int4",		23,	1007,	4,	0},
+	{"int",			23,	1007,	4,	0},
+	{"integer",		23,	1007,	4,	0},
+	{"int8",		20,	1016,	8,	0},
+	{"bigint",		20,	1016,	8,	0},
+	{"float4",		700,	1021,	4,	1},
+	{"real",		700,	1021,	4,	1},
+	{"float8",		701,	1022,	8,	1},
+	{"double precision",	701,	1022,	8,	1},
+	{"bool",		16,	1000,	0,	0},
+	{"boolean",		16,	1000,	0,	0},
+	{"text",		25,	1009,	0,	0},
+	{"varchar",		1043,	1015,	0,	0},
+	{"numeric",		1700,	1231,	0,	0},
+	{"uuid",		2950,	2951,	0,	0},
+	{"date",		1082,	1182,	0,	0},
+	{"timestamp",		1114,	1115,	0,	0},
+	{"timestamptz",		1184,	1185,	0,	0},
+	{NULL,			0,	0,	0,	0}
+};
+
+/* Any other element type is sent as text and inferred by the server */
+static const struct array_type untyped_array = {NULL, 0, 0, 0, 0};
+
+static const struct array_type *find_array_type(const char *name)
+{
+	const struct array_type *type;
+
+	for (type = array_types; type->name; type++)
+		if (!strcasecmp(type->name, name))
+			return type;
+
+	return &untyped_array;
+}
+
+/**
+ * @brief Pick the element type for an array without an explicit one
+ *
+ * Arrays of integers are sent as int8[], other numeric arrays as
+ * float8[] and anything else as text with the type left to the server.
+ */
+static const struct array_type *infer_array_type(duk_context *ctx, duk_size_t len)
+{
+	const char *name = "int8";
+	duk_size_t i;
+	double value;
+
+	for (i = 0; i < len; i++) {
+		duk_get_prop_index(ctx, 1, i);
+		if (duk_is_number(ctx, -1)) {
+			value = duk_get_number(ctx, -1);
+			/* Check the range before comparing with the integer part, so
+			 * that NaN and infinities are never converted */
+			if (!isfinite(value) || fabs(value) > 9007199254740992.0 ||
+					value != trunc(value))
+				name = "float8";
+		} else if (!duk_is_null_or_undefined(ctx, -1)) {
+			duk_pop(ctx);
+			return &untyped_array;
+		}
+		duk_pop(ctx);
+	}
+
+	return find_array_type(name);
+}
+
+static void put_uint32(char *p, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(p, &value, 4);
+}
+
+static void put_uint64(char *p, uint64_t value)
+{
+	put_uint32(p, value >> 32);
+	put_uint32(p + 4, value & 0xffffffff);
+}
+
+/**
+ * @brief Encode the array at index 1 in the binary array format
+ *
+ * The format is a header (number of dimensions, null flag, element type,
+ * then size and lower bound of each dimension) followed by each element
+ * as a 32-bit length (-1 for NULL) and the big endian value.
+ */
+static char *encode_binary_array(duk_context *ctx, const struct array_type *type,
+		duk_size_t len, int *size)
+{
+	char *buf, *p;
+	double value;
+	int64_t ival;
+	uint32_t f4;
+	uint64_t f8;
+	duk_size_t i;
+	int has_null = 0;
+
+	buf = malloc(20 + len * (4 + type->size));
+	if (buf == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
+
+	p = buf + (len ? 20 : 12);
+	for (i = 0; i < len; i++) {
+		duk_get_prop_index(ctx, 1, i);
+		if (duk_is_null_or_undefined(ctx, -1)) {
+			duk_pop(ctx);
+			put_uint32(p, (uint32_t)-1);
+			p += 4;
+			has_null = 1;
+			continue;
+		}
+
+		if (!duk_is_number(ctx, -1)) {
+			free(buf);
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "Array element %lu is not a number\n", (unsigned long)i);
+		}
+		value = duk_get_number(ctx, -1);
+		duk_pop(ctx);
+
+		put_uint32(p, type->size);
+		p += 4;
+
+		if (type->is_float && type->size == 4) {
+			float f = (float)value;
+			memcpy(&f4, &f, 4);
+			put_uint32(p, f4);
+		} else if (type->is_float) {
+			memcpy(&f8, &value, 8);
+			put_uint64(p, f8);
 		} else {
-			for (i = 0; i < stmt->columns->len; i++) {
-				JS_Log(JS_LOG_INFO, "Column name[%d] = %s\n", i, stmt->columns->names[i]);
+			/* Converting a value outside the int64_t range (or NaN) is
+			 * undefined behaviour, so check the range first */
+			if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0)) {
+				free(buf);
+				duk_error(ctx, DUK_ERR_RANGE_ERROR, "Array element %lu is not a valid %s\n",
+						(unsigned long)i, type->name);
 			}
+			ival = (int64_t)value;
+			if ((double)ival != value || (type->size == 2 && (ival < INT16_MIN || ival > INT16_MAX)) ||
+					(type->size == 4 && (ival < INT32_MIN || ival > INT32_MAX))) {
+				free(buf);
+				duk_error(ctx, DUK_ERR_RANGE_ERROR, "Array element %lu is not a valid %s\n",
+						(unsigned long)i, type->name);
+			}
+			if (type->size == 2) {
+				uint16_t i2 = htons((uint16_t)ival);
+				memcpy(p, &i2, 2);
+			} else if (type->size == 4)
+				put_uint32(p, (uint32_t)ival);
+			else
+				put_uint64(p, (uint64_t)ival);
+		}
+		p += type->size;
+	}
+
+	/* An empty array has no dimensions */
+	put_uint32(buf, len ? 1 : 0);
+	put_uint32(buf + 4, has_null);
+	put_uint32(buf + 8, type->element);
+	if (len) {
+		put_uint32(buf + 12, len);
+		put_uint32(buf + 16, 1);
+	}
+
+	*size = p - buf;
+	return buf;
+}
+
+/**
+ * @brief Encode the array at index 1 as an array literal
+ *
+ * All elements are double-quoted, so that they can contain commas,
+ * braces and spaces; quotes and backslashes are escaped.
+ */
+static char *encode_text_array(duk_context *ctx, duk_size_t len)
+{
+	const char *value, *v;
+	char *buf, *p;
+	size_t size = 3;
+	duk_size_t i;
+	duk_idx_t first = duk_get_top(ctx);
+
+	/* Convert the elements once; they are kept on the stack */
+	for (i = 0; i < len; i++) {
+		duk_get_prop_index(ctx, 1, i);
+		if (duk_is_null_or_undefined(ctx, -1)) {
+			size += 5;
+			continue;
+		}
+		value = duk_to_string(ctx, -1);
+		for (v = value; *v; v++)
+			size += (*v == '"' || *v == '\\') ? 2 : 1;
+		size += 3;
+	}
+
+	buf = malloc(size);
+	if (buf == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
+
+	p = buf;
+	*p++ = '{';
+	for (i = 0; i < len; i++) {
+		if (i)
+			*p++ = ',';
+		if (duk_is_null_or_undefined(ctx, first + i)) {
+			memcpy(p, "NULL", 4);
+			p += 4;
+			continue;
 		}
+		*p++ = '"';
+		for (v = duk_get_string(ctx, first + i); *v; v++) {
+			if (*v == '"' || *v == '\\')
+				*p++ = '\\';
+			*p++ = *v;
+		}
+		*p++ = '"';
 	}
+	*p++ = '}';
+	*p = '\0';
+
+	duk_set_top(ctx, first);
+
+	return buf;
 }
 
 /**
- * result_pretty_printer - internal function used for debugging
- * @stmt: pointer to the structure
+ * @brief Bind a JS array as an array parameter
+ *
+ * setArray(position, array[, elementType]) lets a single statement such
+ * as "... where id = ANY(?)" be reused for lists of any size. Arrays of
+ * int2/int4/int8/float4/float8 are sent in binary; other element types
+ * are sent as an array literal. Without an element type, integer arrays
+ * are sent as int8[] and float arrays as float8[].
  */
-static void result_pretty_printer(struct statement *stmt)
+static int PgsqlPreparedStatement_setArray(duk_context *ctx)
 {
-	PQprint(stdout, stmt->result, NULL);
-}
-#endif
+	const struct array_type *type = NULL;
+	struct statement *stmt;
+	duk_size_t len;
+	char *value;
+	int pos, size = 0;
 
-#endif
+	if (duk_get_top(ctx) < 2)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Wrong number of arguments");
 
-static int PgsqlResultSet_getNumber(duk_context *ctx)
-{
-	char *value = get_value_from_index(ctx);
-	char *pEnd;
-	double value_to_double;
+	if (!duk_is_number(ctx, 0))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The first parameter should be a \
+			number which represents the position of the parameter");
 
-	if (value == NULL) {
-		duk_push_number(ctx, 0);
+	if (!duk_is_array(ctx, 1) && !duk_is_null(ctx, 1))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The value is not an array!\n");
+
+	if (duk_is_string(ctx, 2))
+		type = find_array_type(duk_get_string(ctx, 2));
+	duk_set_top(ctx, 2);
+
+	stmt = get_prepared_statement(ctx);
+
+	pos = duk_get_int(ctx, 0);
+	if (pos > stmt->p_len || pos < 1)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The position is incorrect!");
+	pos--;
+
+	if (duk_is_null(ctx, 1)) {
+		duk_set_top(ctx, 2);
+		set_parameter(ctx);
+		return 0;
 	}
 
-	value_to_double = strtod(value, &pEnd);
+	len = duk_get_length(ctx, 1);
+	if (type == NULL)
+		type = infer_array_type(ctx, len);
 
-	duk_push_number(ctx, value_to_double);
-	return 1;
+	if (type->size)
+		value = encode_binary_array(ctx, type, len, &size);
+	else
+		value = encode_text_array(ctx, len);
+
+	free(stmt->p_values[pos]);
+	stmt->p_values[pos] = value;
+	stmt->p_types[pos] = type->array;
+	stmt->p_lengths[pos] = size;
+	stmt->p_formats[pos] = type->size ? BINARY_PARAMETER : TEXT_PARAMETER;
+
+	return 0;
 }
 
-static int PgsqlResultSet_getString(duk_context *ctx)
+/* }}} Array parameters */
+
+static duk_function_list_entry PgsqlPreparedStatement_functions[] = {
+	{"addBatch",		PgsqlPreparedStatement_addBatch,		0},
+	{"clearBatch",		PgsqlPreparedStatement_clearBatch,		0},
+	{"executeBatch",	PgsqlPreparedStatement_executeBatch,		0},
+	{"setNumber",		PgsqlPreparedStatement_setNumber,			2},
+	{"setString",	PgsqlPreparedStatement_setString,		2},
+	{"setArray",		PgsqlPreparedStatement_setArray,		DUK_VARARGS},
+	{"getParameterMetaData",	PgsqlPreparedStatement_getParameterMetaData,	0},
+	{NULL,			NULL, 						0}
+};
+
+static int PgsqlConnection_createStatement(duk_context *ctx)
 {
-	char *value = get_value_from_index(ctx);
-	duk_push_string(ctx, value);
+	/* Create PostgreSQL Statement object */
+	duk_push_object(ctx);
+
+	duk_get_global_string(ctx, "PgsqlStatement");
+	duk_set_prototype(ctx, -2);
+
+	/* Add connection property */
+	duk_push_this(ctx);
+	duk_put_prop_string(ctx, -2, "connection");
+
 	return 1;
 }
 
-static int PgsqlResultSet_next(duk_context *ctx)
+static int PgsqlConnection_prepareStatement(duk_context *ctx)
 {
-	struct statement *stmt;
 	int argc = duk_get_top(ctx);
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
+	if (argc < 1 || argc > 2)
+		return DUK_RET_ERROR;
 
-	if (stmt == NULL) {
-		duk_push_false(ctx);
-		return 1;
-	}
+	/* Create MySQL Prepared Statement object */
+	duk_push_object(ctx);
 
-	if (argc != 0) {
-		duk_push_false(ctx);
-		return 1;
-	}
+	duk_get_global_string(ctx, "PgsqlPreparedStatement");
+	duk_set_prototype(ctx, -2);
+
+	/* Add connection property */
+	duk_push_this(ctx);
+	duk_put_prop_string(ctx, -2, "connection");
 
-	stmt->row_index += 1;
 
-	if (stmt->row_index < 0 || stmt->row_index >= PQntuples(stmt->result)) {
-		duk_push_false(ctx);
-		return 1;
+	/* set_statement uses the duktape stack for the PreparedStatement object
+	and receives also the query and the number of arguments as a normal param.
+	It will simply add the statement struct as a property to the Statement object. */
+	if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
+		/* TODO error */
+		return DUK_RET_ERROR;
 	}
 
-	duk_push_true(ctx);
 	return 1;
 }
 
-static int PgsqlResultSet_first(duk_context *ctx)
+static int PgsqlConnection_nativeSQL(duk_context *ctx)
 {
-	struct statement *stmt;
 	int argc = duk_get_top(ctx);
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
-
-	if (stmt == NULL) {
-		duk_push_false(ctx);
-		return 1;
-	}
+	if (argc != 1)
+		return DUK_RET_ERROR;
 
-	if (argc != 0) {
-		duk_push_false(ctx);
-		return 1;
-	}
+	duk_to_string(ctx, 0);
 
-	stmt->row_index = 0;
+	/* duk_to_string also replaces the value at idx with ToString(val) */
+	duk_dup(ctx, 0);
 
-	duk_push_true(ctx);
 	return 1;
 }
 
-static int PgsqlResultSet_last(duk_context *ctx)
-{
-	struct statement *stmt;
-	int argc = duk_get_top(ctx);
+/* {{{ COPY support */
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
+#define COPY_TEXT	0
+#define COPY_CSV	1
+#define COPY_BINARY	2
 
-	if (stmt == NULL) {
-		duk_push_false(ctx);
-		return 1;
-	}
+struct copy_state {
+	PGconn *conn;
+	int format;
+	char delimiter;
+	char quote;
+	const char *null;
+	int header_sent;
+	char *buf;
+	size_t len;
+};
 
-	if (argc != 0) {
-		duk_push_false(ctx);
-		return 1;
-	}
+static const char copy_binary_header[] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
 
-	stmt->row_index = PQntuples(stmt->result) - 1;
+static PGconn *get_connection(duk_context *ctx)
+{
+	PGconn *conn;
 
-	duk_push_true(ctx);
-	return 1;
+	duk_push_this(ctx);
+	duk_get_prop_string(ctx, -1, "connection");
+	conn = duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+
+	if (conn == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "PGconn property is not set\n");
+
+	return conn;
 }
 
-static int PgsqlResultSet_finalize(duk_context *ctx)
+/**
+ * @brief Get a single character COPY option
+ *
+ * Returns the default value if the option is not set.
+ */
+static char copy_char_option(duk_context *ctx, duk_idx_t idx, const char *key, char def)
 {
-	struct statement *stmt;
-	duk_get_prop_string(ctx, 0, "stmt");
-	if (!duk_is_undefined(ctx, -1)) {
-		stmt = duk_get_pointer(ctx, -1);
+	duk_size_t len;
+	const char *value;
 
-		if (stmt && stmt->result) {
-			PQclear(stmt->result);
-			stmt->result = NULL;
-		}
+	if (!duk_get_prop_string(ctx, idx, key)) {
+		duk_pop(ctx);
+		return def;
 	}
 
-	printf("in finalize la result set: ");
-	return 0;
-}
+	value = duk_get_lstring(ctx, -1, &len);
+	if (value == NULL || len != 1)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "The %s option must be a single character\n", key);
+	duk_pop(ctx);
 
-static duk_function_list_entry PgsqlResultSet_functions[] = {
-	{"getNumber",	PgsqlResultSet_getNumber,	1},
-	{"getString",	PgsqlResultSet_getString,	1},
-	{"next",	PgsqlResultSet_next,		0},
-	{"first",	PgsqlResultSet_first,		0},
-	{"last",	PgsqlResultSet_last,		0},
-	{NULL,		NULL, 				0}
-};
+	return value[0];
+}
 
-static int PgsqlStatement_execute(duk_context *ctx)
+/**
+ * @brief Read the options of copyIn() into the COPY state
+ *
+ * libpq only tells text and binary apart, so the format, delimiter,
+ * quote and NULL string used by the COPY command must be passed
+ * explicitly by the caller. They must match the options of the command.
+ *
+ * The value of the null option (or undefined) is left on the stack, so
+ * that the NULL string stays alive until the COPY is done.
+ */
+static void copy_options(duk_context *ctx, duk_idx_t idx, struct copy_state *cs)
 {
-	struct statement *stmt;
-	int argc = duk_get_top(ctx);
-
-	if (argc < 0 || argc > 2)
-			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Wrong number of arguments\n");
+	const char *format = "text";
 
-	if (argc > 0) {
-		/* if there is an old statement clear the memory */
-		duk_push_this(ctx);
-		duk_get_prop_string(ctx, -1, "stmt");
-		stmt = duk_get_pointer(ctx, -1);
-		if (stmt)
-			clear_statement(stmt);
+	cs->format = COPY_TEXT;
+	cs->delimiter = '\t';
+	cs->quote = '"';
+	cs->null = "\\N";
 
-		duk_push_this(ctx);
-		if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
-			/* TODO error */
-			return DUK_RET_ERROR;
-		}
+	if (duk_is_null_or_undefined(ctx, idx)) {
+		duk_push_undefined(ctx);
+		return;
 	}
+	if (!duk_is_object(ctx, idx))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "The options must be an object");
+
+	if (duk_get_prop_string(ctx, idx, "format"))
+		format = duk_safe_to_string(ctx, -1);
+	if (!strcasecmp(format, "csv")) {
+		cs->format = COPY_CSV;
+		cs->delimiter = ',';
+		cs->null = "";
+	} else if (!strcasecmp(format, "binary"))
+		cs->format = COPY_BINARY;
+	else if (strcasecmp(format, "text"))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "Unknown COPY format: %s\n", format);
+	duk_pop(ctx);
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
-	if (stmt == NULL)
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The statement property is not set\n");
-
-	if (execute_statement(ctx, argc, stmt))
-		duk_push_true(ctx);
-	else
-		duk_push_false(ctx);
+	cs->delimiter = copy_char_option(ctx, idx, "delimiter", cs->delimiter);
+	cs->quote = copy_char_option(ctx, idx, "quote", cs->quote);
 
-	return 1;
+	duk_get_prop_string(ctx, idx, "null");
+	if (!duk_is_undefined(ctx, -1))
+		cs->null = duk_require_string(ctx, -1);
 }
 
-static int PgsqlStatement_executeQuery(duk_context *ctx)
+static int copy_flush(struct copy_state *cs)
 {
-	int argc = duk_get_top(ctx);
-	struct statement *stmt;
+	if (cs->len && PQputCopyData(cs->conn, cs->buf, cs->len) != 1)
+		return -1;
 
-	/* if it is a simple statement set the SQL command*/
-	if (argc == 1) {
-		duk_push_this(ctx);
-		duk_get_prop_string(ctx, -1, "stmt");
-		stmt = duk_get_pointer(ctx, -1);
-		if (stmt)
-			clear_statement(stmt);
+	cs->len = 0;
+	return 0;
+}
 
-		duk_push_this(ctx);
-		if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
-			/* TODO error */
-			return DUK_RET_ERROR;
-		}
+static int copy_write(struct copy_state *cs, const char *data, size_t len)
+{
+	if (cs->len + len > POSTGRES_COPY_BUFFER_SIZE) {
+		if (copy_flush(cs))
+			return -1;
+		if (len > POSTGRES_COPY_BUFFER_SIZE)
+			return PQputCopyData(cs->conn, data, len) == 1 ? 0 : -1;
 	}
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
-	if (stmt == NULL) {
-		duk_push_null(ctx);
-		return 1;
-	}
+	memcpy(cs->buf + cs->len, data, len);
+	cs->len += len;
 
-	if (!execute_statement(ctx, argc, stmt)) {
-		if(stmt)
-			clear_statement(stmt);
-		duk_push_null(ctx);
-		return 1;
-	}
+	return 0;
+}
 
-	/* Create PostgreSQL Result Set object */
-	duk_push_object(ctx);
+/**
+ * @brief Write one field in text or CSV format, escaping as needed
+ *
+ * CSV fields are always quoted, and quotes are escaped by doubling them,
+ * so the ESCAPE option of the command must be left at its default.
+ */
+static int copy_write_text(struct copy_state *cs, const char *data, size_t len)
+{
+	char special[5] = {'\\', '\t', '\n', '\r', cs->delimiter};
+	size_t nspecial = cs->format == COPY_CSV ? 1 : sizeof(special);
+	const char *end = data + len;
+	char esc[2];
+	size_t span;
+
+	if (cs->format == COPY_CSV) {
+		special[0] = cs->quote;
+		if (copy_write(cs, &cs->quote, 1))
+			return -1;
+	}
 
-	duk_get_global_string(ctx, "PgsqlResultSet");
-	duk_set_prototype(ctx, -2);
+	while (data < end) {
+		for (span = 0; data + span < end && !memchr(special, data[span], nspecial); span++)
+			;
+		if (span && copy_write(cs, data, span))
+			return -1;
+		data += span;
+		if (data == end)
+			break;
+
+		if (cs->format == COPY_CSV) {
+			esc[0] = esc[1] = cs->quote;
+		} else {
+			esc[0] = '\\';
+			switch (*data) {
+			case '\t':
+				esc[1] = 't';
+				break;
+			case '\n':
+				esc[1] = 'n';
+				break;
+			case '\r':
+				esc[1] = 'r';
+				break;
+			default:
+				esc[1] = *data;
+			}
+		}
+		if (copy_write(cs, esc, 2))
+			return -1;
+		data++;
+	}
 
-	duk_push_pointer(ctx, (void *) stmt);
-	duk_put_prop_string(ctx, -2, "stmt");
+	if (cs->format == COPY_CSV && copy_write(cs, &cs->quote, 1))
+		return -1;
 
-	return 1;
+	return 0;
 }
 
-static int PgsqlStatement_executeUpdate(duk_context *ctx)
+/**
+ * @brief Encode one row, given as a JS array, in the COPY format
+ *
+ * In text and CSV format, values are converted to strings. In binary
+ * format, the server expects the binary representation of each column
+ * type, which cannot be derived from JS values; only strings and buffers
+ * are accepted, and they are sent as they are.
+ *
+ * Returns NULL on success or an error message.
+ */
+static const char *copy_row(duk_context *ctx, struct copy_state *cs, duk_idx_t idx)
 {
-	int argc = duk_get_top(ctx);
-	struct statement *stmt;
+	duk_size_t i, n, len;
+	const char *data;
+	uint32_t field_len;
+	uint16_t field_count;
 
-	if (argc < 0 || argc > 2)
-		return DUK_RET_ERROR;
+	if (!duk_is_array(ctx, idx))
+		return "Rows must be arrays";
+
+	n = duk_get_length(ctx, idx);
+
+	if (cs->format == COPY_BINARY) {
+		if (!cs->header_sent && copy_write(cs, copy_binary_header, sizeof(copy_binary_header) - 1))
+			return PQerrorMessage(cs->conn);
+		cs->header_sent = 1;
+
+		field_count = htons(n);
+		if (copy_write(cs, (char *)&field_count, 2))
+			return PQerrorMessage(cs->conn);
+	}
 
-	if (argc > 0) {
-		duk_push_this(ctx);
-		duk_get_prop_string(ctx, -1, "stmt");
-		stmt = duk_get_pointer(ctx, -1);
-		if (stmt)
-			clear_statement(stmt);
+	for (i = 0; i < n; i++) {
+		duk_get_prop_index(ctx, idx, i);
 
-		duk_push_this(ctx);
-		if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
-			/* TODO error */
-			return DUK_RET_ERROR;
+		if (duk_is_null_or_undefined(ctx, -1)) {
+			data = NULL;
+			len = 0;
+		} else if (duk_is_buffer_data(ctx, -1)) {
+			data = duk_get_buffer_data(ctx, -1, &len);
+		} else if (cs->format == COPY_BINARY && !duk_is_string(ctx, -1)) {
+			duk_pop(ctx);
+			return "Binary COPY only accepts strings and buffers as values";
+		} else if (duk_is_boolean(ctx, -1)) {
+			data = duk_get_boolean(ctx, -1) ? "t" : "f";
+			len = 1;
+		} else {
+			data = duk_safe_to_string(ctx, -1);
+			len = strlen(data);
 		}
-	}
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
-	if (stmt == NULL) {
-		duk_push_number(ctx, -1);
-		return 1;
+		if (cs->format == COPY_BINARY) {
+			field_len = htonl(data ? len : (uint32_t)-1);
+			if (copy_write(cs, (char *)&field_len, 4) || (data && copy_write(cs, data, len)))
+				break;
+		} else {
+			if (i && copy_write(cs, &cs->delimiter, 1))
+				break;
+			if (data == NULL && copy_write(cs, cs->null, strlen(cs->null)))
+				break;
+			if (data && copy_write_text(cs, data, len))
+				break;
+		}
+
+		duk_pop(ctx);
 	}
 
-	if (!execute_statement(ctx, argc, stmt)) {
-		if(stmt)
-			clear_statement(stmt);
-		duk_push_number(ctx, -1);
-		return 1;
+	if (i < n) {
+		duk_pop(ctx);
+		return PQerrorMessage(cs->conn);
 	}
 
-	duk_push_number(ctx, atoi(PQcmdTuples(stmt->result)));
-	return 1;
+	if (cs->format != COPY_BINARY && copy_write(cs, "\n", 1))
+		return PQerrorMessage(cs->conn);
+
+	return NULL;
 }
 
-static int PgsqlStatement_getConnection(duk_context *ctx)
+static const char *copy_chunk(duk_context *ctx, struct copy_state *cs, duk_idx_t idx)
 {
-	duk_push_this(ctx);
+	duk_size_t len;
+	const char *data;
 
-	duk_get_prop_string(ctx, -1, "connection");
+	if (duk_is_buffer_data(ctx, idx))
+		data = duk_get_buffer_data(ctx, idx, &len);
+	else
+		data = duk_get_lstring(ctx, idx, &len);
 
-	return 1;
+	return copy_write(cs, data, len) ? PQerrorMessage(cs->conn) : NULL;
 }
 
-static int PgsqlStatement_getGeneratedKeys(duk_context *ctx)
+static const char *copy_file(struct copy_state *cs, const char *path)
 {
-	struct statement *stmt;
+	int fd = open(path, O_RDONLY);
+	ssize_t len;
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
+	if (fd < 0)
+		return strerror(errno);
 
-	if (stmt == NULL) {
-		duk_push_null(ctx);
-		return 1;
+	if (copy_flush(cs)) {
+		close(fd);
+		return PQerrorMessage(cs->conn);
 	}
 
-	if (stmt->autoGeneratedKeys != RETURN_GENERATED_KEYS) {
-		duk_push_null(ctx);
-		return 1;
+	while ((len = read(fd, cs->buf, POSTGRES_COPY_BUFFER_SIZE)) > 0) {
+		if (PQputCopyData(cs->conn, cs->buf, len) != 1) {
+			close(fd);
+			return PQerrorMessage(cs->conn);
+		}
 	}
 
-	duk_push_object(ctx);
-
-	duk_get_global_string(ctx, "PgsqlResultSet");
-	duk_set_prototype(ctx, -2);
-
-	duk_push_pointer(ctx, (void *) stmt);
-	duk_put_prop_string(ctx, -2, "stmt");
-
-	return 1;
+	close(fd);
+	return len < 0 ? strerror(errno) : NULL;
 }
 
-static int PgsqlStatement_getResultSet(duk_context *ctx)
+/**
+ * @brief Bulk load data with COPY ... FROM STDIN
+ *
+ * The source can be:
+ *   - an array of rows, each row being an array of values;
+ *   - a function that is called repeatedly and returns either a row, a
+ *     string or buffer with data that is already encoded in the COPY
+ *     format, or null/undefined when there is no more data;
+ *   - the path of a local file, whose contents are sent as they are.
+ *
+ * The optional third argument describes how rows are encoded, and must
+ * match the options of the COPY command:
+ *   - format: "text" (default), "csv" or "binary";
+ *   - delimiter: the column separator, a tab in text format and a comma
+ *     in CSV format by default;
+ *   - quote: the CSV quote character, a double quote by default;
+ *   - null: the string written for NULL values, \N in text format and an
+ *     unquoted empty string in CSV format by default.
+ *
+ * In binary format, the file header and trailer are always sent when the
+ * source is an array, even if it is empty; a function that only returns
+ * already encoded data must produce them itself. If an error occurs, the
+ * COPY is aborted so that the connection remains usable. Returns the
+ * number of rows loaded.
+ */
+static int PgsqlConnection_copyIn(duk_context *ctx)
 {
-	struct statement *stmt;
-
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
-
-	if (stmt == NULL) {
-		duk_push_null(ctx);
-		return 1;
+	struct copy_state cs;
+	PGresult *res;
+	const char *sql, *error = NULL;
+	duk_size_t i, n;
+	int rc, rows, binary;
+
+	if (duk_get_top(ctx) < 2 || duk_get_top(ctx) > 3)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Wrong number of arguments\n");
+	duk_set_top(ctx, 3);
+
+	memset(&cs, 0, sizeof(cs));
+	cs.conn = get_connection(ctx);
+	sql = duk_safe_to_string(ctx, 0);
+	copy_options(ctx, 2, &cs);
+
+	res = PQexec(cs.conn, sql);
+	if (PQresultStatus(res) != PGRES_COPY_IN) {
+		duk_push_string(ctx, PQresultErrorMessage(res));
+		PQclear(res);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
 	}
 
-	duk_push_object(ctx);
+	binary = PQbinaryTuples(res);
+	PQclear(res);
+
+	cs.buf = malloc(POSTGRES_COPY_BUFFER_SIZE);
+	if (cs.buf == NULL)
+		error = "Failed to allocate memory";
+	else if (binary != (cs.format == COPY_BINARY))
+		error = "The format option does not match the COPY command";
+	else if (duk_is_array(ctx, 1)) {
+		if (cs.format == COPY_BINARY) {
+			if (copy_write(&cs, copy_binary_header, sizeof(copy_binary_header) - 1))
+				error = PQerrorMessage(cs.conn);
+			cs.header_sent = 1;
+		}
+		n = duk_get_length(ctx, 1);
+		for (i = 0; i < n && !error; i++) {
+			duk_get_prop_index(ctx, 1, i);
+			error = copy_row(ctx, &cs, -1);
+			duk_pop(ctx);
+		}
+	} else if (duk_is_function(ctx, 1)) {
+		for (;;) {
+			duk_dup(ctx, 1);
+			if (duk_pcall(ctx, 0) != DUK_EXEC_SUCCESS) {
+				/* Abort the COPY and rethrow the original error */
+				PQputCopyEnd(cs.conn, duk_safe_to_string(ctx, -1));
+				while ((res = PQgetResult(cs.conn)) != NULL)
+					PQclear(res);
+				free(cs.buf);
+				duk_throw(ctx);
+			}
+			if (duk_is_null_or_undefined(ctx, -1)) {
+				duk_pop(ctx);
+				break;
+			}
+			if (duk_is_array(ctx, -1))
+				error = copy_row(ctx, &cs, -1);
+			else
+				error = copy_chunk(ctx, &cs, -1);
+			duk_pop(ctx);
+			if (error)
+				break;
+		}
+	} else if (duk_is_string(ctx, 1)) {
+		error = copy_file(&cs, duk_get_string(ctx, 1));
+	} else
+		error = "The source must be an array, a function or a file name";
+
+	if (!error && cs.header_sent && copy_write(&cs, "\377\377", 2))
+		error = PQerrorMessage(cs.conn);
+	if (!error && copy_flush(&cs))
+		error = PQerrorMessage(cs.conn);
+
+	if (error)
+		duk_push_string(ctx, error);
+	free(cs.buf);
+
+	rc = PQputCopyEnd(cs.conn, error);
+	res = PQgetResult(cs.conn);
+	if (!error && (rc != 1 || PQresultStatus(res) != PGRES_COMMAND_OK)) {
+		duk_push_string(ctx, PQerrorMessage(cs.conn));
+		error = duk_get_string(ctx, -1);
+	}
+	rows = atoi(PQcmdTuples(res));
+	PQclear(res);
 
-	duk_get_global_string(ctx, "PgsqlResultSet");
-	duk_set_prototype(ctx, -2);
+	while ((res = PQgetResult(cs.conn)) != NULL)
+		PQclear(res);
 
-	duk_push_pointer(ctx, (void *) stmt);
-	duk_put_prop_string(ctx, -2, "stmt");
+	if (error)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
 
+	duk_push_int(ctx, rows);
 	return 1;
 }
 
-static int PgsqlStatement_getUpdateCount(duk_context *ctx)
+/**
+ * @brief Pass the buffered COPY data to the sink
+ *
+ * If the sink is a file descriptor, the data is written directly.
+ * Otherwise, the sink function is called with the data as a string (or
+ * a buffer, for the binary format). Any error is left on the stack.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+static int copy_out_flush(duk_context *ctx, struct copy_state *cs, int fd)
 {
-	struct statement *stmt;
+	void *data;
 
-	duk_push_this(ctx);
-	duk_get_prop_string(ctx, -1, "stmt");
-	stmt = duk_get_pointer(ctx, -1);
+	if (!cs->len)
+		return 0;
 
-	if (stmt == NULL || stmt->result == NULL) {
-		duk_push_number(ctx, -1);
-		return 1;
+	if (fd >= 0) {
+		if (write_all(fd, cs->buf, cs->len)) {
+			duk_push_string(ctx, strerror(errno));
+			return -1;
+		}
+		cs->len = 0;
+		return 0;
 	}
 
-	duk_push_number(ctx, atoi(PQcmdTuples(stmt->result)));
-	return 1;
-}
-
-static int PgsqlStatement_finalize(duk_context *ctx)
-{
-	struct statement *stmt;
-	duk_get_prop_string(ctx, 0, "stmt");
-	if (!duk_is_undefined(ctx, -1)) {
-		stmt = duk_get_pointer(ctx, -1);
+	duk_dup(ctx, 1);
+	if (cs->format == COPY_BINARY) {
+		data = duk_push_fixed_buffer(ctx, cs->len);
+		memcpy(data, cs->buf, cs->len);
+	} else
+		duk_push_lstring(ctx, cs->buf, cs->len);
+	cs->len = 0;
 
-		if (stmt != NULL)
-			clear_statement(stmt);
-	}
+	if (duk_pcall(ctx, 1) != DUK_EXEC_SUCCESS)
+		return -1;
 
-	printf("in finalize la statement: ");
+	duk_pop(ctx);
 	return 0;
 }
 
-static duk_function_list_entry PgsqlStatement_functions[] = {
-	{"execute",		PgsqlStatement_execute,			DUK_VARARGS},
-	{"executeQuery",	PgsqlStatement_executeQuery,		DUK_VARARGS},
-	{"executeUpdate",	PgsqlStatement_executeUpdate,		DUK_VARARGS},
-	{"getConnection",	PgsqlStatement_getConnection,		0},
-	{"getGeneratedKeys",	PgsqlStatement_getGeneratedKeys,	0},
-	{"getResultSet",	PgsqlStatement_getResultSet,		0},
-	{"getUpdateCount",	PgsqlStatement_getUpdateCount,		0},
-	{NULL,			NULL, 					0}
-};
-
-static int PgsqlPreparedStatement_setNumber(duk_context *ctx)
+/**
+ * @brief Export data with COPY ... TO STDOUT
+ *
+ * The sink is either a function, which is called with consecutive chunks
+ * of data, or a file descriptor that the data is written to. The data is
+ * passed on in chunks of up to POSTGRES_COPY_BUFFER_SIZE bytes, so memory
+ * usage does not depend on the size of the export. Returns the number of
+ * exported rows.
+ */
+static int PgsqlConnection_copyOut(duk_context *ctx)
 {
-	if (!duk_is_number(ctx, 1) || duk_is_null(ctx, 1))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The value is not a number!\n");
+	struct copy_state cs;
+	PGresult *res;
+	char *row;
+	int fd = -1, len, rows, failed = 0;
+
+	if (duk_get_top(ctx) != 2)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Wrong number of arguments\n");
+
+	if (duk_is_number(ctx, 1))
+		fd = duk_get_int(ctx, 1);
+	else if (!duk_is_function(ctx, 1))
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The sink must be a function or a file descriptor\n");
+
+	memset(&cs, 0, sizeof(cs));
+	cs.conn = get_connection(ctx);
+
+	res = PQexec(cs.conn, duk_safe_to_string(ctx, 0));
+	if (PQresultStatus(res) != PGRES_COPY_OUT) {
+		duk_push_string(ctx, PQresultErrorMessage(res));
+		PQclear(res);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
+	}
+	cs.format = PQbinaryTuples(res) ? COPY_BINARY : COPY_TEXT;
+	PQclear(res);
 
-	set_parameter(ctx);
+	cs.buf = malloc(POSTGRES_COPY_BUFFER_SIZE);
+	if (cs.buf == NULL) {
+		duk_push_string(ctx, "Failed to allocate memory");
+		failed = 1;
+	}
 
-	return 0;
-}
+	/* After a failure, keep reading to bring the connection out of the
+	 * COPY state, but discard the data. */
+	while ((len = PQgetCopyData(cs.conn, &row, 0)) > 0) {
+		if (!failed && cs.len + len > POSTGRES_COPY_BUFFER_SIZE)
+			failed = copy_out_flush(ctx, &cs, fd);
+		if (!failed && len > POSTGRES_COPY_BUFFER_SIZE) {
+			/* Larger than the buffer; pass it on directly */
+			if (fd >= 0 && write_all(fd, row, len)) {
+				duk_push_string(ctx, strerror(errno));
+				failed = 1;
+			} else if (fd < 0) {
+				duk_dup(ctx, 1);
+				if (cs.format == COPY_BINARY)
+					memcpy(duk_push_fixed_buffer(ctx, len), row, len);
+				else
+					duk_push_lstring(ctx, row, len);
+				if (duk_pcall(ctx, 1) != DUK_EXEC_SUCCESS)
+					failed = 1;
+				else
+					duk_pop(ctx);
+			}
+		} else if (!failed) {
+			memcpy(cs.buf + cs.len, row, len);
+			cs.len += len;
+		}
+		PQfreemem(row);
+	}
 
-static int PgsqlPreparedStatement_setString(duk_context *ctx)
-{
-	if (!duk_is_string(ctx, 1) || duk_is_null(ctx, 1))
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "The value is not a string!\n");
+	if (!failed)
+		failed = copy_out_flush(ctx, &cs, fd);
+	free(cs.buf);
 
-	set_parameter(ctx);
+	res = PQgetResult(cs.conn);
+	if (!failed && (len == -2 || PQresultStatus(res) != PGRES_COMMAND_OK)) {
+		duk_push_string(ctx, PQerrorMessage(cs.conn));
+		failed = 1;
+	}
+	rows = atoi(PQcmdTuples(res));
+	PQclear(res);
 
-	return 0;
+	while ((res = PQgetResult(cs.conn)) != NULL)
+		PQclear(res);
+
+	/* Rethrow the error from the sink, or throw the libpq error */
+	if (failed && duk_is_error(ctx, -1))
+		duk_throw(ctx);
+	if (failed)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_safe_to_string(ctx, -1));
+
+	duk_push_int(ctx, rows);
+	return 1;
 }
 
-static duk_function_list_entry PgsqlPreparedStatement_functions[] = {
-	{"setNumber",		PgsqlPreparedStatement_setNumber,			2},
-	{"setString",	PgsqlPreparedStatement_setString,		2},
-	{NULL,			NULL, 						0}
-};
+/* }}} COPY support */
 
-static int PgsqlConnection_createStatement(duk_context *ctx)
+/* {{{ LISTEN/NOTIFY support */
+
+/**
+ * @brief Run LISTEN or UNLISTEN for a channel
+ *
+ * The channel name is quoted with PQescapeIdentifier, so any string is a
+ * valid channel name and the case is preserved.
+ */
+static void listen_command(duk_context *ctx, const char *command, const char *channel)
 {
-	/* Create PostgreSQL Statement object */
-	duk_push_object(ctx);
+	PGconn *conn = get_connection(ctx);
+	PGresult *res;
+	char *ident, *sql;
+
+	ident = PQescapeIdentifier(conn, channel, strlen(channel));
+	if (ident == NULL)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", PQerrorMessage(conn));
+
+	sql = malloc(strlen(command) + strlen(ident) + 2);
+	if (sql == NULL) {
+		PQfreemem(ident);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Failed to allocate memory\n");
+	}
+	sprintf(sql, "%s %s", command, ident);
+	PQfreemem(ident);
 
-	duk_get_global_string(ctx, "PgsqlStatement");
-	duk_set_prototype(ctx, -2);
+	res = PQexec(conn, sql);
+	free(sql);
 
-	/* Add connection property */
-	duk_push_this(ctx);
-	duk_put_prop_string(ctx, -2, "connection");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+		duk_push_string(ctx, PQresultErrorMessage(res));
+		PQclear(res);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
+	}
 
-	return 1;
+	PQclear(res);
 }
 
-static int PgsqlConnection_prepareStatement(duk_context *ctx)
+static int PgsqlConnection_listen(duk_context *ctx)
 {
-	int argc = duk_get_top(ctx);
+	if (duk_get_top(ctx) != 1)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Wrong number of arguments\n");
 
-	if (argc < 1 || argc > 2)
-		return DUK_RET_ERROR;
+	listen_command(ctx, "LISTEN", duk_safe_to_string(ctx, 0));
+	return 0;
+}
 
-	/* Create MySQL Prepared Statement object */
-	duk_push_object(ctx);
+/**
+ * @brief Stop listening on a channel, or on all channels if called
+ * without arguments
+ */
+static int PgsqlConnection_unlisten(duk_context *ctx)
+{
+	PGresult *res;
+	PGconn *conn;
 
-	duk_get_global_string(ctx, "PgsqlPreparedStatement");
-	duk_set_prototype(ctx, -2);
+	if (duk_get_top(ctx) && !duk_is_undefined(ctx, 0)) {
+		listen_command(ctx, "UNLISTEN", duk_safe_to_string(ctx, 0));
+		return 0;
+	}
 
-	/* Add connection property */
-	duk_push_this(ctx);
-	duk_put_prop_string(ctx, -2, "connection");
+	conn = get_connection(ctx);
+	res = PQexec(conn, "UNLISTEN *");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+		duk_push_string(ctx, PQresultErrorMessage(res));
+		PQclear(res);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
+	}
+	PQclear(res);
 
+	return 0;
+}
 
-	/* set_statement uses the duktape stack for the PreparedStatement object
-	and receives also the query and the number of arguments as a normal param.
-	It will simply add the statement struct as a property to the Statement object. */
-	if (!set_statement(ctx, duk_get_string(ctx, 0), argc)) {
-		/* TODO error */
-		return DUK_RET_ERROR;
+/* Move the pending notifications to the array on top of the stack */
+static int push_notifications(duk_context *ctx, PGconn *conn, int count)
+{
+	PGnotify *notify;
+
+	while ((notify = PQnotifies(conn)) != NULL) {
+		duk_push_object(ctx);
+		duk_push_string(ctx, notify->relname);
+		duk_put_prop_string(ctx, -2, "channel");
+		duk_push_string(ctx, notify->extra);
+		duk_put_prop_string(ctx, -2, "payload");
+		duk_push_int(ctx, notify->be_pid);
+		duk_put_prop_string(ctx, -2, "pid");
+		duk_put_prop_index(ctx, -2, count++);
+		PQfreemem(notify);
 	}
 
-	return 1;
+	return count;
 }
 
-static int PgsqlConnection_nativeSQL(duk_context *ctx)
+static long elapsed_ms(const struct timespec *start)
 {
-	int argc = duk_get_top(ctx);
+	struct timespec now;
 
-	if (argc != 1)
-		return DUK_RET_ERROR;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
 
-	duk_to_string(ctx, 0);
+/**
+ * @brief Get the notifications received on the listened channels
+ *
+ * Returns an array of {channel, payload, pid} objects. If there are no
+ * notifications yet, wait for up to timeoutMs milliseconds for one to
+ * arrive, without sending anything to the server. A negative timeout
+ * waits indefinitely, and no timeout (or 0) only checks for the
+ * notifications that were already received.
+ */
+static int PgsqlConnection_getNotifications(duk_context *ctx)
+{
+	PGconn *conn = get_connection(ctx);
+	struct pollfd pfd;
+	struct timespec start;
+	long timeout = 0, left;
+	int count, ret;
+
+	if (duk_get_top(ctx) && !duk_is_undefined(ctx, 0))
+		timeout = (long)duk_to_number(ctx, 0);
+
+	pfd.fd = PQsocket(conn);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0)
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", "Connection is not open\n");
+
+	duk_push_array(ctx);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		if (!PQconsumeInput(conn))
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", PQerrorMessage(conn));
+
+		count = push_notifications(ctx, conn, 0);
+		if (count || !timeout)
+			break;
+
+		left = -1;
+		if (timeout > 0) {
+			left = timeout - elapsed_ms(&start);
+			if (left <= 0)
+				break;
+		}
 
-	/* duk_to_string also replaces the value at idx with ToString(val) */
-	duk_dup(ctx, 0);
+		ret = poll(&pfd, 1, left > INT_MAX ? INT_MAX : (int)left);
+		if (ret < 0 && errno != EINTR)
+			duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", strerror(errno));
+	}
 
 	return 1;
 }
 
+/* }}} LISTEN/NOTIFY support */
+
 static int PgsqlConnection_finalize(duk_context *ctx)
 {
 	PGconn *conn;
 	duk_get_prop_string(ctx, 0, "connection");
 	conn = duk_get_pointer(ctx, -1);
 
-	if (conn != NULL)
+	if (conn != NULL) {
 		PQfinish(conn);
+		/* Let statements know the connection is gone */
+		duk_push_pointer(ctx, NULL);
+		duk_put_prop_string(ctx, 0, "connection");
+	}
+
+	duk_get_prop_string(ctx, 0, "sqlCache");
+	free_sql_cache(duk_get_pointer(ctx, -1));
+	duk_push_pointer(ctx, NULL);
+	duk_put_prop_string(ctx, 0, "sqlCache");
 
 	printf("in finalize la connection: ");
 	return 0;
@@ -999,19 +4811,58 @@ static duk_function_list_entry PgsqlConnection_functions[] = {
 	{"createStatement",	PgsqlConnection_createStatement,	1},
 	{"prepareStatement",	PgsqlConnection_prepareStatement,	2},
 	{"nativeSQL",		PgsqlConnection_nativeSQL,		1},
+	{"copyIn",		PgsqlConnection_copyIn,			DUK_VARARGS},
+	{"copyOut",		PgsqlConnection_copyOut,		2},
+	{"listen",		PgsqlConnection_listen,			1},
+	{"unlisten",		PgsqlConnection_unlisten,		DUK_VARARGS},
+	{"getNotifications",	PgsqlConnection_getNotifications,	DUK_VARARGS},
 	{NULL,			NULL,					0}
 };
 
+/**
+ * @brief Check whether a name is a libpq connection option
+ *
+ * The info object may hold properties meant for other layers; only the
+ * ones libpq knows about are passed on, since unknown keywords would make
+ * the connection fail.
+ */
+static int is_connect_option(const PQconninfoOption *options, const char *name)
+{
+	const PQconninfoOption *opt;
+
+	if (!strcmp(name, "dbname"))
+		return 0;
+
+	for (opt = options; opt && opt->keyword; opt++)
+		if (!strcmp(opt->keyword, name))
+			return 1;
+
+	return 0;
+}
+
+/**
+ * @brief Connect to a PostgreSQL server
+ *
+ * The URL is handed to libpq as is (as an expanded dbname), so everything
+ * a libpq connection URI supports can be used, e.g.
+ *
+ *   postgresql://db.example.com:5433/app?keepalives=1&tcp_user_timeout=10000
+ *   postgresql:///app?host=/var/run/postgresql&application_name=worker
+ *
+ * The properties of the info object (user, password or any other libpq
+ * connection option) are added after the URL and take precedence.
+ */
 static int PgsqlDriver_connect(duk_context *ctx)
 {
 	int argc = duk_get_top(ctx);
-	int sep_pos, db_sep;
 	const char *url;
-	char *host, *cursor, *port_str;
-	char postgres_connector[POSTGRES_CONNECTOR_LEN];
-	unsigned int port;
-	const char *user = NULL;
-	const char *password = NULL;
+	const char *keywords[POSTGRES_MAX_CONNECT_OPTIONS + 2];
+	const char *values[POSTGRES_MAX_CONNECT_OPTIONS + 2];
+	PQconninfoOption *options;
+	PGconn *connection;
+	struct sql_cache *cache;
+	duk_idx_t enum_idx;
+	int n = 0;
 
 	if (!argc)
 		return DUK_RET_ERROR;
@@ -1028,66 +4879,52 @@ static int PgsqlDriver_connect(duk_context *ctx)
 		return 1;
 	}
 
-	host = strdup(url + POSTGRES_URI_LEN);
-	port = POSTGRES_DEFAULT_PORT;
-
-	sep_pos = strcspn(host, ":/");
-	if (sep_pos == strlen(host)) {
-		free(host);
-		duk_push_null(ctx);
-		return 1;
-	}
-
-	cursor = host + sep_pos;
-	if (*cursor == ':') {
-		*(cursor++) = '\0';
-		port_str = cursor;
-		db_sep = strcspn(cursor, "/");
-
-		if (db_sep == strlen(cursor)) {
-			free(host);
-			duk_push_null(ctx);
-			return 1;
-		}
-
-		cursor += db_sep;
-		*(cursor++) = '\0';
-		port = atoi(port_str);
-	} else if (*cursor == '/') {
-		*(cursor++) = '\0';
-	} else {
-		free(host);
+	/* Malformed URLs are not ours to handle */
+	options = PQconninfoParse(url, NULL);
+	if (options == NULL) {
 		duk_push_null(ctx);
 		return 1;
 	}
+	PQconninfoFree(options);
 
-	sprintf(postgres_connector, "dbname=%s hostaddr=%s port=%d",
-			cursor, host, port);
+	keywords[n] = "dbname";
+	values[n++] = url;
 
 	if (argc > 1 && duk_is_object(ctx, 1)) {
+		options = PQconndefaults();
+
+		duk_require_stack(ctx, 2 * POSTGRES_MAX_CONNECT_OPTIONS + 4);
+		enum_idx = duk_get_top(ctx);
+		duk_enum(ctx, 1, DUK_ENUM_OWN_PROPERTIES_ONLY);
+		while (n <= POSTGRES_MAX_CONNECT_OPTIONS && duk_next(ctx, enum_idx, 1)) {
+			if (!is_connect_option(options, duk_get_string(ctx, -2)) ||
+					duk_is_null_or_undefined(ctx, -1)) {
+				duk_pop_2(ctx);
+				continue;
+			}
 
-		duk_get_prop_string(ctx, 1, "user");
-
-		if (!duk_is_undefined(ctx, -1)) {
-			user = duk_safe_to_string(ctx, -1);
-			strcat(postgres_connector, " user=");
-			strcat(postgres_connector, user);
+			/* The strings stay on the stack until the connection is made */
+			keywords[n] = duk_get_string(ctx, -2);
+			values[n++] = duk_to_string(ctx, -1);
 		}
 
-		duk_get_prop_string(ctx, 1, "password");
-
-		if (!duk_is_undefined(ctx, -1)) {
-			password = duk_safe_to_string(ctx, -1);
-			strcat(postgres_connector, " password=");
-			strcat(postgres_connector, password);
-		}
+		PQconninfoFree(options);
 	}
 
-	PGconn *connection;
-	connection = PQconnectdb(postgres_connector);
+	keywords[n] = NULL;
+	values[n] = NULL;
+
+	connection = PQconnectdbParams(keywords, values, 1);
 	if (PQstatus(connection) != CONNECTION_OK) {
+		duk_push_string(ctx, PQerrorMessage(connection));
 		PQfinish(connection);
-		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", PQerrorMessage(connection));
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s", duk_get_string(ctx, -1));
+	}
+
+	cache = calloc(1, sizeof(struct sql_cache));
+	if (cache == NULL) {
+		PQfinish(connection);
+		duk_error(ctx, DUK_ERR_TYPE_ERROR, "%s\n", "Failed to allocate memory");
 	}
 
 	/* Create Connection object */
@@ -1099,6 +4936,9 @@ static int PgsqlDriver_connect(duk_context *ctx)
 	duk_push_pointer(ctx, (void *) connection);
 	duk_put_prop_string(ctx, -2, "connection");
 
+	duk_push_pointer(ctx, cache);
+	duk_put_prop_string(ctx, -2, "sqlCache");
+
 	return 1;
 }
 
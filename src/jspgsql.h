@@ -5,16 +5,66 @@
 
 #define POSTGRES_URI				"postgresql://"
 #define POSTGRES_URI_LEN			13
-#define POSTGRES_DEFAULT_PORT			5432
-#define POSTGRES_CONNECTOR_LEN			256
+#define POSTGRES_MAX_CONNECT_OPTIONS		64
 
 #define TEXT_RESULT				0
 #define BINARY_RESULT				1
 
+/* Built-in type OIDs, as defined in catalog/pg_type_d.h (not part of libpq) */
+#define BOOLOID					16
+#define BYTEAOID				17
+#define INT8OID					20
+#define INT2OID					21
+#define INT4OID					23
+#define OIDOID					26
+#define JSONOID					114
+#define FLOAT4OID				700
+#define FLOAT8OID				701
+#define NUMERICOID				1700
+#define JSONBOID				3802
+
+/* Array types of the above */
+#define JSONARRAYOID				199
+#define BOOLARRAYOID				1000
+#define BYTEAARRAYOID				1001
+#define INT2ARRAYOID				1005
+#define INT4ARRAYOID				1007
+#define TEXTARRAYOID				1009
+#define VARCHARARRAYOID				1015
+#define INT8ARRAYOID				1016
+#define FLOAT4ARRAYOID				1021
+#define FLOAT8ARRAYOID				1022
+#define OIDARRAYOID				1028
+#define NUMERICARRAYOID				1231
+#define JSONBARRAYOID				3807
+
+/* arrays have at most 6 dimensions */
+#define MAX_ARRAY_DIMENSIONS			6
+
+/* Column decoder kinds, derived from the type and format of a column */
+#define DECODE_TEXT				0
+#define DECODE_BOOL				1
+#define DECODE_INT32				2
+#define DECODE_INT64				3
+#define DECODE_FLOAT				4
+#define DECODE_BYTEA				5
+#define DECODE_JSON				6
+
+#define TEXT_PARAMETER				0
+#define BINARY_PARAMETER			1
+
 #define SIMPLE_STATEMENT			0
 #define PREPARED_STATEMENT			1
 
-#define MAX_PARAMETERS				99
+/* limit imposed by the frontend/backend protocol */
+#define MAX_PARAMETERS				65535
+
+#define POSTGRES_SQL_CACHE_SIZE			256
+
+#define POSTGRES_STREAMING_CHUNK_ROWS		1000
+#define POSTGRES_CURSOR_NAME_LEN		32
+#define POSTGRES_PIPELINE_DEPTH			512
+#define POSTGRES_COPY_BUFFER_SIZE		65536
 
 #define POSTGRES_AUTOGENERATED_STRING		" RETURNING *"
 #define POSTGRES_AUTOGENERATED_STRING_LENGTH	12
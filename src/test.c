@@ -12,6 +12,31 @@
 #include "jsmysql.h"
 #include "jspgsql.h"
 
+/* readFile(path) returns the contents of a file as a buffer, for checking
+ * the files written by the drivers */
+static int read_file(duk_context *ctx)
+{
+	const char *path = duk_require_string(ctx, 0);
+	char *buf;
+	off_t len;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY, 0);
+	if (fd < 0)
+		return DUK_RET_ERROR;
+
+	len = lseek(fd, 0, SEEK_END);
+	buf = duk_push_fixed_buffer(ctx, len > 0 ? len : 0);
+	n = len > 0 ? pread(fd, buf, len, 0) : 0;
+	close(fd);
+
+	if (n != len)
+		return DUK_RET_ERROR;
+
+	return 1;
+}
+
 static int run_test(char *source, duk_context *ctx)
 {
 	int fd;
@@ -61,6 +86,9 @@ int main(int argc, const char *argv[])
 	if (!js_sql_init(ctx))
 		return 1;
 
+	duk_push_c_function(ctx, read_file, 1);
+	duk_put_prop_string(ctx, -2, "readFile");
+
 	int ret_mysql = 0;
 	int ret_postgres = 0;
 
@@ -478,6 +478,476 @@ function preparedStatementResultBySettingNumber_test() {
 	return "PASS";
 }
 
+function columnLabel_test() {
+	var conn, stmt, result;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	result = stmt.executeQuery("select id, name, age as years from people");
+	if (result == null)
+		return "FAIL";
+
+	while (result.next()) {
+		if (result.getNumber("id") != result.getNumber(1) ||
+				result.getString("NAME") != result.getString(2) ||
+				result.getNumber("years") != result.getNumber(3))
+			return "FAIL";
+	}
+
+	return "PASS";
+}
+
+function toArray_test() {
+	var conn, stmt, result, rows, expected;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	result = stmt.executeQuery("select count(*) from people");
+	if (result == null || !result.next())
+		return "FAIL";
+	expected = result.getNumber(1);
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	rows = result.fetchRows(1);
+	if (rows.length != 1 || rows[0].length != 3 || typeof rows[0][0] != "number")
+		return "FAIL";
+
+	rows = result.toArray({asObject: true});
+	if (rows.length != expected - 1 || (rows.length && typeof rows[0].name != "string"))
+		return "FAIL";
+
+	if (result.fetchRows(10).length != 0)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function fetchColumns_test() {
+	var conn, stmt, result, rows, columns, i;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray();
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	columns = result.fetchColumns(rows.length + 10, ["age", 2]);
+	if (columns.length != 2 || columns[0].name != "age" || columns[1].name != "name")
+		return "FAIL";
+
+	if (!(columns[0].values instanceof Int32Array) || columns[0].values.length != rows.length)
+		return "FAIL";
+
+	for (i = 0; i < rows.length; i++) {
+		if (rows[i][2] == null) {
+			if (!(columns[0].nulls[i >> 3] & (1 << (i & 7))))
+				return "FAIL";
+		} else if (columns[0].values[i] != rows[i][2])
+			return "FAIL";
+		if (columns[1].values[i] != rows[i][1])
+			return "FAIL";
+	}
+
+	return "PASS";
+}
+
+function forEach_test() {
+	var conn, stmt, result, rows, count, ok = true;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray();
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	count = result.forEach(function(name, id) {
+		if (arguments.length != 2 || rows[0][1] != name || rows[0][0] != id)
+			ok = false;
+		rows.shift();
+	}, {columns: ["name", 1]});
+	if (!ok || rows.length != 0)
+		return "FAIL";
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	count = result.forEach(function(row) {
+		if (typeof row.name == "undefined")
+			ok = false;
+		return false;
+	}, {asObject: true});
+	if (!ok || count > 1)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function nextInto_test() {
+	var conn, stmt, result, rows, row = {}, arr = [], i = 0;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray();
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	while (result.nextInto(row)) {
+		if (row.id != rows[i][0] || row.name != rows[i][1])
+			return "FAIL";
+		i++;
+	}
+	if (i != rows.length)
+		return "FAIL";
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	if (rows.length && (!result.nextInto(arr) || arr.length != 3 || arr[0] != rows[0][0]))
+		return "FAIL";
+
+	return "PASS";
+}
+
+function toJSON_test() {
+	var conn, stmt, rows, json;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray({asObject: true});
+
+	json = stmt.executeQuery("select id, name, age from people order by id").toJSON();
+	if (json != JSON.stringify(rows))
+		return "FAIL";
+
+	json = stmt.executeQuery("select 'a\"b' as s, null as n").toJSON({format: "arrays", limit: 1});
+	if (json != '[["a\\"b",null]]')
+		return "FAIL";
+
+	return "PASS";
+}
+
+function writeCSV_test() {
+	var conn, stmt, rows, res;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people").toArray();
+
+	res = stmt.executeQuery("select id, name, age from people").writeCSV("/tmp/jssql_test.csv");
+	if (res.rows != rows.length || res.bytes <= 0)
+		return "FAIL";
+
+	/* "a,b";\N\n */
+	res = stmt.executeQuery("select 'a,b' as s, null as n").writeCSV("/tmp/jssql_test.csv",
+			{delimiter: ";", header: false, nullString: "\\N", lineEnding: "\n"});
+	if (res.rows != 1 || res.bytes != 9)
+		return "FAIL";
+
+	return "PASS";
+}
+
+/*
+ * Check the framing of an Arrow IPC file and count its rows: the leading
+ * and trailing magic, the footer and the length of every record batch
+ * listed in it. Returns -1 if the file is malformed.
+ */
+function arrowRowCount(buf) {
+	var len = buf.length, magic = "ARROW1", i, footer, root, batches, n, rows, msg, header;
+
+	function u16(p) {
+		return buf[p] | (buf[p + 1] << 8);
+	}
+
+	function u32(p) {
+		return (buf[p] | (buf[p + 1] << 8) | (buf[p + 2] << 16) | (buf[p + 3] << 24)) >>> 0;
+	}
+
+	function i64(p) {
+		return u32(p) + u32(p + 4) * 4294967296;
+	}
+
+	/* Position of a field of a FlatBuffers table, 0 if it is absent */
+	function field(table, id) {
+		var vtable = table - (u32(table) | 0);
+		return 4 + 2 * id < u16(vtable) && u16(vtable + 4 + 2 * id) ? table + u16(vtable + 4 + 2 * id) : 0;
+	}
+
+	if (len < 18)
+		return -1;
+	for (i = 0; i < 6; i++)
+		if (buf[i] != magic.charCodeAt(i) || buf[len - 6 + i] != magic.charCodeAt(i))
+			return -1;
+	if (buf[6] != 0 || buf[7] != 0)
+		return -1;
+
+	footer = len - 10 - u32(len - 10);
+	if (footer < 8 || footer % 8)
+		return -1;
+	root = footer + u32(footer);
+	if (!field(root, 3))
+		return -1;
+	batches = field(root, 3) + u32(field(root, 3));
+
+	rows = 0;
+	for (n = u32(batches), i = 0; i < n; i++) {
+		/* Block: offset, metadata length, body length */
+		msg = i64(batches + 4 + 24 * i);
+		if (u32(msg) != 0xffffffff)
+			return -1;
+		msg += 8;
+		root = msg + u32(msg);
+		/* Message: version, header type (3 is RecordBatch), header */
+		if (!field(root, 1) || buf[field(root, 1)] != 3 || !field(root, 2))
+			return -1;
+		header = field(root, 2) + u32(field(root, 2));
+		if (field(header, 0))
+			rows += i64(field(header, 0));
+	}
+
+	return rows;
+}
+
+function writeArrow_test() {
+	var conn, stmt, rows, res, buf;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people").toArray();
+
+	res = stmt.executeQuery("select id, name, age from people").writeArrow("/tmp/jssql_test.arrow", {batchRows: 2});
+	/* The file ends with the footer length and "ARROW1", after 8-byte aligned blocks */
+	if (res.rows != rows.length || res.bytes % 8 != 2)
+		return "FAIL";
+
+	buf = readFile("/tmp/jssql_test.arrow");
+	if (buf.length != res.bytes || arrowRowCount(buf) != rows.length)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function getBuffer_test() {
+	var conn, stmt, rs, buf;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs = stmt.executeQuery("select x'00ff10' as b, 'hello' as s, null as n");
+	if (!rs.next())
+		return "FAIL";
+
+	buf = rs.getBuffer(1);
+	if (buf.length != 3 || buf[0] != 0 || buf[1] != 255 || buf[2] != 16)
+		return "FAIL";
+
+	buf = rs.getBuffer("s");
+	if (buf.length != 5 || buf[0] != 104 || rs.getString(2) != "hello")
+		return "FAIL";
+
+	if (rs.getBuffer(3) !== null)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function typedGetters_test() {
+	var conn, stmt, rs, buf;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs = stmt.executeQuery("select 42 as i, cast(18446744073709551615 as unsigned) as l, 2.5e0 as d, true as b, null as n, 'yes' as s, x'0102' as bin");
+	if (!rs.next())
+		return "FAIL";
+
+	if (rs.getInt(1) !== 42 || rs.wasNull())
+		return "FAIL";
+	if (rs.getLong("l") !== "18446744073709551615")
+		return "FAIL";
+	if (rs.getDouble(3) !== 2.5 || rs.getBoolean(4) !== true || rs.getBoolean("s") !== true)
+		return "FAIL";
+	if (rs.getInt(5) !== 0 || !rs.wasNull())
+		return "FAIL";
+
+	buf = rs.getBytes(7);
+	if (buf.length != 2 || buf[0] != 1 || buf[1] != 2 || rs.wasNull())
+		return "FAIL";
+
+	return "PASS";
+}
+
+function decoders_test() {
+	var conn, stmt, rs, rows, json;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select 1 as i, 0.5e0 as d, 'a' as s, cast(9007199254740993 as signed) as l union all select null, null, null, 2").toArray();
+	if (rows.length != 2 || rows[0][0] !== 1 || rows[0][1] !== 0.5 || rows[0][2] !== "a" || rows[0][3] !== "9007199254740993")
+		return "FAIL";
+	if (rows[1][0] !== null || rows[1][1] !== null || rows[1][2] !== null || rows[1][3] !== 2)
+		return "FAIL";
+
+	json = stmt.executeQuery("select 1 as i, 0.5e0 as d, 'a' as s union all select 2, null, 'b'").toJSON({format: "arrays"});
+	if (json != '[[1,0.5,"a"],[2,null,"b"]]')
+		return "FAIL";
+
+	/* The getters share the decoder table of the result */
+	rs = stmt.executeQuery("select 1 as i, 'true' as s union all select 2, 'false'");
+	if (!rs.next() || rs.getInt(1) !== 1 || rs.getBoolean(2) !== true)
+		return "FAIL";
+	if (!rs.next() || rs.getLong("i") !== 2 || rs.getBoolean("s") !== false)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function numericParsing_test() {
+	var conn, stmt, rs, rows;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = JSON.parse(stmt.executeQuery("select 0.1e0 as a, 1.7976931348623157e308 as b, 2.2250738585072014e-308 as c").toJSON({format: "arrays"}));
+	if (rows[0][0] !== 0.1 || rows[0][1] !== 1.7976931348623157e308 || rows[0][2] !== 2.2250738585072014e-308)
+		return "FAIL";
+
+	rs = stmt.executeQuery("select '0.0' as z, ' 2.5e-1 ' as q, 'abc' as s");
+	if (!rs.next())
+		return "FAIL";
+	if (rs.getBoolean("z") !== false || rs.getBoolean("q") !== true || rs.getBoolean("s") !== false)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function nativeDecoding_test() {
+	var conn, stmt, rs, obj, arr, d;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	stmt.executeUpdate("create temporary table decoding (j json, s set('a', 'b', 'c'), d date, ts datetime(3))");
+	stmt.executeUpdate("insert into decoding values ('{\"a\": [1, 2], \"b\": null}', 'a,c', '2024-01-15', '2024-01-15 10:20:30.123'), (null, '', null, null)");
+
+	rs = stmt.executeQuery("select j, s, d, ts, '2024-01-15 10:20:30+00:00' as text from decoding");
+	if (!rs.next())
+		return "FAIL";
+
+	obj = rs.getJSON("j");
+	if (obj.a.length != 2 || obj.a[1] !== 2 || obj.b !== null)
+		return "FAIL";
+
+	arr = rs.getArray("s");
+	if (arr.length != 2 || arr[0] !== "a" || arr[1] !== "c")
+		return "FAIL";
+
+	d = rs.getDate("d");
+	if (d.getFullYear() != 2024 || d.getMonth() != 0 || d.getDate() != 15 || d.getHours() != 0)
+		return "FAIL";
+	if (rs.getTimestamp("ts").getTime() !== new Date(2024, 0, 15, 10, 20, 30, 123).getTime())
+		return "FAIL";
+	if (rs.getTimestamp("text").getTime() !== Date.UTC(2024, 0, 15, 10, 20, 30))
+		return "FAIL";
+
+	if (!rs.next())
+		return "FAIL";
+	if (rs.getJSON("j") !== null || !rs.wasNull() || rs.getArray("s").length != 0 || rs.getDate("d") !== null)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function metadata_test() {
+	var conn, stmt, rs, md, pmd;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	stmt.executeUpdate("create temporary table metadata (id int not null, price decimal(10,2), name varchar(20))");
+
+	rs = stmt.executeQuery("select id, price, name from metadata");
+	md = rs.getMetaData();
+	if (md.columnCount != 3 || md.columns[0].name != "id" || md.columns[0].typeName != "INT" || md.columns[0].nullable !== false)
+		return "FAIL";
+	if (md.columns[1].typeName != "DECIMAL" || md.columns[1].precision != 10 || md.columns[1].scale != 2)
+		return "FAIL";
+	if (md.columns[2].typeName != "VARCHAR" || md.columns[2].nullable !== true)
+		return "FAIL";
+	if (rs.getMetaData() !== md)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("select * from information_schema.tables where table_name = ? and table_type = ?");
+	pmd = stmt.getParameterMetaData();
+	if (pmd.parameterCount != 2 || pmd.parameters.length != 2 || pmd.parameters[0].type !== null)
+		return "FAIL";
+	if (stmt.getParameterMetaData() !== pmd)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function resultOwnership_test() {
+	var conn, stmt, rs1, rs2;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs1 = stmt.executeQuery("select 1 as n union all select 2 union all select 3");
+	if (!rs1.next() || rs1.getNumber("n") != 1)
+		return "FAIL";
+
+	/* Executing the statement again leaves the first result set usable */
+	rs2 = stmt.executeQuery("select 'a' as s union all select 'b'");
+	if (!rs2.next() || rs2.getString("s") != "a")
+		return "FAIL";
+	if (!rs1.next() || rs1.getNumber("n") != 2 || !rs1.next() || rs1.getNumber("n") != 3 || rs1.next())
+		return "FAIL";
+	if (!rs2.next() || rs2.getString(1) != "b" || rs2.next())
+		return "FAIL";
+
+	stmt = conn.prepareStatement("select concat(?, 'x') as s");
+	stmt.setString(1, "a");
+	rs1 = stmt.executeQuery();
+	stmt.setString(1, "b");
+	rs2 = stmt.executeQuery();
+	if (!rs1.next() || rs1.getString("s") != "ax" || !rs2.next() || rs2.getString("s") != "bx")
+		return "FAIL";
+
+	return "PASS";
+}
+
 function test() {
 	//integration_test();
 	println("[Test  1] Testing connection .................................................. " + connection_test());
@@ -501,6 +971,21 @@ function test() {
 	println("[Test 19] Testing ResultSet for a simple statement with column index........... " + simpleStatementResult_test());
 	println("[Test 20] Testing ResultSet for a prepared statement by setting a string....... " + preparedStatementResultBySettingString_test());
 	println("[Test 21] Testing ResultSet for a prepared statement by setting a number....... " + preparedStatementResultBySettingNumber_test());
+	println("[Test 22] Testing ResultSet with column labels ................................ " + columnLabel_test());
+	println("[Test 23] Testing toArray and fetchRows ....................................... " + toArray_test());
+	println("[Test 24] Testing fetchColumns ................................................ " + fetchColumns_test());
+	println("[Test 25] Testing forEach ..................................................... " + forEach_test());
+	println("[Test 26] Testing nextInto .................................................... " + nextInto_test());
+	println("[Test 27] Testing toJSON ...................................................... " + toJSON_test());
+	println("[Test 28] Testing writeCSV .................................................... " + writeCSV_test());
+	println("[Test 29] Testing writeArrow .................................................. " + writeArrow_test());
+	println("[Test 30] Testing getBuffer ................................................... " + getBuffer_test());
+	println("[Test 31] Testing typed getters ............................................... " + typedGetters_test());
+	println("[Test 32] Testing the decoder table ........................................... " + decoders_test());
+	println("[Test 33] Testing numeric parsing ............................................. " + numericParsing_test());
+	println("[Test 34] Testing getJSON, getArray and getDate ............................... " + nativeDecoding_test());
+	println("[Test 35] Testing metadata .................................................... " + metadata_test());
+	println("[Test 36] Testing result ownership ............................................ " + resultOwnership_test());
 // 	//TODO add more complex tests (example: create a table, insert an element, get the result and check if it is the one expected)
 	return 0;
 }
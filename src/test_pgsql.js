@@ -631,6 +631,883 @@ function preparedStatementResult_test() {
 	return "FAIL";
 }
 
+function streaming_test() {
+	var conn, stmt, result, expected, rows;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	result = stmt.executeQuery("select count(*) from people");
+	if (result == null || !result.next())
+		return "FAIL";
+	expected = result.getNumber(1);
+
+	stmt.setStreaming(true);
+	result = stmt.executeQuery("select * from people");
+	if (result == null)
+		return "FAIL";
+
+	rows = 0;
+	while (result.next()) {
+		if (result.getString("name") == null)
+			return "FAIL";
+		rows++;
+	}
+
+	if (rows != expected)
+		return "FAIL";
+
+	/* The connection must be usable again once the stream is consumed */
+	if (stmt.executeUpdate("update people set age = age where name = 'Mihai'") == -1)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function fetchSize_test() {
+	var conn, stmt, other, result, expected, rows;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	other = conn.createStatement();
+	result = stmt.executeQuery("select count(*) from people");
+	if (result == null || !result.next())
+		return "FAIL";
+	expected = result.getNumber(1);
+
+	stmt.execute("BEGIN");
+	stmt.setFetchSize(2);
+	if (stmt.getFetchSize() != 2)
+		return "FAIL";
+
+	result = stmt.executeQuery("select * from people");
+	if (result == null)
+		return "FAIL";
+
+	rows = 0;
+	while (result.next()) {
+		/* Other statements can run between batches */
+		if (other.executeQuery("select 1") == null)
+			return "FAIL";
+		rows++;
+	}
+
+	/* Statements a cursor does not accept run directly, without
+	 * aborting the transaction */
+	result = stmt.executeQuery("show server_version");
+	if (result == null || !result.next())
+		return "FAIL";
+	result = other.executeQuery("select 1");
+	if (result == null || !result.next())
+		return "FAIL";
+
+	other.execute("COMMIT");
+
+	if (rows != expected)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function batch_test() {
+	var conn, stmt, counts, result, i;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("insert into people (name, age) values (?, ?)");
+	if (stmt == null)
+		return "FAIL";
+
+	for (i = 0; i < 100; i++) {
+		stmt.setString(1, "Batch" + i);
+		stmt.setNumber(2, i);
+		stmt.addBatch();
+	}
+
+	counts = stmt.executeBatch();
+	if (counts.length != 100)
+		return "FAIL";
+
+	for (i = 0; i < counts.length; i++)
+		if (counts[i] != 1)
+			return "FAIL";
+
+	/* The batch is cleared after execution */
+	if (stmt.executeBatch().length != 0)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("delete from people where name = ?");
+	for (i = 0; i < 100; i++) {
+		stmt.setString(1, "Batch" + i);
+		stmt.addBatch();
+	}
+	stmt.executeBatch();
+
+	/* A failed entry rolls back the whole batch, even past the first
+	 * pipeline segment */
+	stmt = conn.prepareStatement("insert into people (name, age) values (?, ?)");
+	for (i = 0; i < 600; i++) {
+		stmt.setString(1, i == 550 ? new Array(50).join("Atomic") : "Atomic" + i);
+		stmt.setNumber(2, i);
+		stmt.addBatch();
+	}
+	try {
+		stmt.executeBatch();
+		return "FAIL";
+	} catch (e) {
+	}
+
+	result = conn.createStatement().executeQuery("select count(*) from people where name like 'Atomic%'");
+	if (!result.next() || result.getNumber(1) != 0)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function copyIn_test() {
+	var conn, stmt, result, rows, i;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+
+	/* Array of rows, text format (with characters that need escaping) */
+	rows = conn.copyIn("COPY people (name, age) FROM STDIN", [
+		["Copy\ttab", 1],
+		["Copy\\backslash", null]
+	]);
+	if (rows != 2)
+		return "FAIL";
+
+	/* Row producer callback, CSV format */
+	i = 0;
+	rows = conn.copyIn("COPY people (name, age) FROM STDIN (FORMAT csv)", function() {
+		if (i == 10)
+			return null;
+		i++;
+		return ["Copy \"" + i + "\", quoted", i];
+	}, {format: "csv"});
+	if (rows != 10)
+		return "FAIL";
+
+	/* Custom delimiter and NULL string */
+	rows = conn.copyIn("COPY people (name, age) FROM STDIN (DELIMITER '|', NULL 'nil')", [
+		["Copy|pipe", null]
+	], {delimiter: "|", null: "nil"});
+	if (rows != 1)
+		return "FAIL";
+
+	/* An empty binary COPY still needs the header and trailer */
+	rows = conn.copyIn("COPY people (name, age) FROM STDIN (FORMAT binary)", [],
+		{format: "binary"});
+	if (rows != 0)
+		return "FAIL";
+
+	result = stmt.executeQuery("select count(*) from people where name like 'Copy%'");
+	if (!result.next() || result.getNumber(1) != 13)
+		return "FAIL";
+
+	stmt.executeUpdate("delete from people where name like 'Copy%'");
+
+	return "PASS";
+}
+
+function copyOut_test() {
+	var conn, stmt, result, expected, rows, data;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	result = stmt.executeQuery("select count(*) from people");
+	if (result == null || !result.next())
+		return "FAIL";
+	expected = result.getNumber(1);
+
+	data = "";
+	rows = conn.copyOut("COPY people TO STDOUT (FORMAT csv)", function(chunk) {
+		data += chunk;
+	});
+
+	if (rows != expected || data.split("\n").length != expected + 1)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function placeholders_test() {
+	var conn, stmt, result;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("select '?' as a, \"?\" , ? as b -- ?\n, $$?$$ /* ? */, '{\"k\": 1}'::jsonb ?? 'k' as c from (select 1 as \"?\") t");
+	if (stmt == null)
+		return "FAIL";
+
+	stmt.setString(1, "Test");
+
+	result = stmt.executeQuery();
+	if (result == null || !result.next())
+		return "FAIL";
+
+	if (result.getString(1) != "?" || result.getString(3) != "Test" || result.getString(5) != "t")
+		return "FAIL";
+
+	/* ?| and ?& are a parameter followed by an operator; the jsonb
+	 * operators are written ??| and ??& */
+	stmt = conn.prepareStatement("select ?||'%', '{\"k\": 1}'::jsonb ??| array['k', 'x'], " +
+		"'{\"k\": 1}'::jsonb ??& array['k', 'x']");
+	stmt.setString(1, "Test");
+
+	result = stmt.executeQuery();
+	if (result == null || !result.next())
+		return "FAIL";
+
+	if (result.getString(1) != "Test%" || result.getString(2) != "t" || result.getString(3) != "f")
+		return "FAIL";
+
+	return "PASS";
+}
+
+function notifications_test() {
+	var listener, notifier, stmt, notifications;
+
+	listener = getPgsqlConnection();
+	notifier = getPgsqlConnection();
+	if (listener == null || notifier == null)
+		return "FAIL";
+
+	listener.listen("jssql Test");
+	if (listener.getNotifications().length != 0)
+		return "FAIL";
+
+	stmt = notifier.createStatement();
+	stmt.execute("notify \"jssql Test\", 'payload'");
+
+	notifications = listener.getNotifications(5000);
+	if (notifications.length != 1 || notifications[0].channel != "jssql Test" ||
+			notifications[0].payload != "payload")
+		return "FAIL";
+
+	listener.unlisten();
+	stmt.execute("notify \"jssql Test\"");
+	if (listener.getNotifications(100).length != 0)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function generatedKeyColumns_test() {
+	var conn, stmt, rs;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("insert into people (age, name) values (?,?)", ["name", "ID"]);
+	stmt.setNumber(1, 34);
+	stmt.setString(2, "Test34");
+	if (stmt.executeUpdate() != 1)
+		return "FAIL";
+
+	rs = stmt.getGeneratedKeys();
+	if (rs == null || !rs.next())
+		return "FAIL";
+	if (rs.getString(1) != "Test34" || !(rs.getNumber(2) > 0))
+		return "FAIL";
+
+	/* Only the requested columns are sent back */
+	try {
+		rs.getString(3);
+		return "FAIL";
+	} catch (e) {
+	}
+
+	stmt = conn.prepareStatement("insert into people (age, name) values (?,?)", [3, 1]);
+	stmt.setNumber(1, 35);
+	stmt.setString(2, "Test35");
+	if (stmt.executeUpdate() != 1)
+		return "FAIL";
+
+	rs = stmt.getGeneratedKeys();
+	if (rs == null || !rs.next())
+		return "FAIL";
+	if (rs.getNumber(1) != 35 || !(rs.getNumber(2) > 0))
+		return "FAIL";
+
+	return "PASS";
+}
+
+function setArray_test() {
+	var conn, stmt, rs;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("select count(*), sum(x) from unnest(?::int4[]) x where x = ANY(?)");
+	stmt.setArray(1, [1, 2, 3, null, 5], "int4");
+	stmt.setArray(2, [2, 3, 4]);
+
+	rs = stmt.executeQuery();
+	if (rs == null || !rs.next() || rs.getNumber(1) != 2 || rs.getNumber(2) != 5)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("select array_length(?::text[], 1), (?::text[])[2]");
+	stmt.setArray(1, ["a,b", "c\"d", null], "text");
+	stmt.setArray(2, ["x", "{y}"]);
+
+	rs = stmt.executeQuery();
+	if (rs == null || !rs.next() || rs.getNumber(1) != 3 || rs.getString(2) != "{y}")
+		return "FAIL";
+
+	return "PASS";
+}
+
+function connectionOptions_test() {
+	var conn, rs;
+
+	conn = DriverManager.getConnection("postgresql://127.0.0.1/test_js_sql?application_name=jssql_url&keepalives=1", {
+		user: "test_js_sql",
+		password: "123456",
+		connect_timeout: 10,
+		notAnOption: "ignored"
+	});
+	if (conn == null)
+		return "FAIL";
+
+	rs = conn.createStatement().executeQuery("show application_name");
+	if (rs == null || !rs.next() || rs.getString(1) != "jssql_url")
+		return "FAIL";
+
+	/* Options from the info object take precedence */
+	conn = DriverManager.getConnection("postgresql://127.0.0.1/test_js_sql?application_name=jssql_url", {
+		user: "test_js_sql",
+		password: "123456",
+		application_name: "jssql_info"
+	});
+
+	rs = conn.createStatement().executeQuery("show application_name");
+	if (rs == null || !rs.next() || rs.getString(1) != "jssql_info")
+		return "FAIL";
+
+	return "PASS";
+}
+
+function toArray_test() {
+	var conn, stmt, result, rows, expected;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	result = stmt.executeQuery("select count(*) from people");
+	if (result == null || !result.next())
+		return "FAIL";
+	expected = result.getNumber(1);
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	rows = result.fetchRows(1);
+	if (rows.length != 1 || rows[0].length != 3 || typeof rows[0][0] != "number")
+		return "FAIL";
+
+	rows = result.toArray({asObject: true});
+	if (rows.length != expected - 1 || (rows.length && typeof rows[0].name != "string"))
+		return "FAIL";
+
+	if (result.fetchRows(10).length != 0)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function fetchColumns_test() {
+	var conn, stmt, result, rows, columns, i;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray();
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	columns = result.fetchColumns(rows.length + 10, ["age", 2]);
+	if (columns.length != 2 || columns[0].name != "age" || columns[1].name != "name")
+		return "FAIL";
+
+	if (!(columns[0].values instanceof Int32Array) || columns[0].values.length != rows.length)
+		return "FAIL";
+
+	for (i = 0; i < rows.length; i++) {
+		if (rows[i][2] == null) {
+			if (!(columns[0].nulls[i >> 3] & (1 << (i & 7))))
+				return "FAIL";
+		} else if (columns[0].values[i] != rows[i][2])
+			return "FAIL";
+		if (columns[1].values[i] != rows[i][1])
+			return "FAIL";
+	}
+
+	return "PASS";
+}
+
+function forEach_test() {
+	var conn, stmt, result, rows, count, ok = true;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray();
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	count = result.forEach(function(name, id) {
+		if (arguments.length != 2 || rows[0][1] != name || rows[0][0] != id)
+			ok = false;
+		rows.shift();
+	}, {columns: ["name", 1]});
+	if (!ok || rows.length != 0)
+		return "FAIL";
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	count = result.forEach(function(row) {
+		if (typeof row.name == "undefined")
+			ok = false;
+		return false;
+	}, {asObject: true});
+	if (!ok || count > 1)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function nextInto_test() {
+	var conn, stmt, result, rows, row = {}, arr = [], i = 0;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray();
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	while (result.nextInto(row)) {
+		if (row.id != rows[i][0] || row.name != rows[i][1])
+			return "FAIL";
+		i++;
+	}
+	if (i != rows.length)
+		return "FAIL";
+
+	result = stmt.executeQuery("select id, name, age from people order by id");
+	if (rows.length && (!result.nextInto(arr) || arr.length != 3 || arr[0] != rows[0][0]))
+		return "FAIL";
+
+	return "PASS";
+}
+
+function toJSON_test() {
+	var conn, stmt, rows, json;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people order by id").toArray({asObject: true});
+
+	json = stmt.executeQuery("select id, name, age from people order by id").toJSON();
+	if (json != JSON.stringify(rows))
+		return "FAIL";
+
+	json = stmt.executeQuery("select 'a\"b\\c\nd' as s, null as n").toJSON({format: "arrays", limit: 1});
+	if (json != '[["a\\"b\\\\c\\nd",null]]')
+		return "FAIL";
+
+	return "PASS";
+}
+
+function writeCSV_test() {
+	var conn, stmt, rows, res;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people").toArray();
+
+	res = stmt.executeQuery("select id, name, age from people").writeCSV("/tmp/jssql_test.csv");
+	if (res.rows != rows.length || res.bytes <= 0)
+		return "FAIL";
+
+	/* "a,b";\N\n */
+	res = stmt.executeQuery("select 'a,b' as s, null as n").writeCSV("/tmp/jssql_test.csv",
+			{delimiter: ";", header: false, nullString: "\\N", lineEnding: "\n"});
+	if (res.rows != 1 || res.bytes != 9)
+		return "FAIL";
+
+	return "PASS";
+}
+
+/*
+ * Check the framing of an Arrow IPC file and count its rows: the leading
+ * and trailing magic, the footer and the length of every record batch
+ * listed in it. Returns -1 if the file is malformed.
+ */
+function arrowRowCount(buf) {
+	var len = buf.length, magic = "ARROW1", i, footer, root, batches, n, rows, msg, header;
+
+	function u16(p) {
+		return buf[p] | (buf[p + 1] << 8);
+	}
+
+	function u32(p) {
+		return (buf[p] | (buf[p + 1] << 8) | (buf[p + 2] << 16) | (buf[p + 3] << 24)) >>> 0;
+	}
+
+	function i64(p) {
+		return u32(p) + u32(p + 4) * 4294967296;
+	}
+
+	/* Position of a field of a FlatBuffers table, 0 if it is absent */
+	function field(table, id) {
+		var vtable = table - (u32(table) | 0);
+		return 4 + 2 * id < u16(vtable) && u16(vtable + 4 + 2 * id) ? table + u16(vtable + 4 + 2 * id) : 0;
+	}
+
+	if (len < 18)
+		return -1;
+	for (i = 0; i < 6; i++)
+		if (buf[i] != magic.charCodeAt(i) || buf[len - 6 + i] != magic.charCodeAt(i))
+			return -1;
+	if (buf[6] != 0 || buf[7] != 0)
+		return -1;
+
+	footer = len - 10 - u32(len - 10);
+	if (footer < 8 || footer % 8)
+		return -1;
+	root = footer + u32(footer);
+	if (!field(root, 3))
+		return -1;
+	batches = field(root, 3) + u32(field(root, 3));
+
+	rows = 0;
+	for (n = u32(batches), i = 0; i < n; i++) {
+		/* Block: offset, metadata length, body length */
+		msg = i64(batches + 4 + 24 * i);
+		if (u32(msg) != 0xffffffff)
+			return -1;
+		msg += 8;
+		root = msg + u32(msg);
+		/* Message: version, header type (3 is RecordBatch), header */
+		if (!field(root, 1) || buf[field(root, 1)] != 3 || !field(root, 2))
+			return -1;
+		header = field(root, 2) + u32(field(root, 2));
+		if (field(header, 0))
+			rows += i64(field(header, 0));
+	}
+
+	return rows;
+}
+
+function writeArrow_test() {
+	var conn, stmt, rows, res, buf;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select id, name, age from people").toArray();
+
+	res = stmt.executeQuery("select id, name, age from people").writeArrow("/tmp/jssql_test.arrow", {batchRows: 2});
+	/* The file ends with the footer length and "ARROW1", after 8-byte aligned blocks */
+	if (res.rows != rows.length || res.bytes % 8 != 2)
+		return "FAIL";
+
+	buf = readFile("/tmp/jssql_test.arrow");
+	if (buf.length != res.bytes || arrowRowCount(buf) != rows.length)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function getBuffer_test() {
+	var conn, stmt, rs, buf;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs = stmt.executeQuery("select '\\x00ff10'::bytea as b, 'hello' as s, null as n");
+	if (!rs.next())
+		return "FAIL";
+
+	buf = rs.getBuffer(1);
+	if (buf.length != 3 || buf[0] != 0 || buf[1] != 255 || buf[2] != 16)
+		return "FAIL";
+
+	buf = rs.getBuffer("s");
+	if (buf.length != 5 || buf[0] != 104 || rs.getString(2) != "hello")
+		return "FAIL";
+
+	if (rs.getBuffer(3) !== null)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function typedGetters_test() {
+	var conn, stmt, rs, buf;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs = stmt.executeQuery("select 42 as i, 9007199254740993::int8 as l, 2.5::float8 as d, true as b, null::int4 as n, 'yes' as s, '\\x0102'::bytea as bin");
+	if (!rs.next())
+		return "FAIL";
+
+	if (rs.getInt(1) !== 42 || rs.wasNull())
+		return "FAIL";
+	if (rs.getLong("l") !== "9007199254740993")
+		return "FAIL";
+	if (rs.getDouble(3) !== 2.5 || rs.getBoolean(4) !== true || rs.getBoolean("s") !== true)
+		return "FAIL";
+	if (rs.getInt(5) !== 0 || !rs.wasNull())
+		return "FAIL";
+
+	buf = rs.getBytes(7);
+	if (buf.length != 2 || buf[0] != 1 || buf[1] != 2 || rs.wasNull())
+		return "FAIL";
+
+	return "PASS";
+}
+
+function decoders_test() {
+	var conn, stmt, rs, rows, json;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rows = stmt.executeQuery("select 1 as i, 0.5::float8 as d, 'a' as s, 9007199254740993::int8 as l union all select null, null, null, 2::int8").toArray();
+	if (rows.length != 2 || rows[0][0] !== 1 || rows[0][1] !== 0.5 || rows[0][2] !== "a" || rows[0][3] !== "9007199254740993")
+		return "FAIL";
+	if (rows[1][0] !== null || rows[1][1] !== null || rows[1][2] !== null || rows[1][3] !== 2)
+		return "FAIL";
+
+	json = stmt.executeQuery("select 1 as i, 0.5::float8 as d, 'a' as s union all select 2, null, 'b'").toJSON({format: "arrays"});
+	if (json != '[[1,0.5,"a"],[2,null,"b"]]')
+		return "FAIL";
+
+	/* The getters share the decoder table of the result */
+	rs = stmt.executeQuery("select 1 as i, true as s union all select 2, false");
+	if (!rs.next() || rs.getInt(1) !== 1 || rs.getBoolean(2) !== true)
+		return "FAIL";
+	if (!rs.next() || rs.getLong("i") !== 2 || rs.getBoolean("s") !== false)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function numericParsing_test() {
+	var conn, stmt, rs, cols;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs = stmt.executeQuery("select 0.1::float8 as d, 1.7976931348623157e308::float8 as max, 5e-324::float8 as tiny, 'NaN'::float8 as nan, '-Infinity'::float8 as inf, 12345678901234567890::numeric as big, 'abc' as s, null::float8 as n");
+	if (!rs.next())
+		return "FAIL";
+
+	if (rs.getNumber(1) !== 0.1 || rs.getDouble("max") !== 1.7976931348623157e308 || rs.getDouble("tiny") !== 5e-324)
+		return "FAIL";
+	if (!isNaN(rs.getNumber("nan")) || rs.getNumber("inf") !== -Infinity)
+		return "FAIL";
+	if (rs.getLong("big") !== 12345678901234567000 || rs.getNumber("big") !== 12345678901234567000)
+		return "FAIL";
+	if (!isNaN(rs.getNumber("s")) || rs.getNumber("n") !== 0 || !rs.wasNull())
+		return "FAIL";
+
+	/* The typed getters refuse values that are not numbers */
+	try {
+		rs.getDouble("s");
+		return "FAIL";
+	} catch (e) {
+	}
+
+	cols = stmt.executeQuery("select x::int4 as i, x / 8.0::float8 as d from generate_series(-3, 3) as x").fetchColumns(10);
+	if (cols[0].values[0] !== -3 || cols[0].values[6] !== 3 || cols[1].values[1] !== -0.25)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function nativeDecoding_test() {
+	var conn, stmt, rs, obj, arr, d;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs = stmt.executeQuery("select '{\"a\": [1, 2], \"b\": null}'::jsonb as j, array[1, null, 3]::int4[] as i, " +
+		"array['x', 'a,b', 'q\"', 'NULL', null] as t, '{{1,2},{3,4}}'::int8[] as m, '[0:1]={t,f}'::bool[] as b, " +
+		"'2024-01-15'::date as d, '2024-01-15 10:20:30.123456+00'::timestamptz as tz, '2024-01-15 10:20:30'::timestamp as ts, " +
+		"'infinity'::date as inf, null::int4[] as n, array['{\"k\": 1}', 'null']::jsonb[] as ja");
+	if (!rs.next())
+		return "FAIL";
+
+	obj = rs.getJSON("j");
+	if (obj.a.length != 2 || obj.a[1] !== 2 || obj.b !== null)
+		return "FAIL";
+
+	arr = rs.getArray("i");
+	if (arr.length != 3 || arr[0] !== 1 || arr[1] !== null || arr[2] !== 3)
+		return "FAIL";
+	arr = rs.getArray("t");
+	if (arr.length != 5 || arr[1] !== "a,b" || arr[2] !== "q\"" || arr[3] !== "NULL" || arr[4] !== null)
+		return "FAIL";
+	arr = rs.getArray("m");
+	if (arr.length != 2 || arr[1].length != 2 || arr[1][0] !== 3)
+		return "FAIL";
+	arr = rs.getArray("b");
+	if (arr.length != 2 || arr[0] !== true || arr[1] !== false)
+		return "FAIL";
+	arr = rs.getArray("ja");
+	if (arr.length != 2 || arr[0].k !== 1 || arr[1] !== null)
+		return "FAIL";
+
+	d = rs.getDate("d");
+	if (d.getFullYear() != 2024 || d.getMonth() != 0 || d.getDate() != 15 || d.getHours() != 0)
+		return "FAIL";
+	if (rs.getTimestamp("tz").getTime() !== Date.UTC(2024, 0, 15, 10, 20, 30, 123))
+		return "FAIL";
+	if (rs.getTimestamp("ts").getTime() !== new Date(2024, 0, 15, 10, 20, 30).getTime())
+		return "FAIL";
+	if (!isNaN(rs.getDate("inf").getTime()))
+		return "FAIL";
+	if (rs.getArray("n") !== null || !rs.wasNull())
+		return "FAIL";
+
+	return "PASS";
+}
+
+function metadata_test() {
+	var conn, stmt, rs, md, pmd;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs = stmt.executeQuery("select 1::int4 as id, 12.5::numeric(10,2) as price, 'x'::varchar(20) as name");
+
+	md = rs.getMetaData();
+	if (md.columnCount != 3 || md.columns[0].name != "id" || md.columns[0].typeName != "int4")
+		return "FAIL";
+	if (md.columns[1].type != 1700 || md.columns[1].precision != 10 || md.columns[1].scale != 2)
+		return "FAIL";
+	if (md.columns[2].typeName != "varchar" || md.columns[2].precision != 20 || md.columns[2].nullable !== null)
+		return "FAIL";
+	if (rs.getMetaData() !== md)
+		return "FAIL";
+
+	stmt = conn.prepareStatement("select * from information_schema.tables where table_name = ? and table_catalog = ?");
+	pmd = stmt.getParameterMetaData();
+	if (pmd.parameterCount != 2 || pmd.parameters.length != 2 || pmd.parameters[0].typeName == null)
+		return "FAIL";
+	if (stmt.getParameterMetaData() !== pmd)
+		return "FAIL";
+
+	return "PASS";
+}
+
+function resultOwnership_test() {
+	var conn, stmt, rs1, rs2;
+
+	conn = getPgsqlConnection();
+	if (conn == null)
+		return "FAIL";
+
+	stmt = conn.createStatement();
+	rs1 = stmt.executeQuery("select generate_series(1, 3) as n");
+	if (!rs1.next() || rs1.getInt("n") != 1)
+		return "FAIL";
+
+	/* Executing the statement again leaves the first result set usable */
+	rs2 = stmt.executeQuery("select 'a' as s union all select 'b'");
+	if (!rs2.next() || rs2.getString("s") != "a")
+		return "FAIL";
+	if (!rs1.next() || rs1.getInt("n") != 2 || !rs1.next() || rs1.getInt("n") != 3 || rs1.next())
+		return "FAIL";
+	if (!rs2.next() || rs2.getString(1) != "b" || rs2.next())
+		return "FAIL";
+
+	stmt = conn.prepareStatement("select ? || 'x' as s");
+	stmt.setString(1, "a");
+	rs1 = stmt.executeQuery();
+	stmt.setString(1, "b");
+	rs2 = stmt.executeQuery();
+	if (!rs1.next() || rs1.getString("s") != "ax" || !rs2.next() || rs2.getString("s") != "bx")
+		return "FAIL";
+
+	/* A failed execution does not invalidate the statement or the result sets */
+	stmt = conn.createStatement();
+	rs1 = stmt.executeQuery("select 1 as n");
+	try {
+		stmt.executeQuery("select * from no_such_table");
+		return "FAIL";
+	} catch (e) {
+	}
+	if (!rs1.next() || rs1.getInt("n") != 1)
+		return "FAIL";
+	rs2 = stmt.executeQuery("select 2 as n");
+	if (!rs2.next() || rs2.getInt("n") != 2)
+		return "FAIL";
+
+	/* A streamed result cut short by a new execution fails, instead of ending early */
+	stmt = conn.createStatement();
+	stmt.setStreaming(true);
+	rs1 = stmt.executeQuery("select generate_series(1, 100000) as n");
+	if (!rs1.next())
+		return "FAIL";
+	rs2 = stmt.executeQuery("select 1 as n");
+	if (!rs2.next() || rs2.getInt("n") != 1)
+		return "FAIL";
+	try {
+		while (rs1.next())
+			;
+		return "FAIL";
+	} catch (e) {
+	}
+
+	return "PASS";
+}
+
 function test() {
 	//integration_test();
 	println("[Test  1] Testing connection ......................................... " + connection_test());
@@ -653,6 +1530,30 @@ function test() {
 	println("[Test 18] Testing getConnection for prepared statement ............... " + preparedStatement_getConnection_test());
 	println("[Test 19] Testing ResultSet for a simple statement  .................. " + simpleStatementResult_test());
 	println("[Test 20] Testing ResultSet for a prepared statement  ................ " + preparedStatementResult_test());
+	println("[Test 21] Testing streaming ResultSet ................................ " + streaming_test());
+	println("[Test 22] Testing cursor based fetching .............................. " + fetchSize_test());
+	println("[Test 23] Testing batch execution for prepared statement ............. " + batch_test());
+	println("[Test 24] Testing COPY FROM STDIN .................................... " + copyIn_test());
+	println("[Test 25] Testing COPY TO STDOUT ..................................... " + copyOut_test());
+	println("[Test 26] Testing placeholders in literals and comments .............. " + placeholders_test());
+	println("[Test 27] Testing LISTEN/NOTIFY ...................................... " + notifications_test());
+	println("[Test 28] Testing getGeneratedKeys for selected columns .............. " + generatedKeyColumns_test());
+	println("[Test 29] Testing setArray for prepared statement .................... " + setArray_test());
+	println("[Test 30] Testing connection options ................................. " + connectionOptions_test());
+	println("[Test 31] Testing toArray and fetchRows .............................. " + toArray_test());
+	println("[Test 32] Testing fetchColumns ....................................... " + fetchColumns_test());
+	println("[Test 33] Testing forEach ............................................ " + forEach_test());
+	println("[Test 34] Testing nextInto ........................................... " + nextInto_test());
+	println("[Test 35] Testing toJSON ............................................. " + toJSON_test());
+	println("[Test 36] Testing writeCSV ........................................... " + writeCSV_test());
+	println("[Test 37] Testing writeArrow ......................................... " + writeArrow_test());
+	println("[Test 38] Testing getBuffer .......................................... " + getBuffer_test());
+	println("[Test 39] Testing typed getters ...................................... " + typedGetters_test());
+	println("[Test 40] Testing the decoder table .................................. " + decoders_test());
+	println("[Test 41] Testing numeric parsing .................................... " + numericParsing_test());
+	println("[Test 42] Testing getJSON, getArray and getDate ...................... " + nativeDecoding_test());
+	println("[Test 43] Testing metadata ........................................... " + metadata_test());
+	println("[Test 44] Testing result ownership ................................... " + resultOwnership_test());
 // 	//TODO add more complex tests (example: create a table, insert an element, get the result and check if it is the one expected)
 	return 0;
 }